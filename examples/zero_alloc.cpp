@@ -0,0 +1,177 @@
+/* Checks that polling a GPSDO does not allocate once warmed up
+ *
+ * A pseudo terminal stands in for the device: a responder thread echoes each
+ * command and answers it in the format of a Jackson Labs GPSDO. Allocations
+ * made by the polling thread are counted by replacing operator new.
+ *
+ * Build and run from the root of the repository:
+ *
+ *   g++ -std=c++11 -O2 -DCYRIAL_NO_PYTHON -Iinclude examples/zero_alloc.cpp \
+ *       -o zero_alloc -lutil -pthread && ./zero_alloc
+ *
+ * Also define CYRIAL_TRACE to check the traced build. Exits with status 1 if
+ * any allocation was counted
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pty.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "cyrial/manager.hpp"
+#include "cyrial/telemetry/sampler.hpp"
+
+static thread_local bool counting = false;
+static std::atomic<long> allocations(0);
+
+void* operator new(size_t size)
+{
+  if (counting)
+    ++allocations;
+
+  void* p = std::malloc(size ? size : 1);
+
+  if (p == nullptr)
+    throw std::bad_alloc();
+
+  return p;
+}
+
+// Not inlined, so that GCC does not mistake the replacement pair for a
+// mismatched new and free
+__attribute__((noinline)) void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept
+{
+  std::free(p);
+}
+
+// Answers each command line written to the pseudo terminal
+static void respond(int master, const std::atomic<bool>& stop)
+{
+  std::string received;
+  char buffer[256];
+
+  while (!stop)
+  {
+    pollfd p{ master, POLLIN, 0 };
+
+    if (poll(&p, 1, 50) <= 0)
+      continue;
+
+    ssize_t n = ::read(master, buffer, sizeof(buffer));
+
+    if (n <= 0)
+      continue;
+
+    received.append(buffer, n);
+
+    size_t end;
+
+    while ((end = received.find("\r\n")) != std::string::npos)
+    {
+      std::string command = received.substr(0, end);
+      received.erase(0, end + 2);
+
+      std::string reply = command + "\r\n"
+        + (command == "SYNC:SOUR:STATE?" ? "GPS" : "12.5") + "\r\nscpi>\r\n";
+
+      if (::write(master, reply.data(), reply.size()) < 0)
+        return;
+    }
+  }
+}
+
+// Runs f with allocations on this thread counted, returning their number
+template <typename F>
+static long count_allocations(F f)
+{
+  long before = allocations;
+
+  counting = true;
+  f();
+  counting = false;
+
+  return allocations - before;
+}
+
+int main()
+{
+  using namespace cyrial;
+
+  const int polls = 50;
+
+  int master, slave;
+  char name[256];
+
+  if (openpty(&master, &slave, name, nullptr, nullptr) != 0)
+  {
+    std::perror("openpty");
+    return 2;
+  }
+
+  std::atomic<bool> stop(false);
+  std::thread responder(respond, master, std::cref(stop));
+
+  long polling, setting;
+
+  {
+    manager m(false);
+    std::shared_ptr<interface> port = m.open(name);
+    gpsdo_device dev(port);
+    std::vector<sample> out;
+
+    port->set_timeout(10);
+
+    // Warm up: buffers grow to the longest command and response seen
+    for (int i = 0; i < 3; ++i)
+    {
+      out.clear();
+      sample_gpsdo(dev, 1, out);
+    }
+
+    dev.serv_efcs(6.0);
+    dev.gps_gpgga(1);
+
+    if (out.empty())
+    {
+      std::fprintf(stderr, "no samples parsed from the responder\n");
+      stop = true;
+      responder.join();
+      return 2;
+    }
+
+    polling = count_allocations([&]() {
+      for (int i = 0; i < polls; ++i)
+      {
+        out.clear();
+        sample_gpsdo(dev, 1, out);
+      }
+    });
+
+    setting = count_allocations([&]() {
+      dev.serv_efcs(6.0);
+      dev.gps_gpgga(1);
+    });
+  }
+
+  stop = true;
+  responder.join();
+  ::close(slave);
+  ::close(master);
+
+  std::printf("allocations in %d polls: %ld\n", polls, polling);
+  std::printf("allocations in setters: %ld\n", setting);
+
+  return polling == 0 && setting == 0 ? 0 : 1;
+}
@@ -0,0 +1,267 @@
+#ifndef CYRIAL_CALIBRATION_AGING_HPP
+#define CYRIAL_CALIBRATION_AGING_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "../devices/gpsdo.hpp"
+#include "../telemetry/sample.hpp"
+
+namespace cyrial
+{
+
+/* @struct coefficient_estimate
+ *
+ * @brief An estimated coefficient with a symmetric confidence bound
+ */
+struct coefficient_estimate
+{
+  double value;
+  double bound;       // Half-width of the confidence interval
+  bool valid;         // Whether the bound is within the configured limit
+};
+
+/* @struct aging_config
+ *
+ * @brief Parameters of an aging_estimator
+ *
+ * The estimator works in EFC units (as reported by DIAG:ROSC:EFC:ABS?) per
+ * day and per degree. The scales convert these into the units of SERV:AGING
+ * and SERV:TEMPCO, which depend on the oscillator, and may be negative if
+ * the device applies compensation with the opposite sign
+ */
+struct aging_config
+{
+  // Device whose EFC is modelled, and the device and metric which provide
+  // temperature (e.g. a co-located CSAC's csac_temp), any_source for none
+  uint32_t efc_source = 0;
+  uint32_t temp_source = any_source;
+  uint16_t temp_metric = metric::csac_temp;
+
+  // Temperature readings older than this (ns) are not paired with EFC. When
+  // temp_source is set, EFC samples without a fresh reading are not used
+  uint64_t max_temp_age = 60000000000ull;
+
+  // Whether EFC samples are used before the first sync_lock sample of the
+  // device has been seen, e.g. when lock is not part of the telemetry
+  bool assume_locked = false;
+
+  // Forgetting factor; 1.0 weighs all history equally, smaller values track
+  // slowly changing coefficients
+  double forgetting = 1.0;
+
+  // Number of standard deviations spanned by the bounds (1.96: 95%)
+  double confidence = 1.96;
+
+  // Estimates are valid once this many samples have been used and their
+  // bound is at most this limit, in device units
+  uint64_t min_samples = 1000;
+  double max_aging_bound = 0.5;
+  double max_tempco_bound = 50.0;
+
+  double aging_scale = 1.0;
+  double tempco_scale = 1.0;
+};
+
+/* @class aging_estimator
+ *
+ * @brief Class to estimate the aging and temperature coefficients of a
+ *        GPSDO's oscillator online
+ *
+ * While the device is locked its EFC tracks the frequency error of the
+ * oscillator, which is modelled as
+ *
+ *   efc(t) = e0 + aging * t + tempco * (T(t) - T0)
+ *
+ * and fitted by recursive least squares as efc_abs samples arrive, in
+ * constant memory. Samples are ignored until the device reports lock
+ * (sync_lock), and while it reports none. When a temperature source is
+ * configured, samples without a fresh temperature reading are ignored too,
+ * rather than being attributed to T0
+ */
+class aging_estimator : public sample_sink
+{
+  aging_config config;
+
+  double theta[3];    // e0, aging per day, tempco per degree
+  double p[3][3];     // Covariance of theta, up to the residual variance
+
+  double sse;         // Weighted sum of squared residuals
+  double weight;      // Effective number of samples
+  uint64_t used;
+  uint64_t used_with_temp;
+
+  uint64_t origin;    // Time of the first sample used
+  bool locked;
+
+  double temp;
+  uint64_t temp_time;
+  double temp_ref;
+  bool temp_known;
+
+  void update(const double x[3], double y)
+  {
+    double px[3];
+
+    for (int i = 0; i < 3; ++i)
+      px[i] = p[i][0] * x[0] + p[i][1] * x[1] + p[i][2] * x[2];
+
+    double denom = config.forgetting + x[0] * px[0] + x[1] * px[1]
+                                     + x[2] * px[2];
+    double error = y - (theta[0] * x[0] + theta[1] * x[1] + theta[2] * x[2]);
+
+    for (int i = 0; i < 3; ++i)
+      theta[i] += px[i] / denom * error;
+
+    for (int i = 0; i < 3; ++i)
+      for (int j = 0; j < 3; ++j)
+        p[i][j] = (p[i][j] - px[i] * px[j] / denom) / config.forgetting;
+
+    // A priori times a posteriori error, the exact residual recursion
+    double posterior = y - (theta[0] * x[0] + theta[1] * x[1]
+                                            + theta[2] * x[2]);
+
+    sse = config.forgetting * sse + error * posterior;
+    weight = config.forgetting * weight + 1.0;
+    ++used;
+  }
+
+  coefficient_estimate estimate(int i, double scale, double limit,
+      uint64_t n) const
+  {
+    double variance = weight > 3.0 ? std::max(sse, 0.0) / (weight - 3.0)
+                                   : 0.0;
+    double bound = config.confidence * std::sqrt(variance * p[i][i])
+                                                         * std::fabs(scale);
+
+    return coefficient_estimate{ theta[i] * scale, bound,
+                                 n >= config.min_samples && bound <= limit };
+  }
+
+public:
+  /* @brief Constructor for aging_estimator
+   *
+   * @param cfg Sources of the data and limits of the estimates
+   */
+  aging_estimator(const aging_config& cfg=aging_config())
+    : config(cfg)
+  {
+    reset();
+  }
+
+  /* @brief Function to discard all history, e.g. after the oscillator or its
+   *        environment has changed
+   */
+  void reset()
+  {
+    for (int i = 0; i < 3; ++i)
+    {
+      theta[i] = 0.0;
+
+      for (int j = 0; j < 3; ++j)
+        p[i][j] = i == j ? 1e6 : 0.0;
+    }
+
+    sse = weight = 0.0;
+    used = used_with_temp = origin = 0;
+    locked = config.assume_locked;
+    temp = temp_ref = 0.0;
+    temp_time = 0;
+    temp_known = false;
+  }
+
+  void push(const sample& s) override
+  {
+    if (s.source == config.temp_source && s.metric == config.temp_metric)
+    {
+      if (!temp_known)
+        temp_ref = s.value;
+
+      temp = s.value;
+      temp_time = s.time;
+      temp_known = true;
+    }
+
+    if (s.source != config.efc_source)
+      return;
+
+    if (s.metric == metric::sync_lock)
+      locked = s.value != 0.0;
+
+    if (s.metric != metric::efc_abs || !locked)
+      return;
+
+    bool fresh = temp_known && s.time <= temp_time + config.max_temp_age
+                            && temp_time <= s.time + config.max_temp_age;
+
+    if (config.temp_source != any_source && !fresh)
+      return;
+
+    if (used == 0)
+      origin = s.time;
+
+    double x[3] = { 1.0, (double)(int64_t)(s.time - origin) / 86400e9,
+                    fresh ? temp - temp_ref : 0.0 };
+
+    update(x, s.value);
+
+    if (fresh)
+      ++used_with_temp;
+  }
+
+  /* @brief Function to get the aging estimate in SERV:AGING units
+   */
+  coefficient_estimate aging() const
+  {
+    return estimate(1, config.aging_scale, config.max_aging_bound, used);
+  }
+
+  /* @brief Function to get the temperature coefficient estimate in
+   *        SERV:TEMPCO units
+   */
+  coefficient_estimate tempco() const
+  {
+    return estimate(2, config.tempco_scale, config.max_tempco_bound,
+                    used_with_temp);
+  }
+
+  /* @brief Function to get the number of EFC samples used
+   */
+  uint64_t samples() const
+  {
+    return used;
+  }
+
+  /* @brief Function to apply the valid estimates to a device, clamped to the
+   *        ranges accepted by @gpsdo_device::serv_aging and
+   *        @gpsdo_device::serv_tempco
+   *
+   * @param dev The GPSDO whose EFC was modelled
+   * @return Whether any coefficient was written to the device
+   */
+  bool apply(gpsdo_device& dev) const
+  {
+    namespace c = gpsdo_command;
+
+    coefficient_estimate a = aging();
+    coefficient_estimate t = tempco();
+    bool applied = false;
+
+    if (a.valid)
+      applied |= dev.scpi_set(c::serv_aging,
+                              std::min(std::max(a.value, c::serv_aging.min),
+                                       c::serv_aging.max));
+
+    if (t.valid)
+      applied |= dev.scpi_set(c::serv_tempco,
+                              std::min(std::max(t.value, c::serv_tempco.min),
+                                       c::serv_tempco.max));
+
+    return applied;
+  }
+};
+
+} // namespace cyrial
+
+#endif // CYRIAL_CALIBRATION_AGING_HPP
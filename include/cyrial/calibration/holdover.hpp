@@ -0,0 +1,463 @@
+#ifndef CYRIAL_CALIBRATION_HOLDOVER_HPP
+#define CYRIAL_CALIBRATION_HOLDOVER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../csv.hpp"
+#include "../devices/gpsdo.hpp"
+#include "../telemetry/sample.hpp"
+
+namespace cyrial
+{
+
+/* @class phase_fit
+ *
+ * @brief Class to fit a quadratic phase model x(t) = a + b t + c t^2 to
+ *        phase readings incrementally
+ *
+ * Only the sums of the normal equations are kept, so adding a reading is O(1)
+ * and the fit can be solved at any time. Time is scaled to hours internally
+ * to keep the normal equations well conditioned over long runs; coefficients
+ * are reported in seconds. b is the fractional frequency offset and 2c the
+ * frequency drift rate (aging) per second
+ */
+class phase_fit
+{
+  static constexpr double scale = 3600.0;
+
+  double s[5];        // Sums of t^k, k = 0..4
+  double sx[3];       // Sums of x t^k, k = 0..2
+  double sxx;
+
+  double origin;      // First phase reading, subtracted from every reading
+  double coef[3];     // Solution in scaled time, valid when solved
+  bool solved;
+
+  bool solve()
+  {
+    if (s[0] < 3)
+      return false;
+
+    // Gaussian elimination with partial pivoting on the 3x3 system
+    double m[3][4] = { { s[0], s[1], s[2], sx[0] },
+                       { s[1], s[2], s[3], sx[1] },
+                       { s[2], s[3], s[4], sx[2] } };
+
+    for (int col = 0; col < 3; ++col)
+    {
+      int pivot = col;
+
+      for (int row = col + 1; row < 3; ++row)
+        if (std::fabs(m[row][col]) > std::fabs(m[pivot][col]))
+          pivot = row;
+
+      if (m[pivot][col] == 0.0)
+        return false;
+
+      for (int k = 0; k < 4; ++k)
+        std::swap(m[col][k], m[pivot][k]);
+
+      for (int row = col + 1; row < 3; ++row)
+      {
+        double f = m[row][col] / m[col][col];
+
+        for (int k = col; k < 4; ++k)
+          m[row][k] -= f * m[col][k];
+      }
+    }
+
+    for (int row = 2; row >= 0; --row)
+    {
+      double v = m[row][3];
+
+      for (int k = row + 1; k < 3; ++k)
+        v -= m[row][k] * coef[k];
+
+      coef[row] = v / m[row][row];
+    }
+
+    return true;
+  }
+
+public:
+  phase_fit()
+  {
+    reset();
+  }
+
+  void reset()
+  {
+    for (double& v : s)  v = 0.0;
+    for (double& v : sx) v = 0.0;
+    for (double& v : coef) v = 0.0;
+    sxx = origin = 0.0;
+    solved = false;
+  }
+
+  /* @brief Function to add a phase reading
+   *
+   * @param t Time of the reading in seconds since the start of the run
+   * @param x Phase (time interval) in seconds
+   */
+  void add(double t, double x)
+  {
+    if (s[0] == 0)
+      origin = x;
+
+    t /= scale;
+    x -= origin;
+
+    double tk = 1.0;
+
+    for (int k = 0; k < 5; ++k)
+    {
+      s[k] += tk;
+
+      if (k < 3)
+        sx[k] += x * tk;
+
+      tk *= t;
+    }
+
+    sxx += x * x;
+    solved = false;
+  }
+
+  /* @brief Function to get the number of readings
+   */
+  size_t count() const
+  {
+    return (size_t)s[0];
+  }
+
+  /* @brief Function to get the coefficients of the fit
+   *
+   * @param a Phase at the start of the run in seconds
+   * @param b Fractional frequency offset
+   * @param c Half the frequency drift rate per second
+   * @return Whether enough readings were available to fit
+   */
+  bool coefficients(double& a, double& b, double& c)
+  {
+    if (!solved)
+      solved = solve();
+
+    if (!solved)
+      return false;
+
+    a = coef[0] + origin;
+    b = coef[1] / scale;
+    c = coef[2] / (scale * scale);
+
+    return true;
+  }
+
+  /* @brief Function to evaluate the fit
+   *
+   * @param t Seconds since the start of the run
+   * @return The predicted phase in seconds
+   */
+  double predict(double t)
+  {
+    double a, b, c;
+
+    if (!coefficients(a, b, c))
+      return origin;
+
+    return a + b * t + c * t * t;
+  }
+
+  /* @brief Function to get the RMS of the residuals of the fit in seconds
+   */
+  double residual_rms()
+  {
+    double a, b, c;
+
+    if (!coefficients(a, b, c) || s[0] <= 3)
+      return 0.0;
+
+    double ssr = sxx - coef[0] * sx[0] - coef[1] * sx[1] - coef[2] * sx[2];
+
+    return ssr > 0.0 ? std::sqrt(ssr / (s[0] - 3)) : 0.0;
+  }
+};
+
+/* @struct holdover_config
+ *
+ * @brief Parameters of a holdover characterization run
+ */
+struct holdover_config
+{
+  // Length of the forced holdover
+  std::chrono::seconds duration{ 4 * 3600 };
+
+  // Minimum time between phase readings, zero to read back to back as fast
+  // as the link allows
+  std::chrono::milliseconds min_interval{ 0 };
+
+  // Whether a device must report lock before holdover is forced
+  bool require_lock = true;
+
+  // Consecutive unreadable responses after which a device is abandoned
+  size_t max_failures = 20;
+};
+
+/* @struct holdover_result
+ *
+ * @brief Outcome of a holdover run on one device
+ *
+ * Phase errors are relative to the phase at the start of holdover
+ */
+struct holdover_result
+{
+  std::string name;
+  uint32_t source;
+  std::string error;          // Empty on success
+
+  uint64_t start;             // Start of holdover, ns since the Unix epoch
+  double duration;            // Seconds spent in holdover
+  size_t readings;
+  size_t failures;            // Unreadable responses
+
+  double final_error;         // Seconds
+  double max_error;           // Largest magnitude, seconds
+
+  double freq_offset;         // Fractional frequency at the start of holdover
+  double drift_per_day;       // Change in fractional frequency per day
+  double residual_rms;        // Seconds
+  double predicted_24h;       // Fitted phase error after a day, seconds
+
+  bool ok() const
+  {
+    return error.empty();
+  }
+};
+
+/* @class holdover_harness
+ *
+ * @brief Class to characterize the holdover performance of many GPSDOs at
+ *        once
+ *
+ * Each device runs on its own thread: lock is checked, holdover is forced
+ * with @gpsdo_device::sync_hold_init, SYNC:TINT? is read for the configured
+ * duration while a quadratic phase model is fitted, and the device is always
+ * returned to normal operation with @gpsdo_device::sync_hold_rec_init, even
+ * if the run fails or is stopped. Readings may also be forwarded to a sample
+ * sink (e.g. a segment_writer) for later analysis
+ */
+class holdover_harness
+{
+  struct unit
+  {
+    std::shared_ptr<gpsdo_device> dev;
+    uint32_t source;
+    std::string name;
+  };
+
+  holdover_config config;
+  sample_sink* sink;
+
+  std::vector<unit> units;
+  std::mutex sink_mutex;
+  std::atomic<bool> stopping;
+
+  void forward(const sample& s)
+  {
+    if (!sink)
+      return;
+
+    std::lock_guard<std::mutex> lock(sink_mutex);
+    sink->push(s);
+  }
+
+  void characterize(const unit& u, holdover_result& r)
+  {
+    typedef std::chrono::steady_clock clock;
+
+    phase_fit fit;
+    double initial = 0.0;
+    bool holding = false;
+
+    r = holdover_result();
+    r.name = u.name;
+    r.source = u.source;
+
+    try
+    {
+      double value;
+
+      if (config.require_lock
+          && (!parse_number(u.dev->sync_lock(), value) || value == 0.0))
+        throw std::runtime_error("not locked");
+
+      u.dev->sync_hold_init();
+      holding = true;
+      r.start = now_ns();
+
+      clock::time_point deadline = clock::now() + config.duration;
+      size_t consecutive = 0;
+
+      while (!stopping && clock::now() < deadline)
+      {
+        clock::time_point next = clock::now() + config.min_interval;
+        std::string response = u.dev->sync_tint();
+        uint64_t time = now_ns();
+
+        if (!parse_number(response, value))
+        {
+          ++r.failures;
+
+          if (++consecutive >= config.max_failures)
+            throw std::runtime_error("no phase readings");
+
+          continue;
+        }
+
+        consecutive = 0;
+
+        if (fit.count() == 0)
+          initial = value;
+
+        double error = value - initial;
+        fit.add((time - r.start) * 1e-9, value);
+        forward(sample{ time, u.source, metric::sync_tint, value });
+
+        r.duration = (time - r.start) * 1e-9;
+        r.final_error = error;
+
+        if (std::fabs(error) > std::fabs(r.max_error))
+          r.max_error = error;
+
+        if (config.min_interval.count())
+          std::this_thread::sleep_until(next);
+      }
+    }
+    catch (const std::exception& e)
+    {
+      r.error = e.what();
+    }
+
+    if (holding)
+    {
+      try
+      {
+        u.dev->sync_hold_rec_init();
+      }
+      catch (const std::exception& e)
+      {
+        if (r.error.empty())
+          r.error = std::string("recovery failed: ") + e.what();
+      }
+    }
+
+    double a, b, c;
+    r.readings = fit.count();
+
+    if (fit.coefficients(a, b, c))
+    {
+      r.freq_offset = b;
+      r.drift_per_day = 2.0 * c * 86400.0;
+      r.residual_rms = fit.residual_rms();
+      r.predicted_24h = fit.predict(86400.0) - a;
+    }
+    else if (r.error.empty())
+      r.error = "too few readings";
+  }
+
+public:
+  /* @brief Constructor for holdover_harness
+   *
+   * @param cfg Parameters of the run
+   * @param output Sink to which every phase reading is forwarded, or nullptr
+   */
+  holdover_harness(const holdover_config& cfg=holdover_config(),
+      sample_sink* output=nullptr)
+    : config(cfg), sink(output), stopping(false)
+  { }
+
+  /* @brief Function to add a device to the run
+   *
+   * @param dev The GPSDO
+   * @param source Identifier attached to its readings
+   * @param name Name used in the report, e.g. its serial number
+   */
+  void add(std::shared_ptr<gpsdo_device> dev, uint32_t source,
+      const std::string& name="")
+  {
+    units.push_back(unit{ dev, source,
+                          name.empty() ? std::to_string(source) : name });
+  }
+
+  /* @brief Function to characterize every device concurrently, returning
+   *        when all have finished
+   *
+   * @return One result per device, in the order they were added
+   */
+  std::vector<holdover_result> run()
+  {
+    std::vector<holdover_result> results(units.size());
+    std::vector<std::thread> threads;
+
+    stopping = false;
+
+    for (size_t i = 0; i < units.size(); ++i)
+      threads.emplace_back(&holdover_harness::characterize, this,
+                           std::cref(units[i]), std::ref(results[i]));
+
+    for (auto& t : threads)
+      t.join();
+
+    return results;
+  }
+
+  /* @brief Function to end a run early, e.g. from a signal handler thread;
+   *        devices are still recovered and results reported
+   */
+  void stop()
+  {
+    stopping = true;
+  }
+};
+
+/* @brief Function to write the results of a run as CSV, one line per device
+ *
+ * @param out Stream to write to
+ * @param results The results
+ */
+inline void write_holdover_report(std::ostream& out,
+    const std::vector<holdover_result>& results)
+{
+  out << "name,source,status,duration_s,readings,failures,final_error_s,"
+         "max_error_s,freq_offset,drift_per_day,residual_rms_s,"
+         "predicted_24h_s\n";
+
+  char line[256];
+
+  for (const auto& r : results)
+  {
+    std::snprintf(line, sizeof(line),
+                  ",%.0f,%zu,%zu,%.4e,%.4e,%.4e,%.4e,%.4e,%.4e\n",
+                  r.duration, r.readings, r.failures, r.final_error,
+                  r.max_error, r.freq_offset, r.drift_per_day,
+                  r.residual_rms, r.predicted_24h);
+
+    out << csv_field(r.name) << ',' << r.source << ','
+        << (r.ok() ? "ok" : csv_field(r.error)) << line;
+  }
+}
+
+} // namespace cyrial
+
+#endif // CYRIAL_CALIBRATION_HOLDOVER_HPP
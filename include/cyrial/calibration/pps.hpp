@@ -0,0 +1,320 @@
+#ifndef CYRIAL_CALIBRATION_PPS_HPP
+#define CYRIAL_CALIBRATION_PPS_HPP
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../csv.hpp"
+#include "../manager.hpp"
+#include "../devices/gpsdo.hpp"
+#include "../telemetry/rollup.hpp"
+#include "../telemetry/sample.hpp"
+
+namespace cyrial
+{
+
+/* @brief Resolution of @gpsdo_device::serv_1pps in seconds
+ */
+const double pps_step = 16.7e-9;
+
+/* @struct pps_trim_config
+ *
+ * @brief Parameters of a 1PPS trim
+ */
+struct pps_trim_config
+{
+  // SYNC:TINT? updates once per second, so faster reading only repeats values
+  std::chrono::milliseconds interval{ 1000 };
+
+  // Averaging stops once the standard error of the mean offset is below the
+  // target, but never before min_readings nor after max_readings
+  size_t min_readings = 30;
+  size_t max_readings = 600;
+  double target_error = 2e-9;
+
+  // Time allowed for the new offset to take effect before verification
+  std::chrono::seconds settle{ 5 };
+
+  // Sign relating SYNC:TINT? to the 1PPS offset: with +1 a positive TINT is
+  // removed by decreasing the offset
+  double sign = 1.0;
+
+  // Consecutive unreadable responses after which a device is abandoned
+  size_t max_failures = 20;
+};
+
+/* @struct pps_calibration
+ *
+ * @brief Record of a 1PPS trim of one device
+ */
+struct pps_calibration
+{
+  std::string name;
+  uint32_t source;
+  std::string error;          // Empty on success
+
+  uint64_t time;              // Completion, ns since the Unix epoch
+
+  long steps_before;          // SERV:1PPS setting, in 16.7 ns steps
+  long steps_after;
+
+  double offset_before;       // Mean TINT, seconds
+  double error_before;        // Standard error of offset_before
+  size_t readings_before;
+
+  double offset_after;
+  double error_after;
+  size_t readings_after;
+
+  // Residual offset within half a step, widened by three standard errors
+  // of offset_after so that measurement noise alone does not fail a trim
+  bool verified;
+
+  bool ok() const
+  {
+    return error.empty();
+  }
+};
+
+/* @class pps_trimmer
+ *
+ * @brief Class to trim the 1PPS offset of GPSDOs from their measured offset
+ *        to GPS time
+ *
+ * SYNC:TINT? is averaged until the standard error of the mean is small enough,
+ * the nearest whole number of 16.7 ns steps is applied through
+ * @gpsdo_device::serv_1pps, and the offset is measured again to verify the
+ * correction. Readings are treated as independent, which holds for the
+ * white phase noise of the 1PPS comparison that dominates over such short
+ * averages
+ */
+class pps_trimmer
+{
+  pps_trim_config config;
+  sample_sink* sink;
+  std::mutex sink_mutex;
+
+  aggregate measure(gpsdo_device& dev, uint32_t source)
+  {
+    typedef std::chrono::steady_clock clock;
+
+    aggregate a;
+    a.reset(now_ns());
+
+    size_t consecutive = 0;
+
+    while (a.count < config.max_readings)
+    {
+      clock::time_point next = clock::now() + config.interval;
+      double value;
+      uint64_t time = now_ns();
+
+      if (!parse_number(dev.sync_tint(), value))
+      {
+        if (++consecutive >= config.max_failures)
+          throw std::runtime_error("no offset readings");
+      }
+      else
+      {
+        consecutive = 0;
+        a.add(time, value);
+
+        if (sink)
+        {
+          std::lock_guard<std::mutex> lock(sink_mutex);
+          sink->push(sample{ time, source, metric::sync_tint, value });
+        }
+
+        if (a.count >= config.min_readings
+            && a.stddev() / std::sqrt((double)a.count) <= config.target_error)
+          break;
+      }
+
+      std::this_thread::sleep_until(next);
+    }
+
+    return a;
+  }
+
+public:
+  /* @brief Constructor for pps_trimmer
+   *
+   * @param cfg Parameters of the trim
+   * @param output Sink to which every offset reading is forwarded, or nullptr
+   */
+  pps_trimmer(const pps_trim_config& cfg=pps_trim_config(),
+      sample_sink* output=nullptr)
+    : config(cfg), sink(output)
+  { }
+
+  /* @brief Function to trim one device
+   *
+   * @param dev The GPSDO, which should be locked
+   * @param source Identifier attached to its readings
+   * @param name Name recorded with the calibration, e.g. its serial number
+   * @return The calibration record
+   */
+  pps_calibration trim(gpsdo_device& dev, uint32_t source,
+      const std::string& name)
+  {
+    pps_calibration c = pps_calibration();
+    c.name = name;
+    c.source = source;
+
+    try
+    {
+      double current;
+
+      if (!parse_number(dev.serv_1pps(), current))
+        throw std::runtime_error("1PPS offset unreadable");
+
+      // SERV:1PPS? reports nanoseconds
+      c.steps_before = c.steps_after = std::lround(current * 1e-9 / pps_step);
+
+      aggregate before = measure(dev, source);
+      c.offset_before = before.mean;
+      c.error_before = before.stddev() / std::sqrt((double)before.count);
+      c.readings_before = before.count;
+
+      long correction = std::lround(config.sign * c.offset_before / pps_step);
+      c.steps_after = c.steps_before - correction;
+
+      if (correction != 0)
+      {
+        dev.serv_1pps((int)c.steps_after);
+        std::this_thread::sleep_for(config.settle);
+      }
+
+      aggregate after = measure(dev, source);
+      c.offset_after = after.mean;
+      c.error_after = after.stddev() / std::sqrt((double)after.count);
+      c.readings_after = after.count;
+
+      c.verified = std::fabs(c.offset_after)
+                     <= pps_step / 2 + 3 * c.error_after;
+
+      if (!c.verified)
+        c.error = "residual offset exceeds half a step plus three standard "
+                  "errors";
+    }
+    catch (const std::exception& e)
+    {
+      c.error = e.what();
+    }
+
+    c.time = now_ns();
+
+    return c;
+  }
+
+  /* @brief Function to trim every Jackson Labs GPSDO connected to a manager
+   *        concurrently
+   *
+   * Devices are identified by *IDN?, and named by their serial number
+   *
+   * @param m The manager
+   * @return One record per GPSDO found
+   */
+  std::vector<pps_calibration> trim_all(manager& m)
+  {
+    std::vector<std::shared_ptr<gpsdo_device>> units;
+    std::vector<uint32_t> sources;
+    std::vector<std::string> names;
+
+    for (size_t i = 0; i < m.num_dev(); ++i)
+    {
+      std::shared_ptr<interface> port = m.dev(i);
+
+      // Closed, e.g. unplugged
+      if (!port)
+        continue;
+
+      scpi_device probe(port);
+
+      std::string id = probe.idn();
+
+      if (id.find("Jackson") == std::string::npos)
+        continue;
+
+      units.push_back(std::make_shared<gpsdo_device>(port));
+      sources.push_back(i);
+      names.push_back(idn_serial(id));
+    }
+
+    std::vector<pps_calibration> results(units.size());
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < units.size(); ++i)
+      threads.emplace_back([&, i]() {
+        results[i] = trim(*units[i], sources[i],
+                          names[i].empty() ? std::to_string(sources[i])
+                                           : names[i]);
+      });
+
+    for (auto& t : threads)
+      t.join();
+
+    return results;
+  }
+};
+
+/* @brief Function to write calibration records as CSV
+ *
+ * @param out Stream to write to
+ * @param records The records
+ * @param header Whether to write the column names first
+ */
+inline void write_pps_report(std::ostream& out,
+    const std::vector<pps_calibration>& records, bool header=true)
+{
+  if (header)
+    out << "name,source,time_ns,status,steps_before,steps_after,"
+           "offset_before_s,error_before_s,readings_before,offset_after_s,"
+           "error_after_s,readings_after\n";
+
+  char line[256];
+
+  for (const auto& c : records)
+  {
+    std::snprintf(line, sizeof(line),
+                  ",%ld,%ld,%.4e,%.2e,%zu,%.4e,%.2e,%zu\n",
+                  c.steps_before, c.steps_after, c.offset_before,
+                  c.error_before, c.readings_before, c.offset_after,
+                  c.error_after, c.readings_after);
+
+    out << csv_field(c.name) << ',' << c.source << ',' << c.time << ','
+        << (c.ok() ? "ok" : csv_field(c.error)) << line;
+  }
+}
+
+/* @brief Function to append calibration records to a CSV log, creating it
+ *        with a header if necessary
+ *
+ * @param path Location of the log
+ * @param records The records
+ */
+inline void record_pps_calibration(const std::string& path,
+    const std::vector<pps_calibration>& records)
+{
+  bool exists = std::ifstream(path).good();
+  std::ofstream out(path, std::ios::app);
+
+  if (!out)
+    throw std::runtime_error("Failed to open " + path);
+
+  write_pps_report(out, records, !exists);
+}
+
+} // namespace cyrial
+
+#endif // CYRIAL_CALIBRATION_PPS_HPP
@@ -0,0 +1,384 @@
+#ifndef CYRIAL_CALIBRATION_SERVO_HPP
+#define CYRIAL_CALIBRATION_SERVO_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../devices/gpsdo.hpp"
+#include "../telemetry/series.hpp"
+
+namespace cyrial
+{
+
+/* @brief Function to compute the overlapping Allan deviation of phase data
+ *
+ * @param phase Phase readings in seconds, evenly spaced
+ * @param m Averaging factor, tau = m * tau0
+ * @param tau0 Spacing of the readings in seconds
+ * @return The deviation, or NaN if there are too few readings
+ */
+inline double overlapping_adev(const std::vector<double>& phase, size_t m,
+    double tau0=1.0)
+{
+  if (m == 0 || phase.size() <= 2 * m)
+    return std::numeric_limits<double>::quiet_NaN();
+
+  size_t n = phase.size() - 2 * m;
+  double sum = 0.0;
+
+  for (size_t i = 0; i < n; ++i)
+  {
+    double d = phase[i + 2 * m] - 2.0 * phase[i + m] + phase[i];
+    sum += d * d;
+  }
+
+  double tau = m * tau0;
+
+  return std::sqrt(sum / (2.0 * tau * tau * n));
+}
+
+/* @struct servo_params
+ *
+ * @brief A candidate setting of the GPSDO servo loop, see
+ *        @gpsdo_device::serv_efcs, @gpsdo_device::serv_efcd and
+ *        @gpsdo_device::serv_phaseco
+ */
+struct servo_params
+{
+  double efcs;        // Proportional gain, [0.0, 500.0]
+  double efcd;        // DAC low pass filter, [0.0, 4000.0]
+  double phaseco;     // Integral gain, [-100.0, 100.0]
+};
+
+/* @struct servo_model
+ *
+ * @brief Discrete (1 s) model of the GPSDO's phase locked loop
+ *
+ * The measured phase is low pass filtered with a time constant of efcd
+ * seconds, and the frequency correction is proportional (efcs) plus integral
+ * (phaseco) in the filtered phase. The gain scales map the device's unitless
+ * coefficients onto fractional frequency, and should be matched to the
+ * oscillator's EFC sensitivity; the defaults place the typical values from
+ * the GPSDO documentation near critical damping
+ */
+struct servo_model
+{
+  double prop_scale = 1e-3;       // Fractional frequency per s of phase
+  double int_scale = 1e-6;        // Fractional frequency per s of summed phase
+  double range = 1e-6;            // Limit of the frequency correction
+
+  double step = 100e-9;           // Initial phase error, s
+  double tolerance = 10e-9;       // Phase error counted as settled, s
+  double divergence = 1e-3;       // Phase error counted as unstable, s
+};
+
+/* @struct servo_disturbance
+ *
+ * @brief Per-second inputs of a closed loop simulation
+ *
+ * frequency is the fractional frequency the oscillator would have without
+ * correction, and noise the error of each phase measurement (e.g. GPS 1PPS
+ * jitter)
+ */
+struct servo_disturbance
+{
+  std::vector<double> frequency;
+  std::vector<double> noise;
+};
+
+/* @struct oscillator_noise
+ *
+ * @brief Noise model used to synthesize a servo_disturbance
+ */
+struct oscillator_noise
+{
+  double white_fm = 1e-11;        // Allan deviation at 1 s
+  double random_walk_fm = 1e-13;  // Frequency step deviation per s
+  double aging = 1e-10;           // Fractional frequency drift per day
+  double offset = 1e-9;           // Initial fractional frequency offset
+  double measurement = 15e-9;     // RMS phase measurement noise, s
+};
+
+/* @brief Function to synthesize the disturbance seen by a servo loop
+ *
+ * @param noise The noise model of the oscillator and reference
+ * @param seconds The length of the simulation
+ * @param seed Seed of the random number generator
+ * @return The disturbance
+ */
+inline servo_disturbance simulate_disturbance(const oscillator_noise& noise,
+    size_t seconds, uint32_t seed=1)
+{
+  std::mt19937 gen(seed);
+  std::normal_distribution<double> normal(0.0, 1.0);
+  servo_disturbance d;
+  double walk = noise.offset;
+
+  d.frequency.reserve(seconds);
+  d.noise.reserve(seconds);
+
+  for (size_t i = 0; i < seconds; ++i)
+  {
+    walk += noise.random_walk_fm * normal(gen);
+    d.frequency.push_back(walk + noise.aging * i / 86400.0
+                               + noise.white_fm * normal(gen));
+    d.noise.push_back(noise.measurement * normal(gen));
+  }
+
+  return d;
+}
+
+/* @brief Function to recover the disturbance from a recorded closed loop
+ *        trace, so that candidates can be replayed against real conditions
+ *
+ * The oscillator's own frequency is the measured phase rate less the
+ * correction applied through the EFC. Measurement noise remains embedded in
+ * the recorded phase, so the returned noise is zero
+ *
+ * @param phase The sync_tint series of the device, in seconds
+ * @param efc The efc_abs series of the device over the same period
+ * @param efc_gain Fractional frequency per EFC unit
+ * @return The disturbance, one entry per second
+ */
+inline servo_disturbance disturbance_from_trace(const series& phase,
+    const series& efc, double efc_gain)
+{
+  servo_disturbance d;
+  size_t j = 0;
+
+  if (phase.size() < 2 || efc.empty())
+    return d;
+
+  double efc_ref = efc.value[0];
+
+  for (size_t i = 1; i < phase.size(); ++i)
+  {
+    double dt = (phase.time[i] - phase.time[i - 1]) * 1e-9;
+
+    if (dt <= 0.0)
+      continue;
+
+    while (j + 1 < efc.size() && efc.time[j + 1] <= phase.time[i - 1])
+      ++j;
+
+    double y = (phase.value[i] - phase.value[i - 1]) / dt
+               - efc_gain * (efc.value[j] - efc_ref);
+
+    for (long k = std::max(1L, std::lround(dt)); k > 0; --k)
+    {
+      d.frequency.push_back(y);
+      d.noise.push_back(0.0);
+    }
+  }
+
+  return d;
+}
+
+/* @struct servo_evaluation
+ *
+ * @brief Performance of a candidate over one disturbance
+ */
+struct servo_evaluation
+{
+  servo_params params;
+  bool stable;
+  double settling;                // s, infinity if never settled
+  std::vector<double> adev;       // At each evaluated tau
+  double score;                   // Lower is better
+};
+
+/* @brief Function to simulate the closed loop with a candidate
+ *
+ * @param params The candidate
+ * @param model The loop model
+ * @param d The disturbance
+ * @return The true phase error each second
+ */
+inline std::vector<double> simulate_servo(const servo_params& params,
+    const servo_model& model, const servo_disturbance& d)
+{
+  std::vector<double> phase;
+  phase.reserve(d.frequency.size());
+
+  double x = model.step;
+  double filtered = 0.0;
+  double integral = 0.0;
+
+  for (size_t k = 0; k < d.frequency.size(); ++k)
+  {
+    double measured = x + (k < d.noise.size() ? d.noise[k] : 0.0);
+
+    filtered += (measured - filtered) / (1.0 + params.efcd);
+    integral += filtered;
+
+    double correction = -(model.prop_scale * params.efcs * filtered
+                          + model.int_scale * params.phaseco * integral);
+    correction = std::min(std::max(correction, -model.range), model.range);
+
+    x += d.frequency[k] + correction;
+    phase.push_back(x);
+
+    if (std::fabs(x) > model.divergence)
+      break;
+  }
+
+  return phase;
+}
+
+/* @class servo_tuner
+ *
+ * @brief Class to search for the servo loop coefficients which give the most
+ *        stable output
+ *
+ * Every candidate is simulated against the same disturbance, on as many
+ * threads as there are cores. A candidate's score is the sum of log10 of its
+ * Allan deviation at each tau plus a settling penalty per second; unstable
+ * candidates score infinity
+ */
+class servo_tuner
+{
+  servo_model model;
+  std::vector<size_t> taus;
+  double settling_weight;
+
+public:
+  /* @brief Constructor for servo_tuner
+   *
+   * @param m The loop model
+   * @param tau Averaging times in seconds at which to evaluate ADEV
+   * @param settle_weight Score added per 1000 s of settling time
+   */
+  servo_tuner(const servo_model& m=servo_model(),
+      const std::vector<size_t>& tau={ 1, 10, 100, 1000 },
+      double settle_weight=0.5)
+    : model(m), taus(tau), settling_weight(settle_weight)
+  { }
+
+  /* @brief Function to evaluate one candidate
+   */
+  servo_evaluation evaluate(const servo_params& params,
+      const servo_disturbance& d) const
+  {
+    servo_evaluation e;
+    e.params = params;
+    e.settling = std::numeric_limits<double>::infinity();
+    e.score = std::numeric_limits<double>::infinity();
+
+    std::vector<double> phase = simulate_servo(params, model, d);
+    e.stable = phase.size() == d.frequency.size();
+
+    if (!e.stable)
+      return e;
+
+    // Settled from the last time the error was outside the tolerance
+    size_t last = phase.size();
+
+    while (last > 0 && std::fabs(phase[last - 1]) <= model.tolerance)
+      --last;
+
+    if (last < phase.size())
+      e.settling = last;
+
+    e.score = 0.0;
+
+    for (size_t tau : taus)
+    {
+      double a = overlapping_adev(phase, tau);
+      e.adev.push_back(a);
+
+      if (a > 0.0)
+        e.score += std::log10(a);
+    }
+
+    e.score += std::isinf(e.settling) ? 1e3
+                                      : settling_weight * e.settling / 1000.0;
+
+    return e;
+  }
+
+  /* @brief Function to evaluate candidates in parallel
+   *
+   * @param candidates The coefficient sets to try
+   * @param d The disturbance to simulate against
+   * @param threads Number of worker threads, 0 for one per core
+   * @return The evaluations, best first
+   */
+  std::vector<servo_evaluation> tune(
+      const std::vector<servo_params>& candidates,
+      const servo_disturbance& d, size_t threads=0) const
+  {
+    std::vector<servo_evaluation> results(candidates.size());
+    std::atomic<size_t> next(0);
+
+    if (threads == 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+
+    threads = std::min(threads, candidates.size());
+
+    std::vector<std::thread> workers;
+
+    for (size_t t = 0; t < threads; ++t)
+      workers.emplace_back([&]() {
+        for (size_t i = next++; i < candidates.size(); i = next++)
+          results[i] = evaluate(candidates[i], d);
+      });
+
+    for (auto& w : workers)
+      w.join();
+
+    std::sort(results.begin(), results.end(),
+      [](const servo_evaluation& a, const servo_evaluation& b) {
+        return a.score < b.score;
+      });
+
+    return results;
+  }
+};
+
+/* @brief Function to build a grid of candidates spanning the typical ranges
+ *        given in the GPSDO documentation
+ *
+ * @param steps Number of values per coefficient (steps^3 candidates)
+ * @return The candidates
+ */
+inline std::vector<servo_params> servo_grid(size_t steps=12)
+{
+  std::vector<servo_params> grid;
+
+  // Logarithmic in the gains, which span decades (0.7 to 6.0 is typical for
+  // EFCS alone)
+  auto log_step = [steps](double lo, double hi, size_t i) {
+    return steps < 2 ? lo : lo * std::pow(hi / lo, (double)i / (steps - 1));
+  };
+
+  for (size_t i = 0; i < steps; ++i)
+    for (size_t j = 0; j < steps; ++j)
+      for (size_t k = 0; k < steps; ++k)
+        grid.push_back(servo_params{ log_step(0.2, 20.0, i),
+                                     log_step(1.0, 100.0, j),
+                                     log_step(1.0, 50.0, k) });
+
+  return grid;
+}
+
+/* @brief Function to apply a coefficient set to a GPSDO
+ *
+ * @param dev The GPSDO
+ * @param params The coefficients
+ */
+inline void apply_servo(gpsdo_device& dev, const servo_params& params)
+{
+  dev.serv_efcs(params.efcs);
+  dev.serv_efcd(params.efcd);
+  dev.serv_phaseco(params.phaseco);
+}
+
+} // namespace cyrial
+
+#endif // CYRIAL_CALIBRATION_SERVO_HPP
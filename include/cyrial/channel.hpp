@@ -0,0 +1,282 @@
+#ifndef CYRIAL_CHANNEL_HPP
+#define CYRIAL_CHANNEL_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace cyrial
+{
+
+/* @brief What a channel does with an item pushed while it is full
+ */
+enum channel_policy : uint8_t
+{
+  CHANNEL_BLOCK,          // Wait for room; not for use from I/O threads
+  CHANNEL_DROP_OLDEST,    // Discard the oldest item to make room
+  CHANNEL_DROP_NEWEST,    // Discard the item pushed
+  CHANNEL_SAMPLE          // Keep one in sample_every items, in place of the
+                          // oldest, and discard the rest
+};
+
+/* @struct channel_stats
+ *
+ * @brief Counters describing the activity of a channel
+ */
+struct channel_stats
+{
+  uint64_t pushed;        // Accepted
+  uint64_t popped;
+  uint64_t dropped;       // By any policy
+  uint64_t blocked;       // Pushes which waited for room
+  size_t size;
+  size_t high_water;      // Greatest size reached
+};
+
+/* @class channel
+ *
+ * @brief Bounded FIFO between the producer of a stream (e.g. an I/O thread
+ *        reading NMEA) and a consumer which may fall behind
+ *
+ * Storage is allocated once, so memory is bounded whatever the load. The
+ * lock is held only to move a single item, so a slow consumer delays the
+ * producer by no more than that unless the policy is CHANNEL_BLOCK
+ *
+ * @tparam T The type of item, which must be default constructible
+ */
+template <typename T>
+class channel
+{
+  std::mutex lock;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+
+  std::vector<T> ring;
+  size_t head;
+  size_t count;
+
+  channel_policy policy;
+  size_t sample_every;
+  size_t sample_phase;
+  bool closed;
+
+  uint64_t pushed;
+  uint64_t popped;
+  uint64_t dropped;
+  uint64_t blocked;
+  size_t high_water;
+
+  void put(T&& item)
+  {
+    ring[(head + count) % ring.size()] = std::move(item);
+    ++count;
+    ++pushed;
+
+    if (count > high_water)
+      high_water = count;
+  }
+
+  void discard_oldest()
+  {
+    ring[head] = T();
+    head = (head + 1) % ring.size();
+    --count;
+    ++dropped;
+  }
+
+  T take()
+  {
+    T item = std::move(ring[head]);
+    head = (head + 1) % ring.size();
+    --count;
+    ++popped;
+
+    return item;
+  }
+
+public:
+  /* @brief Constructor for channel
+   *
+   * @param capacity Maximum number of items held, at least 1
+   * @param overflow Policy applied to pushes while full
+   * @param every For CHANNEL_SAMPLE, keep one in this many items while full
+   */
+  channel(size_t capacity=256, channel_policy overflow=CHANNEL_DROP_OLDEST,
+          size_t every=10)
+    : ring(capacity ? capacity : 1), head(0), count(0), policy(overflow),
+      sample_every(every ? every : 1), sample_phase(0), closed(false),
+      pushed(0), popped(0), dropped(0), blocked(0), high_water(0)
+  { }
+
+  channel(const channel&) = delete;
+  channel& operator=(const channel&) = delete;
+
+  /* @brief Function to change the capacity and policy, discarding nothing
+   *        unless the new capacity is smaller than the current size, in
+   *        which case the oldest items are dropped
+   */
+  void configure(size_t capacity, channel_policy overflow, size_t every=10)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<T> resized(capacity ? capacity : 1);
+    size_t keep = std::min(count, resized.size());
+
+    dropped += count - keep;
+
+    for (size_t i = 0; i < keep; ++i)
+      resized[i] = std::move(ring[(head + count - keep + i) % ring.size()]);
+
+    ring.swap(resized);
+    head = 0;
+    count = keep;
+    policy = overflow;
+    sample_every = every ? every : 1;
+
+    not_full.notify_all();
+  }
+
+  /* @brief Function to add an item, applying the policy if full
+   *
+   * @param item The item
+   * @return Whether the item was queued; false if it was dropped or the
+   *         channel is closed
+   */
+  bool push(T item)
+  {
+    std::unique_lock<std::mutex> guard(lock);
+
+    if (closed)
+      return false;
+
+    if (count < ring.size())
+    {
+      put(std::move(item));
+      not_empty.notify_one();
+      return true;
+    }
+
+    switch (policy)
+    {
+      case CHANNEL_BLOCK:
+        ++blocked;
+        not_full.wait(guard, [this]() {
+          return count < ring.size() || closed;
+        });
+
+        if (closed)
+          return false;
+
+        break;
+
+      case CHANNEL_DROP_OLDEST:
+        discard_oldest();
+        break;
+
+      case CHANNEL_DROP_NEWEST:
+        ++dropped;
+        return false;
+
+      case CHANNEL_SAMPLE:
+        if (++sample_phase < sample_every)
+        {
+          ++dropped;
+          return false;
+        }
+
+        sample_phase = 0;
+        discard_oldest();
+        break;
+    }
+
+    put(std::move(item));
+    not_empty.notify_one();
+
+    return true;
+  }
+
+  /* @brief Function to remove the oldest item without waiting
+   *
+   * @param item Set to the item removed
+   * @return Whether there was an item
+   */
+  bool try_pop(T& item)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (count == 0)
+      return false;
+
+    item = take();
+    not_full.notify_one();
+
+    return true;
+  }
+
+  /* @brief Function to remove the oldest item, waiting for one up to a
+   *        timeout
+   *
+   * @return Whether there was an item; false on timeout or once closed and
+   *         empty
+   */
+  template <typename Rep, typename Period>
+  bool pop(T& item, const std::chrono::duration<Rep, Period>& timeout)
+  {
+    std::unique_lock<std::mutex> guard(lock);
+
+    if (!not_empty.wait_for(guard, timeout, [this]() {
+          return count > 0 || closed;
+        }) || count == 0)
+      return false;
+
+    item = take();
+    not_full.notify_one();
+
+    return true;
+  }
+
+  /* @brief Function to remove every item
+   *
+   * @param out Items are appended to this, oldest first
+   * @return The number of items removed
+   */
+  size_t drain(std::vector<T>& out)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t n = count;
+
+    while (count > 0)
+      out.push_back(take());
+
+    not_full.notify_all();
+
+    return n;
+  }
+
+  /* @brief Function to refuse further pushes and release blocked producers
+   *        and consumers; items already queued may still be popped
+   */
+  void close()
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    closed = true;
+    not_empty.notify_all();
+    not_full.notify_all();
+  }
+
+  channel_stats stats()
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    return channel_stats{ pushed, popped, dropped, blocked, count,
+                          high_water };
+  }
+};
+
+} // namespace cyrial
+
+#endif // CYRIAL_CHANNEL_HPP
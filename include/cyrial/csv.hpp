@@ -0,0 +1,38 @@
+#ifndef CYRIAL_CSV_HPP
+#define CYRIAL_CSV_HPP
+
+#include <string>
+
+namespace cyrial
+{
+
+/* @brief Function to format free text, e.g. an error message or a device
+ *        response, as one CSV field
+ *
+ * Text containing a comma, quote or line break is quoted with its quotes
+ * doubled (RFC 4180); other text is returned unchanged
+ *
+ * @param text The text
+ * @return The field
+ */
+inline std::string csv_field(const std::string& text)
+{
+  if (text.find_first_of(",\"\r\n") == std::string::npos)
+    return text;
+
+  std::string field = "\"";
+
+  for (char c : text)
+  {
+    if (c == '"')
+      field += '"';
+
+    field += c;
+  }
+
+  return field + '"';
+}
+
+} // namespace cyrial
+
+#endif // CYRIAL_CSV_HPP
@@ -0,0 +1,295 @@
+#ifndef CYRIAL_DEVICE_CACHE_HPP
+#define CYRIAL_DEVICE_CACHE_HPP
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "manager.hpp"
+#include "devices/csac.hpp"
+#include "devices/scpi.hpp"
+#include "devices/ubx.hpp"
+
+namespace cyrial
+{
+
+/* @brief Kinds of device which can be identified on a port
+ */
+enum device_type { DEV_UNKNOWN, DEV_GPSDO, DEV_CSAC, DEV_UBX };
+
+/* @brief Function to get the name of a device type, as used in fleet
+ *        configuration sections
+ */
+inline const char* device_type_name(device_type type)
+{
+  switch (type)
+  {
+    case DEV_GPSDO: return "gpsdo";
+    case DEV_CSAC:  return "csac";
+    case DEV_UBX:   return "ubx";
+    default:        return "unknown";
+  }
+}
+
+/* @brief Function to parse the name of a device type
+ */
+inline device_type parse_device_type(const std::string& name)
+{
+  if (name == "gpsdo") return DEV_GPSDO;
+  if (name == "csac")  return DEV_CSAC;
+  if (name == "ubx")   return DEV_UBX;
+
+  return DEV_UNKNOWN;
+}
+
+/* @struct cached_port
+ *
+ * @brief What is known about the device on a port
+ */
+struct cached_port
+{
+  std::string by_id;          // Stable path under /dev/serial/by-id
+  device_type type;
+  std::string serial;         // Serial number from *IDN?, if available
+  size_t baud;
+};
+
+/* @brief Function to check cheaply that a port still holds the device
+ *        recorded for it
+ *
+ * A single command is sent: *IDN? for a GPSDO (whose serial number must
+ * match), the telemetry header for a CSAC, and UBX-MON-VER for a u-blox
+ * receiver
+ *
+ * @param port The port, which is set to the recorded baud rate
+ * @param entry The recorded device
+ * @return Whether the device responded as expected
+ */
+inline bool probe_port(std::shared_ptr<interface> port,
+    const cached_port& entry)
+{
+  port->set_baud(entry.baud);
+
+  switch (entry.type)
+  {
+    case DEV_GPSDO:
+      return !entry.serial.empty()
+             && scpi_device(port).serial() == entry.serial;
+
+    case DEV_CSAC:
+      return port->query("!6").find("Status") != std::string::npos;
+
+    case DEV_UBX:
+    {
+      ubx_device dev(port);
+      port->set_baud(entry.baud);
+
+      return dev.ubx_mon_ver().find("\\xb5b\\n\\x04") != std::string::npos;
+    }
+
+    default:
+      return false;
+  }
+}
+
+/* @brief Function to identify the device on a port by trying each protocol
+ *        at its default baud rate
+ *
+ * @param port The port
+ * @param by_id The stable path of the port
+ * @return The identified device, of type DEV_UNKNOWN if none responded
+ */
+inline cached_port identify_port(std::shared_ptr<interface> port,
+    const std::string& by_id)
+{
+  cached_port entry{ by_id, DEV_GPSDO, "", 115200 };
+  port->set_baud(entry.baud);
+
+  std::string id = scpi_device(port).idn();
+
+  if (id.find("Jackson") != std::string::npos)
+  {
+    entry.serial = idn_serial(id);
+    return entry;
+  }
+
+  entry = cached_port{ by_id, DEV_CSAC, "", 57600 };
+
+  if (probe_port(port, entry))
+    return entry;
+
+  entry = cached_port{ by_id, DEV_UBX, "", 9600 };
+
+  if (probe_port(port, entry))
+    return entry;
+
+  return cached_port{ by_id, DEV_UNKNOWN, "", 0 };
+}
+
+/* @class device_cache
+ *
+ * @brief Class to persist the device found on each port between runs
+ *
+ * The file holds one tab separated line per port: by-id path, device type,
+ * serial number, and baud rate
+ */
+class device_cache
+{
+  std::string location;
+  std::map<std::string, cached_port> entries;
+
+public:
+  /* @brief Constructor for device_cache
+   *
+   * @param path Location of the cache file, which need not exist yet
+   */
+  device_cache(const std::string& path)
+    : location(path)
+  {
+    std::ifstream in(path);
+    std::string line;
+
+    while (std::getline(in, line))
+    {
+      if (line.empty() || line[0] == '#')
+        continue;
+
+      std::istringstream fields(line);
+      std::string by_id, type, serial, baud;
+
+      if (std::getline(fields, by_id, '\t') && std::getline(fields, type, '\t')
+          && std::getline(fields, serial, '\t') && std::getline(fields, baud))
+        entries[by_id] = cached_port{ by_id, parse_device_type(type), serial,
+                                      std::strtoul(baud.c_str(), NULL, 10) };
+    }
+  }
+
+  /* @brief Function to get the recorded device of a port
+   *
+   * @return The entry, or nullptr if the port is not recorded
+   */
+  const cached_port* find(const std::string& by_id) const
+  {
+    auto it = entries.find(by_id);
+
+    return it == entries.end() ? nullptr : &it->second;
+  }
+
+  void update(const cached_port& entry)
+  {
+    entries[entry.by_id] = entry;
+  }
+
+  void erase(const std::string& by_id)
+  {
+    entries.erase(by_id);
+  }
+
+  /* @brief Function to write the cache back to its file
+   */
+  void save() const
+  {
+    std::string temporary = location + ".tmp";
+    std::ofstream out(temporary, std::ios::trunc);
+
+    if (!out)
+      throw std::runtime_error("Failed to open " + temporary);
+
+    out << "# cyrial device cache: by-id path, type, serial, baud\n";
+
+    for (const auto& entry : entries)
+      out << entry.second.by_id << '\t'
+          << device_type_name(entry.second.type) << '\t'
+          << entry.second.serial << '\t' << entry.second.baud << '\n';
+
+    out.close();
+
+    // Replaced atomically so that a crash cannot leave a truncated cache
+    if (!out || std::rename(temporary.c_str(), location.c_str()) != 0)
+      throw std::runtime_error("Failed to write " + location);
+  }
+};
+
+/* @struct connected_port
+ *
+ * @brief A port opened by @connect_cached
+ */
+struct connected_port
+{
+  std::shared_ptr<interface> port;
+  cached_port device;
+  bool from_cache;            // Whether the cached entry was confirmed
+};
+
+/* @brief Function to open every serial port, identifying devices from a
+ *        cache where possible
+ *
+ * Ports are enumerated from /dev/serial/by-id rather than through PyVISA. A
+ * port whose cached device answers a single probe is accepted as is; any
+ * other port is identified in full and its entry replaced. Ports with no
+ * identifiable device are still opened and returned as DEV_UNKNOWN; ports
+ * which cannot be opened, e.g. because another process holds them, are
+ * skipped and dropped from the cache
+ *
+ * @param m A manager constructed without connecting to any resource
+ * @param path Location of the cache file, which is updated
+ * @return The opened ports
+ */
+inline std::vector<connected_port> connect_cached(manager& m,
+    const std::string& path)
+{
+  device_cache cache(path);
+  std::vector<connected_port> result;
+  bool changed = false;
+
+  for (const auto& entry : serial_ports_by_id())
+  {
+    expected<std::shared_ptr<interface>> opened =
+      m.try_open("ASRL" + entry.second + "::INSTR");
+    const cached_port* known = cache.find(entry.first);
+
+    if (!opened)
+    {
+      if (known)
+      {
+        cache.erase(entry.first);
+        changed = true;
+      }
+
+      continue;
+    }
+
+    std::shared_ptr<interface> port = *opened;
+
+    if (known && probe_port(port, *known))
+    {
+      result.push_back(connected_port{ port, *known, true });
+      continue;
+    }
+
+    cached_port found = identify_port(port, entry.first);
+    result.push_back(connected_port{ port, found, false });
+
+    if (found.type == DEV_UNKNOWN)
+      cache.erase(entry.first);
+    else
+      cache.update(found);
+
+    changed = true;
+  }
+
+  if (changed)
+    cache.save();
+
+  return result;
+}
+
+} // namespace cyrial
+
+#endif // CYRIAL_DEVICE_CACHE_HPP
@@ -11,6 +11,12 @@ namespace cyrial
 /* @class base_device
  *
  * @brief Class to represent a generic device
+ *
+ * Holds the transport shared by every protocol a device speaks. Protocols are
+ * added as mixins (e.g. scpi_protocol, nmea_protocol) which take the device
+ * class as a template parameter and reach the transport through @port, so
+ * command paths resolve statically and there is exactly one base_device per
+ * device without virtual inheritance
  */
 class base_device
 {
@@ -30,6 +36,15 @@ public:
   base_device(std::shared_ptr<interface> port)
     : comm(port)
   { }
+
+  /* @brief Function to get the communication interface of the device
+   *
+   * @return The interface
+   */
+  const std::shared_ptr<interface>& port() const
+  {
+    return comm;
+  }
 };
 
 } // namespace cyrial
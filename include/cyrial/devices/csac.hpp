@@ -1,9 +1,11 @@
 #ifndef CYRIAL_DEVICES_CSAC_HPP
 #define CYRIAL_DEVICES_CSAC_HPP
 
+#include <cstdio>
 #include <string>
 
 #include "base.hpp"
+#include "../expected.hpp"
 
 namespace cyrial
 {
@@ -14,8 +16,20 @@ namespace cyrial
  *
  * @brief Class to represent a CSAC
  */
-class csac_device : virtual public base_device
+class csac_device : public base_device
 {
+  expected<std::string> steer(const char* format, int value)
+  {
+    char command[16];
+
+    if (value < -20000000 || value > 20000000)
+      return error(errc::range, "steer");
+
+    std::snprintf(command, sizeof(command), format, value);
+
+    return comm->try_query(command);
+  }
+
 public:
   /* @brief Constructor for csac device
    *
@@ -43,29 +57,59 @@ public:
    */
   std::string telemetry_data()
   {
-    return comm->query("!^");
+    return telemetry_view();
+  }
+
+  /* @brief Function to get telemetry data without copying it
+   *
+   * @return Telemetry data in CSV format, valid until the next read from the
+   *         port
+   */
+  const std::string& telemetry_view()
+  {
+    return comm->query_view("!^");
   }
 
   /* @brief Function to adjust the absolute operating frequency
    *
    * @param Frequency adjustment value in pp10^15
-   * @return Unit response steer
+   * @return Unit response steer, or errc::range if the value is outside
+   *         [-2E7, 2E7] and errc::timeout if the unit did not respond
    */
-  std::string steer_freq_abs(int value)
+  expected<std::string> try_steer_freq_abs(int value)
   {
-    return (value < -20000000 || value > 20000000) ? ""
-      : comm->query("!FD" + std::to_string(value));
+    return steer("!FD%d", value);
   }
 
   /* @brief Function to adjust the relative operating frequency
    *
    * @param Frequency adjustment value in pp10^15
-   * @return Unit response steer
+   * @return Unit response steer, or errc::range if the value is outside
+   *         [-2E7, 2E7] and errc::timeout if the unit did not respond
+   */
+  expected<std::string> try_steer_freq_rel(int value)
+  {
+    return steer("!FD%d", value);
+  }
+
+  /* @brief Function to adjust the absolute operating frequency, see
+   *        @try_steer_freq_abs
+   *
+   * @return Unit response steer, or an empty string on failure
+   */
+  std::string steer_freq_abs(int value)
+  {
+    return try_steer_freq_abs(value).value_or("");
+  }
+
+  /* @brief Function to adjust the relative operating frequency, see
+   *        @try_steer_freq_rel
+   *
+   * @return Unit response steer, or an empty string on failure
    */
   std::string steer_freq_rel(int value)
   {
-    return (value < -20000000 || value > 20000000) ? ""
-      : comm->query("!FD" + std::to_string(value));
+    return try_steer_freq_rel(value).value_or("");
   }
 
   /* @brief Function to lock the frequency steering value
@@ -3,7 +3,7 @@
 
 #include <string>
 
-#include "../interface.hpp"
+#include "base.hpp"
 
 namespace cyrial
 {
@@ -12,18 +12,15 @@ namespace cyrial
  *
  * @brief Class to represent an FPGA (RTDS proprietary protocol)
  */
-class fpga_device
+class fpga_device : public base_device
 {
-protected:
-  std::shared_ptr<interface> comm;
-
 public:
   /* @brief Constructor for fpga device
    *
    * @param A shared_ptr to a communication interface
    */
   fpga_device(std::shared_ptr<interface> port)
-    : comm(port)
+    : base_device(port)
   {
     comm->set_baud(57600);
     comm->set_timeout(100);
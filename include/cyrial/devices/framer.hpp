@@ -0,0 +1,510 @@
+#ifndef CYRIAL_DEVICES_FRAMER_HPP
+#define CYRIAL_DEVICES_FRAMER_HPP
+
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace cyrial
+{
+
+/* @struct nmea_field
+ *
+ * @brief A field of an NMEA sentence, pointing into the framer's buffer
+ */
+struct nmea_field
+{
+  const char* data;
+  size_t size;
+};
+
+/* @struct nmea_sentence
+ *
+ * @brief A decoded NMEA sentence, valid only for the duration of the handler
+ *        it is passed to
+ */
+struct nmea_sentence
+{
+  static const size_t max_fields = 40;
+
+  char talker[3];               // e.g. "GP", or "P" for proprietary
+  char type[4];                 // e.g. "RMC", or "UBX" for $PUBX
+
+  // The sentence from '$' up to but excluding the checksum delimiter '*'
+  const char* data;
+  size_t size;
+
+  // Comma separated fields after the address field
+  nmea_field fields[max_fields];
+  size_t field_count;
+};
+
+/* @struct ubx_frame
+ *
+ * @brief A UBX frame whose checksum has been verified, valid only for the
+ *        duration of the handler it is passed to
+ */
+struct ubx_frame
+{
+  uint8_t cls;
+  uint8_t id;
+  const uint8_t* payload;
+  size_t size;
+};
+
+/* @struct framer_stats
+ *
+ * @brief Counters describing the activity of a framer
+ */
+struct framer_stats
+{
+  uint64_t decoded;             // Subscribed frames delivered
+  uint64_t skipped;             // Unsubscribed frames passed over
+  uint64_t skipped_bytes;
+  uint64_t checksum_errors;
+  uint64_t oversized;           // Subscribed frames too long to buffer
+};
+
+/* @class framer
+ *
+ * @brief Class to split a stream of mixed NMEA and UBX data into frames and
+ *        deliver those which have subscribers
+ *
+ * Subscriptions are compiled into lookup tables: a bit per UBX class and ID,
+ * and per NMEA sentence type a mask of talkers. The table is consulted as
+ * soon as a frame's header has arrived, so unsubscribed frames are skipped
+ * without being buffered, checksummed, or split into fields, and decoding
+ * cost follows what is consumed rather than what the receiver sends.
+ * Subscriptions must not change while data is fed
+ */
+class framer
+{
+public:
+  typedef std::function<void(const nmea_sentence&)> nmea_handler;
+  typedef std::function<void(const ubx_frame&)> ubx_handler;
+
+private:
+  enum state_type : uint8_t { IDLE, NMEA_HEADER, NMEA_BODY, NMEA_SKIP,
+                              UBX_SYNC, UBX_HEADER, UBX_BODY, UBX_SKIP };
+
+  // Talkers with their own bit in a sentence type's mask; others share one
+  static const size_t talker_other = 9;
+  static const uint32_t talker_any = 0xffffffff;
+  static const size_t type_count = 26 * 26 * 26;
+
+  struct nmea_subscription
+  {
+    size_t type;
+    uint32_t talkers;
+    nmea_handler handler;
+  };
+
+  struct ubx_subscription
+  {
+    uint16_t key;
+    ubx_handler handler;
+  };
+
+  std::unique_ptr<uint32_t[]> nmea_table;
+  std::bitset<65536> ubx_table;
+  std::vector<nmea_subscription> nmea_subscriptions;
+  std::vector<ubx_subscription> ubx_subscriptions;
+
+  state_type state;
+  std::vector<uint8_t> buffer;
+  size_t length;
+  size_t remaining;
+
+  nmea_sentence sentence;
+  framer_stats counters;
+
+  static size_t talker_index(const char* talker)
+  {
+    static const char* known[] = { "GP", "GL", "GA", "GB", "BD", "GQ", "GI",
+                                   "GN", "P" };
+
+    for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); ++i)
+      if (std::strcmp(talker, known[i]) == 0)
+        return i;
+
+    return talker_other;
+  }
+
+  // Index of a three letter sentence type, or type_count if it is not one
+  static size_t type_index(const char* type)
+  {
+    size_t index = 0;
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+      if (type[i] < 'A' || type[i] > 'Z')
+        return type_count;
+
+      index = index * 26 + (type[i] - 'A');
+    }
+
+    return index;
+  }
+
+  static int hex_value(char c)
+  {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+
+    return -1;
+  }
+
+  static uint16_t ubx_key(uint8_t cls, uint8_t id)
+  {
+    return (uint16_t)(cls << 8 | id);
+  }
+
+  // Called once the address field is complete: "$GPRMC" or "$PUBX"
+  void nmea_header()
+  {
+    const char* header = (const char*)buffer.data();
+    bool proprietary = header[1] == 'P';
+    size_t talker_size = proprietary ? 1 : 2;
+
+    std::memcpy(sentence.talker, header + 1, talker_size);
+    sentence.talker[talker_size] = '\0';
+    std::memcpy(sentence.type, header + 1 + talker_size, 3);
+    sentence.type[3] = '\0';
+
+    size_t type = type_index(sentence.type);
+
+    if (type < type_count
+        && nmea_table[type] & (1u << talker_index(sentence.talker)))
+      state = NMEA_BODY;
+    else
+    {
+      ++counters.skipped;
+      counters.skipped_bytes += length;
+      state = NMEA_SKIP;
+    }
+  }
+
+  void nmea_complete()
+  {
+    char* data = (char*)buffer.data();
+    size_t end = length;
+
+    while (end > 0 && (data[end - 1] == '\r' || data[end - 1] == '\n'))
+      --end;
+
+    // Checksum: XOR of the characters between '$' and '*'
+    const char* star = (const char*)std::memchr(data, '*', end);
+    uint8_t sum = 0;
+
+    if (star == nullptr || end < (size_t)(star - data) + 3)
+    {
+      ++counters.checksum_errors;
+      return;
+    }
+
+    for (const char* c = data + 1; c < star; ++c)
+      sum ^= (uint8_t)*c;
+
+    int high = hex_value(star[1]);
+    int low = hex_value(star[2]);
+
+    if (high < 0 || low < 0 || (high << 4 | low) != sum)
+    {
+      ++counters.checksum_errors;
+      return;
+    }
+
+    // Fields follow the address field
+    sentence.data = data;
+    sentence.size = star - data;
+    sentence.field_count = 0;
+
+    const char* field = (const char*)std::memchr(data, ',', star - data);
+
+    while (field != nullptr && sentence.field_count < nmea_sentence::max_fields)
+    {
+      const char* begin = field + 1;
+      field = (const char*)std::memchr(begin, ',', star - begin);
+
+      sentence.fields[sentence.field_count++] =
+        nmea_field{ begin, (size_t)((field ? field : star) - begin) };
+    }
+
+    ++counters.decoded;
+
+    size_t type = type_index(sentence.type);
+    uint32_t talker = 1u << talker_index(sentence.talker);
+
+    for (const auto& s : nmea_subscriptions)
+      if (s.type == type && s.talkers & talker)
+        s.handler(sentence);
+  }
+
+  // Called once class, ID and length have arrived
+  void ubx_header()
+  {
+    uint8_t cls = buffer[2];
+    uint8_t id = buffer[3];
+    size_t size = buffer[4] | buffer[5] << 8;
+
+    // Payload and two checksum bytes
+    remaining = size + 2;
+
+    if (!ubx_table[ubx_key(cls, id)])
+    {
+      ++counters.skipped;
+      counters.skipped_bytes += length + remaining;
+      state = UBX_SKIP;
+    }
+    else if (length + remaining > buffer.size())
+    {
+      ++counters.oversized;
+      state = UBX_SKIP;
+    }
+    else
+      state = UBX_BODY;
+  }
+
+  void ubx_complete()
+  {
+    size_t size = length - 8;
+    uint8_t check_a = 0;
+    uint8_t check_b = 0;
+
+    // Fletcher checksum over class, ID, length and payload
+    for (size_t i = 2; i < 6 + size; ++i)
+      check_b += (check_a += buffer[i]);
+
+    if (buffer[6 + size] != check_a || buffer[7 + size] != check_b)
+    {
+      ++counters.checksum_errors;
+      return;
+    }
+
+    ++counters.decoded;
+
+    ubx_frame frame{ buffer[2], buffer[3], buffer.data() + 6, size };
+    uint16_t key = ubx_key(frame.cls, frame.id);
+
+    for (const auto& s : ubx_subscriptions)
+      if (s.key == key)
+        s.handler(frame);
+  }
+
+  void start(uint8_t c)
+  {
+    length = 0;
+
+    if (c == '$')
+    {
+      buffer[length++] = c;
+      state = NMEA_HEADER;
+    }
+    else if (c == 0xb5)
+    {
+      buffer[length++] = c;
+      state = UBX_SYNC;
+    }
+    else
+      state = IDLE;
+  }
+
+public:
+  /* @brief Constructor for framer
+   *
+   * @param max_frame Largest frame buffered, in bytes; larger subscribed
+   *        frames are counted as oversized and skipped
+   */
+  framer(size_t max_frame=2048)
+    : nmea_table(new uint32_t[type_count]()), state(IDLE),
+      buffer(max_frame < 128 ? 128 : max_frame), length(0), remaining(0),
+      counters()
+  { }
+
+  framer(const framer&) = delete;
+  framer& operator=(const framer&) = delete;
+
+  /* @brief Function to subscribe to an NMEA sentence type
+   *
+   * @param type The sentence type, e.g. "RMC", or "UBX" for $PUBX
+   * @param handler Called with each such sentence which passes its checksum
+   * @param talker The talker, e.g. "GP", "GN", or "P" for proprietary
+   *        sentences; nullptr for any
+   * @return Whether the type could be subscribed to (three capital letters)
+   */
+  bool subscribe_nmea(const char* type, nmea_handler handler,
+                      const char* talker=nullptr)
+  {
+    size_t index = type_index(type);
+
+    if (std::strlen(type) != 3 || index == type_count)
+      return false;
+
+    uint32_t talkers = talker ? 1u << talker_index(talker) : talker_any;
+
+    nmea_table[index] |= talkers;
+    nmea_subscriptions.push_back(nmea_subscription{ index, talkers,
+                                                    handler });
+
+    return true;
+  }
+
+  /* @brief Function to subscribe to an UBX message
+   *
+   * @param cls The message class, e.g. 0x01 for NAV
+   * @param id The message ID, e.g. 0x07 for NAV-PVT
+   * @param handler Called with each such frame which passes its checksum
+   */
+  void subscribe_ubx(uint8_t cls, uint8_t id, ubx_handler handler)
+  {
+    ubx_table.set(ubx_key(cls, id));
+    ubx_subscriptions.push_back(ubx_subscription{ ubx_key(cls, id),
+                                                  handler });
+  }
+
+  /* @brief Function to remove every subscription
+   */
+  void clear()
+  {
+    std::memset(nmea_table.get(), 0, type_count * sizeof(uint32_t));
+    ubx_table.reset();
+    nmea_subscriptions.clear();
+    ubx_subscriptions.clear();
+  }
+
+  /* @brief Function to process data read from a port, which may end part
+   *        way through a frame; e.g. the handler of a reactor
+   *
+   * @param data The bytes read
+   * @param size The number of bytes
+   */
+  void feed(const char* data, size_t size)
+  {
+    const uint8_t* bytes = (const uint8_t*)data;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+      uint8_t c = bytes[i];
+
+      switch (state)
+      {
+        case IDLE:
+          start(c);
+          break;
+
+        case NMEA_HEADER:
+          if (c < 'A' || c > 'Z')
+          {
+            // Too short for an address field, e.g. noise containing '$'
+            start(c);
+            break;
+          }
+
+          buffer[length++] = c;
+
+          // "$" followed by talker and type: 4 characters if proprietary,
+          // otherwise 5
+          if (length == (buffer[1] == 'P' ? 5u : 6u))
+            nmea_header();
+
+          break;
+
+        case NMEA_BODY:
+          if (c == '$')
+          {
+            start(c);
+            break;
+          }
+
+          if (length == buffer.size())
+          {
+            ++counters.oversized;
+            state = NMEA_SKIP;
+            break;
+          }
+
+          buffer[length++] = c;
+
+          if (c == '\n')
+          {
+            nmea_complete();
+            state = IDLE;
+          }
+
+          break;
+
+        case NMEA_SKIP:
+          if (c == '$' || c == 0xb5)
+            start(c);
+          else if (c == '\n')
+            state = IDLE;
+          else
+            ++counters.skipped_bytes;
+
+          break;
+
+        case UBX_SYNC:
+          if (c == 0x62)
+          {
+            buffer[length++] = c;
+            state = UBX_HEADER;
+          }
+          else
+            start(c);
+
+          break;
+
+        case UBX_HEADER:
+          buffer[length++] = c;
+
+          if (length == 6)
+            ubx_header();
+
+          break;
+
+        case UBX_BODY:
+        {
+          // Copy as much of the frame as is available at once
+          size_t n = size - i < remaining ? size - i : remaining;
+          std::memcpy(buffer.data() + length, bytes + i, n);
+          length += n;
+          remaining -= n;
+          i += n - 1;
+
+          if (remaining == 0)
+          {
+            ubx_complete();
+            state = IDLE;
+          }
+
+          break;
+        }
+
+        case UBX_SKIP:
+        {
+          size_t n = size - i < remaining ? size - i : remaining;
+          remaining -= n;
+          i += n - 1;
+
+          if (remaining == 0)
+            state = IDLE;
+
+          break;
+        }
+      }
+    }
+  }
+
+  framer_stats stats() const
+  {
+    return counters;
+  }
+};
+
+} // namespace cyrial
+
+#endif // CYRIAL_DEVICES_FRAMER_HPP
@@ -14,6 +14,73 @@ enum sync_source { GPS, EXT, AUTO };
 
 std::array<size_t, 5> gpsdo_baud{ 9600, 19200, 38400, 57600, 115200 };
 
+/* @brief Table of the GPSDO's parameterized commands, from which the setters
+ *        and queries of gpsdo_device are generated
+ */
+namespace gpsdo_command
+{
+  constexpr scpi_command gps_gpgga   { "GPS:GPGGA",    SCPI_UINT, 0, 255,
+                                       SCPI_NUMBER };
+  constexpr scpi_command gps_ggast   { "GPS:GGAST",    SCPI_UINT, 0, 255,
+                                       SCPI_NUMBER };
+  constexpr scpi_command gps_gprmc   { "GPS:GPRMC",    SCPI_UINT, 0, 255,
+                                       SCPI_NUMBER };
+  constexpr scpi_command gps_xyzsp   { "GPS:XYZSP",    SCPI_UINT, 0, 255,
+                                       SCPI_NUMBER };
+
+  constexpr scpi_command serv_coarsd { "SERV:COARSD",  SCPI_UINT, 0, 255,
+                                       SCPI_NUMBER };
+  constexpr scpi_command serv_efcs   { "SERV:EFCS",    SCPI_REAL, 0.0, 500.0,
+                                       SCPI_NUMBER };
+  constexpr scpi_command serv_efcd   { "SERV:EFCD",    SCPI_REAL, 0.0, 4000.0,
+                                       SCPI_NUMBER };
+  constexpr scpi_command serv_tempco { "SERV:TEMPCO",  SCPI_REAL, -4000.0,
+                                       4000.0, SCPI_NUMBER };
+  constexpr scpi_command serv_aging  { "SERV:AGING",   SCPI_REAL, -10.0, 10.0,
+                                       SCPI_NUMBER };
+  constexpr scpi_command serv_phaseco{ "SERV:PHASECO", SCPI_REAL, -100.0,
+                                       100.0, SCPI_NUMBER };
+  constexpr scpi_command serv_1pps   { "SERV:1PPS",    SCPI_INT, -2147483648.0,
+                                       2147483647.0, SCPI_NUMBER };
+  constexpr scpi_command serv_trac   { "SERV:TRAC",    SCPI_UINT, 0,
+                                       4294967295.0, SCPI_NUMBER };
+
+  constexpr scpi_command syst_comm_ser_echo
+                                     { "SYST:COMM:SER:ECHO", SCPI_BOOL, 0, 1,
+                                       SCPI_TEXT };
+  constexpr scpi_command syst_comm_ser_pro
+                                     { "SYST:COMM:SER:PRO",  SCPI_BOOL, 0, 1,
+                                       SCPI_TEXT };
+  constexpr scpi_command syst_comm_ser_baud
+                                     { "SYST:COMM:SER:BAUD", SCPI_UINT, 9600,
+                                       115200, SCPI_NUMBER };
+
+  // Queries polled for telemetry
+  constexpr scpi_command gps_sat_tra_coun
+                                     { "GPS:SAT:TRA:COUN", SCPI_NONE, 0, 0,
+                                       SCPI_NUMBER };
+  constexpr scpi_command gps_sat_vis_coun
+                                     { "GPS:SAT:VIS:COUN", SCPI_NONE, 0, 0,
+                                       SCPI_NUMBER };
+  constexpr scpi_command sync_sour_state
+                                     { "SYNC:SOUR:STATE",  SCPI_NONE, 0, 0,
+                                       SCPI_TEXT };
+  constexpr scpi_command sync_tint   { "SYNC:TINT",    SCPI_NONE, 0, 0,
+                                       SCPI_NUMBER };
+  constexpr scpi_command sync_fee    { "SYNC:FEE",     SCPI_NONE, 0, 0,
+                                       SCPI_NUMBER };
+  constexpr scpi_command sync_lock   { "SYNC:LOCK",    SCPI_NONE, 0, 0,
+                                       SCPI_NUMBER };
+  constexpr scpi_command sync_health { "SYNC:HEALTH",  SCPI_NONE, 0, 0,
+                                       SCPI_NUMBER };
+  constexpr scpi_command diag_rosc_efc_rel
+                                     { "DIAG:ROSC:EFC:REL", SCPI_NONE, 0, 0,
+                                       SCPI_NUMBER };
+  constexpr scpi_command diag_rosc_efc_abs
+                                     { "DIAG:ROSC:EFC:ABS", SCPI_NONE, 0, 0,
+                                       SCPI_NUMBER };
+} // namespace gpsdo_command
+
 /* @class gpsdo_device
  *
  * @brief Class to represent a GPS Disciplined Oscillator
@@ -32,7 +99,8 @@ std::array<size_t, 5> gpsdo_baud{ 9600, 19200, 38400, 57600, 115200 };
  * also be added - note that NEMA messages start with '$', and command
  * responses are wrapped in an echo of the command and a newline
  */
-class gpsdo_device : public scpi_device, public nmea_device
+class gpsdo_device : public base_device, public scpi_protocol<gpsdo_device>,
+                     public nmea_protocol<gpsdo_device>
 {
 public:
   /* @brief Constructor for gpsdo device
@@ -40,7 +108,7 @@ public:
    * @param A shared_ptr to a communication interface
    */
   gpsdo_device(std::shared_ptr<interface> port)
-    : scpi_device(port), nmea_device(port), base_device(port)
+    : base_device(port)
   {
     comm->set_timeout(100);
     comm->set_baud(115200);
@@ -65,7 +133,7 @@ public:
    */
   std::string gps_sat_tra_coun()
   {
-    return comm->query("GPS:SAT:TRA:COUN?");
+    return scpi_get(gpsdo_command::gps_sat_tra_coun);
   }
 
   /* @brief Function to query the number of SV's which should be visible per the
@@ -77,7 +145,7 @@ public:
    */
   std::string gps_sat_vis_coun()
   {
-    return comm->query("GPS:SAT:VIS:COUN?");
+    return scpi_get(gpsdo_command::gps_sat_vis_coun);
   }
 
   /* @brief Function to instruct the GPSDO to transmit GPGGA NEMA messages at a
@@ -91,11 +159,7 @@ public:
    */
   void gps_gpgga(size_t freq)
   {
-    if (freq <= 255)
-    {
-      comm->write("GPS:GPGGA " + std::to_string(freq));
-      comm->eat();
-    }
+    scpi_set(gpsdo_command::gps_gpgga, freq);
   }
 
   /* @brief Function to instruct the GPSDO to transmit modified GPGGA NEMA
@@ -112,11 +176,7 @@ public:
    */
   void gps_ggast(size_t freq)
   {
-    if (freq <= 255)
-    {
-      comm->write("GPS:GGAST " + std::to_string(freq));
-      comm->eat();
-    }
+    scpi_set(gpsdo_command::gps_ggast, freq);
   }
 
   /* @brief Function to instruct the GPSDO to transmit GPRMC NEMA messages at a
@@ -130,11 +190,7 @@ public:
    */
   void gps_gprmc(size_t freq)
   {
-    if (freq <= 255)
-    {
-      comm->write("GPS:GPRMC " + std::to_string(freq));
-      comm->eat();
-    }
+    scpi_set(gpsdo_command::gps_gprmc, freq);
   }
 
   /* @brief Function to instruct teh GPSDO to transmit X, Y, and Z speed
@@ -149,11 +205,7 @@ public:
    */
   void gps_xyzsp(size_t freq)
   {
-    if (freq <= 255)
-    {
-      comm->write("GPS:XYZSP " + std::to_string(freq));
-      comm->eat();
-    }
+    scpi_set(gpsdo_command::gps_xyzsp, freq);
   }
 
   /* @brief Function to return information about time, including date, time in
@@ -261,7 +313,7 @@ public:
    */
   std::string sync_sour_state()
   {
-    return comm->query("SYNC:SOUR:STATE?");
+    return scpi_get(gpsdo_command::sync_sour_state);
   }
 
   /* @brief Function to query the length of the most recent holdover duration
@@ -302,7 +354,7 @@ public:
    */
   std::string sync_tint()
   {
-    return comm->query("SYNC:TINT?");
+    return scpi_get(gpsdo_command::sync_tint);
   }
 
   /* @brief Function to command the GPSDO to synchronize with the reference
@@ -327,7 +379,7 @@ public:
    */
   std::string sync_fee()
   {
-    return comm->query("SYNC:FEE?");
+    return scpi_get(gpsdo_command::sync_fee);
   }
 
   /* @brief Function to query the lock status of the PLL which controls the
@@ -339,7 +391,7 @@ public:
    */
   std::string sync_lock()
   {
-    return comm->query("SYNC:LOCK?");
+    return scpi_get(gpsdo_command::sync_lock);
   }
 
   /* @brief Function to query the health status of the GPSDO
@@ -362,7 +414,7 @@ public:
    */
   std::string sync_health()
   {
-    return comm->query("SYNC:HEALTH?");
+    return scpi_get(gpsdo_command::sync_health);
   }
 
   /* @brief Function to query the electronic frequency control value in percent
@@ -373,7 +425,7 @@ public:
    */
   std::string diag_rosc_efc_rel()
   {
-    return comm->query("DIAG:ROSC:EFC:REL?");
+    return scpi_get(gpsdo_command::diag_rosc_efc_rel);
   }
 
   /* @brief Function to query the electronic frequency control value in volts
@@ -385,7 +437,7 @@ public:
    */
   std::string diag_rosc_efc_abs()
   {
-    return comm->query("DIAG:ROSC:EFC:ABS?");
+    return scpi_get(gpsdo_command::diag_rosc_efc_abs);
   }
 
   /* @brief Function to query the system status
@@ -405,7 +457,7 @@ public:
    */
   std::string syst_comm_ser_echo()
   {
-    return comm->query("SYST:COMM:SER:ECHO?");
+    return scpi_get(gpsdo_command::syst_comm_ser_echo);
   }
 
   /* @brief Function to enable or disable command echo on RS-232
@@ -415,10 +467,7 @@ public:
    */
   void syst_comm_ser_echo(bool state)
   {
-    std::string command = "SYST:COMM:SER:ECHO " + state ? "ON" : "OFF";
-
-    comm->write(command.c_str());
-    comm->eat();
+    scpi_set(gpsdo_command::syst_comm_ser_echo, state);
   }
 
   /* @brief Function to check of command prompt ("scpi>") is enabled
@@ -429,7 +478,7 @@ public:
    */
   std::string syst_comm_ser_pro()
   {
-    return comm->query("SYST:COMM:SER:PRO?");
+    return scpi_get(gpsdo_command::syst_comm_ser_pro);
   }
 
   /* @brief Function to enable or disable command prompt on RS-232
@@ -439,10 +488,7 @@ public:
    */
   void syst_comm_ser_pro(bool state)
   {
-    std::string command = "SYST:COMM:SER:PRO " + state ? "ON" : "OFF";
-
-    comm->write(command.c_str());
-    comm->eat();
+    scpi_set(gpsdo_command::syst_comm_ser_pro, state);
   }
 
   /* @brief Function to query current baud rate setting for device
@@ -453,7 +499,7 @@ public:
    */
   std::string syst_comm_ser_baud()
   {
-    return comm->query("SYST:COMM:SER:BAUD?");
+    return scpi_get(gpsdo_command::syst_comm_ser_baud);
   }
 
   /* @brief Function to change the baud rate for the device
@@ -472,8 +518,7 @@ public:
     for (size_t i = 0; i < gpsdo_baud.size(); ++i)
       if (proposed == gpsdo_baud[i])
       {
-        comm->write("SYST:COMM:SER:BAUD");
-        comm->eat();
+        scpi_set(gpsdo_command::syst_comm_ser_baud, proposed);
         break;
       }
   }
@@ -497,11 +542,7 @@ public:
    */
   void serv_coarsd(size_t val)
   {
-    if (val <= 255)
-    {
-      comm->write("SERV:COARSD " + std::to_string(val));
-      comm->eat();
-    }
+    scpi_set(gpsdo_command::serv_coarsd, val);
   }
 
   /* @brief Function to set the proportional coefficient of the PID loop. Values
@@ -518,11 +559,7 @@ public:
    */
   void serv_efcs(double value)
   {
-    if (value >= 0.0 && value <= 500.0)
-    {
-      comm->write("SERV:EFCS " + std::to_string(value));
-      comm->eat();
-    }
+    scpi_set(gpsdo_command::serv_efcs, value);
   }
 
   /* @brief Function to set the low pass filter effectiveness of the DAC. Values
@@ -532,11 +569,7 @@ public:
    */
   void serv_efcd(double value)
   {
-    if (value >= 0.0 && value <= 4000.0)
-    {
-      comm->write("SERV:EFCD " + std::to_string(value));
-      comm->eat();
-    }
+    scpi_set(gpsdo_command::serv_efcd, value);
   }
 
   /* @brief Function to set the coefficient corresponding to the temperature
@@ -546,11 +579,7 @@ public:
    */
   void serv_tempco(double value)
   {
-    if (value >= -4000.0 && value <= 4000.0)
-    {
-      comm->write("SERV:TEMPCO " + std::to_string(value));
-      comm->eat();
-    }
+    scpi_set(gpsdo_command::serv_tempco, value);
   }
 
   /* @brief Function to set the aging coefficient for the OCXO. Values should
@@ -560,11 +589,7 @@ public:
    */
   void serv_aging(double value)
   {
-    if (value >= -10.0 && value <= 10.0)
-    {
-      comm->write("SERV:AGING " + std::to_string(value));
-      comm->eat();
-    }
+    scpi_set(gpsdo_command::serv_aging, value);
   }
 
   /* @brief Function to set the integral component of the PID loop. Values
@@ -577,11 +602,7 @@ public:
    */
   void serv_phaseco(double value)
   {
-    if (value >= -100.0 && value <= 100.0)
-    {
-      comm->write("SERV:PHASECO " + std::to_string(value));
-      comm->eat();
-    }
+    scpi_set(gpsdo_command::serv_phaseco, value);
   }
 
   /* @brief Function to query the GPSDO's offset to UTC
@@ -592,7 +613,7 @@ public:
    */
   std::string serv_1pps()
   {
-    return comm->query("SERV:1PPS?");
+    return scpi_get(gpsdo_command::serv_1pps);
   }
 
   /* @brief Function to set the GPSDO's offset to UTC in 16.7ns incremnnts
@@ -601,8 +622,7 @@ public:
    */
   void serv_1pps(int offset)
   {
-    comm->write("SERV:1PPS " + std::to_string(offset));
-    comm->eat();
+    scpi_set(gpsdo_command::serv_1pps, offset);
   }
 
   /* @brief Function to set the frequency at which a debug trace is produced
@@ -617,8 +637,7 @@ public:
    */
   void serv_trac(size_t freq)
   {
-    comm->write("SERV:TRAC " + std::to_string(freq));
-    comm->eat();
+    scpi_set(gpsdo_command::serv_trac, freq);
   }
 };
 
@@ -1,68 +1,107 @@
 #ifndef CYRIAL_DEVICES_NMEA_HPP
 #define CYRIAL_DEVICES_NMEA_HPP
 
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "../channel.hpp"
 #include "base.hpp"
 
 namespace cyrial
 {
 
-/* @class nmea_device
+/* @class nmea_protocol
  *
- * @brief Class to represent a generic device which supports sending NMEA
- *        messages
+ * @brief Mixin providing the buffering of NMEA sentences to a device class
+ *        derived from base_device
+ *
+ * Sentences are held in a bounded channel, by default of the 256 most recent,
+ * so that they do not accumulate when @get_NMEA is not called. The channel is
+ * held by pointer, as it can be neither copied nor moved, so that device
+ * classes remain movable
+ *
+ * @tparam Device The device class (CRTP)
  */
-class nmea_device : virtual public base_device
+template <typename Device>
+class nmea_protocol
 {
+  interface& link()
+  {
+    return *static_cast<Device*>(this)->port();
+  }
+
+  std::vector<std::string> drained;
+
 protected:
-  std::vector<std::string> messages;
+  std::unique_ptr<channel<std::string>> messages;
 
+  nmea_protocol()
+    : messages(new channel<std::string>())
+  { }
+
+  /* @brief Function to set aside NMEA sentences which arrived in place of
+   *        a command response
+   *
+   * @param input The response read from the device
+   * @return The first response which is not an NMEA sentence, or an empty
+   *         string if none arrived
+   */
   std::string check_NMEA(std::string input)
   {
-    std::string result;
-
-    if (input[0] == '$')
+    // Continue reading until we receive a non-NMEA message. It may be
+    // required that we split strings on newlines, because I'm not certain if
+    // there will be a situation where the sought reply will be at the tail of
+    // the string
+    while (!input.empty() && input[0] == '$')
     {
-      messages.push_back(input);
-
-      result = comm->read();
+      messages->push(input);
 
-      // Idea is to continue reading until we receive a non-NMEA message
-      // It may be required that we split strings on newlines, because I'm not
-      // certain if there will be a situation where the sought reply will be
-      // at the tail of the string
-      while (result[0] == '$')
-      {
-        messages.push_back(input);
-
-        result = comm->read();
-      }
+      input = link().read();
     }
-    else
-      return input;
+
+    return input;
   }
 
 public:
-  /* @brief Constructor for nmea device
-   *
-   * @param A shared_ptr to a communication interface
-   */
-  nmea_device(std::shared_ptr<interface> port)
-    : base_device(port)
-  { }
-
   std::string get_NMEA()
   {
     std::string result = "";
 
-    for (auto msg : messages)
-      result += msg;
+    drained.clear();
+    messages->drain(drained);
 
-    messages.clear();
+    for (const auto& msg : drained)
+      result += msg;
 
     return result;
   }
+
+  /* @brief Function to get the channel of buffered sentences, e.g. to change
+   *        its capacity and policy, to read its counters, or to consume it
+   *        from another thread
+   */
+  channel<std::string>& NMEA_channel()
+  {
+    return *messages;
+  }
+};
+
+/* @class nmea_device
+ *
+ * @brief Class to represent a generic device which supports sending NMEA
+ *        messages
+ */
+class nmea_device : public base_device, public nmea_protocol<nmea_device>
+{
+public:
+  /* @brief Constructor for nmea device
+   *
+   * @param A shared_ptr to a communication interface
+   */
+  nmea_device(std::shared_ptr<interface> port)
+    : base_device(port)
+  { }
 };
 
 } // namespace cyrial
@@ -1,27 +1,305 @@
 #ifndef CYRIAL_DEVICES_SCPI_HPP
 #define CYRIAL_DEVICES_SCPI_HPP
 
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <string>
 
 #include "base.hpp"
+#include "../expected.hpp"
+#include "../trace.hpp"
 
 namespace cyrial
 {
 
-/* @class scpi_device
+/* @brief Types of the argument taken by a SCPI command
+ */
+enum scpi_arg { SCPI_NONE, SCPI_UINT, SCPI_INT, SCPI_REAL, SCPI_BOOL };
+
+/* @brief Types of the response to a SCPI query
+ */
+enum scpi_response { SCPI_TEXT, SCPI_NUMBER };
+
+/* @struct scpi_command
  *
- * @brief Class to represent a generic device which supports the SCPI protocol
+ * @brief Compile-time description of a SCPI command and its query form
+ */
+struct scpi_command
+{
+  const char* mnemonic;       // Without argument or '?', e.g. "SERV:EFCS"
+  scpi_arg arg;
+  double min;                 // Inclusive range of the argument
+  double max;
+  scpi_response response;
+};
+
+/* @brief Size of the buffer into which commands are formatted, enough for the
+ *        longest mnemonic and any argument
+ */
+const size_t scpi_max_command = 64;
+
+/* @brief Function to check whether a value is a valid argument of a command
+ *
+ * @param cmd The command
+ * @param value The proposed argument
+ * @return Whether the value is in range, and whole for integer arguments
+ */
+inline bool scpi_valid(const scpi_command& cmd, double value)
+{
+  if (cmd.arg == SCPI_NONE || cmd.arg == SCPI_BOOL)
+    return true;
+
+  if (!(value >= cmd.min && value <= cmd.max))
+    return false;
+
+  return cmd.arg == SCPI_REAL || value == std::floor(value);
+}
+
+/* @brief Function to format a command with its argument
+ *
+ * Reals are formatted as by std::to_string, booleans as ON or OFF
+ *
+ * @param cmd The command
+ * @param value The argument, ignored for SCPI_NONE
+ * @param buffer Buffer to format into
+ * @param size Size of the buffer
+ * @return The length of the command, or 0 if the value is not valid or the
+ *         buffer too small
+ */
+inline size_t scpi_format(const scpi_command& cmd, double value, char* buffer,
+    size_t size)
+{
+  if (!scpi_valid(cmd, value))
+    return 0;
+
+  int n;
+
+  switch (cmd.arg)
+  {
+    case SCPI_UINT:
+    case SCPI_INT:
+      n = std::snprintf(buffer, size, "%s %lld", cmd.mnemonic,
+                        (long long)value);
+      break;
+
+    case SCPI_REAL:
+      n = std::snprintf(buffer, size, "%s %f", cmd.mnemonic, value);
+      break;
+
+    case SCPI_BOOL:
+      n = std::snprintf(buffer, size, "%s %s", cmd.mnemonic,
+                        value != 0.0 ? "ON" : "OFF");
+      break;
+
+    default:
+      n = std::snprintf(buffer, size, "%s", cmd.mnemonic);
+  }
+
+  return n < 0 || (size_t)n >= size ? 0 : n;
+}
+
+/* @brief Function to check whether a response reports that the command was
+ *        rejected, which the firmware does with an error message in place of
+ *        the response
+ *
+ * @param response The device response
+ * @return Whether the response contains "error", in any case
+ */
+inline bool scpi_rejected(const std::string& response)
+{
+  static const char word[] = "error";
+
+  for (size_t i = 0; i + sizeof(word) - 1 <= response.size(); ++i)
+  {
+    size_t j = 0;
+
+    while (j < sizeof(word) - 1
+           && std::tolower((unsigned char)response[i + j]) == word[j])
+      ++j;
+
+    if (j == sizeof(word) - 1)
+      return true;
+  }
+
+  return false;
+}
+
+/* @brief Function to parse the numeric value of a query response, which
+ *        follows any echo of the query
+ *
+ * @param response The device response
+ * @param value Set to the value on success
+ * @return Whether a number was found
  */
-class scpi_device : virtual public base_device
+inline bool scpi_number(const std::string& response, double& value)
 {
+  size_t start = response.rfind('?');
+  start = start == std::string::npos ? 0 : start + 1;
+
+  const char* begin = response.c_str() + start;
+  char* end;
+
+  value = std::strtod(begin, &end);
+
+  return end != begin;
+}
+
+/* @brief Function to extract the serial number field from a response to
+ *        *IDN?, e.g. to identify a device and name it with one query
+ *
+ * @param id The response, which may be preceded by an echo of the command
+ * @return The serial number, or an empty string if the response could not be
+ *         parsed
+ */
+inline std::string idn_serial(const std::string& id)
+{
+  size_t start = 0;
+
+  // The response may be preceded by an echo of the command
+  size_t line = id.rfind("*IDN?");
+
+  if (line != std::string::npos)
+    start = id.find('\n', line) + 1;
+
+  for (int field = 0; field < 2; ++field)
+  {
+    start = id.find(',', start);
+
+    if (start == std::string::npos)
+      return "";
+
+    ++start;
+  }
+
+  size_t end = id.find_first_of(",\r\n", start);
+  std::string value = id.substr(start, end == std::string::npos
+                                               ? std::string::npos
+                                               : end - start);
+
+  size_t first = value.find_first_not_of(' ');
+  size_t last = value.find_last_not_of(' ');
+
+  return first == std::string::npos ? ""
+                                    : value.substr(first, last - first + 1);
+}
+
+/* @class scpi_protocol
+ *
+ * @brief Mixin providing the common SCPI commands to a device class derived
+ *        from base_device
+ *
+ * @tparam Device The device class (CRTP)
+ */
+template <typename Device>
+class scpi_protocol
+{
+  interface& link()
+  {
+    return *static_cast<Device*>(this)->port();
+  }
+
 public:
-  /* @brief Constructor for scpi device
+  /* @brief Function to send a command from a command table, consuming its
+   *        echo
    *
-   * @param A shared_ptr to a communication interface
+   * @param cmd The command
+   * @param value The argument, ignored for SCPI_NONE
+   * @return Nothing, or errc::range if the value is invalid and the port's
+   *         error if it could not be written
    */
-  scpi_device(std::shared_ptr<interface> port)
-    : base_device(port)
-  { }
+  expected<void> try_scpi_set(const scpi_command& cmd, double value=0.0)
+  {
+    CYRIAL_TRACE_SPAN(cmd.mnemonic, link().get_idx());
+    char buffer[scpi_max_command];
+
+    if (scpi_format(cmd, value, buffer, sizeof(buffer)) == 0)
+      return error(errc::range, cmd.mnemonic);
+
+    expected<void> written = link().try_write(buffer);
+
+    if (written)
+      link().eat();
+
+    return written;
+  }
+
+  /* @brief Function to send a command from a command table, see
+   *        @try_scpi_set
+   *
+   * @return Whether the command was sent
+   */
+  bool scpi_set(const scpi_command& cmd, double value=0.0)
+  {
+    return try_scpi_set(cmd, value).has_value();
+  }
+
+  /* @brief Function to query the value of a numeric command
+   *
+   * @param cmd The command, whose response type must be SCPI_NUMBER
+   * @return The value, or errc::timeout if there was no response, errc::nak
+   *         if the device reported an error, and errc::framing if the
+   *         response held no number
+   */
+  expected<double> try_scpi_get(const scpi_command& cmd)
+  {
+    CYRIAL_TRACE_SPAN(cmd.mnemonic, link().get_idx());
+    char buffer[scpi_max_command];
+    double value;
+
+    std::snprintf(buffer, sizeof(buffer), "%s?", cmd.mnemonic);
+
+    expected<const std::string*> response = link().try_query_view(buffer);
+
+    if (!response)
+      return response.error();
+
+    if (scpi_rejected(**response))
+      return error(errc::nak, cmd.mnemonic);
+
+    if (cmd.response != SCPI_NUMBER || !scpi_number(**response, value))
+      return error(errc::framing, cmd.mnemonic);
+
+    return value;
+  }
+
+  /* @brief Function to send the query form of a command from a command table,
+   *        without copying the response
+   *
+   * @param cmd The command
+   * @return The device response, valid until the next read from the port
+   */
+  const std::string& scpi_view(const scpi_command& cmd)
+  {
+    CYRIAL_TRACE_SPAN(cmd.mnemonic, link().get_idx());
+    char buffer[scpi_max_command];
+
+    std::snprintf(buffer, sizeof(buffer), "%s?", cmd.mnemonic);
+
+    return link().query_view(buffer);
+  }
+
+  /* @brief Function to send the query form of a command from a command table
+   *
+   * @param cmd The command
+   * @return The device response
+   */
+  std::string scpi_get(const scpi_command& cmd)
+  {
+    return scpi_view(cmd);
+  }
+
+  /* @brief Function to query the value of a numeric command
+   *
+   * @param cmd The command, whose response type must be SCPI_NUMBER
+   * @param value Set to the value on success
+   * @return Whether the response held a number
+   */
+  bool scpi_get(const scpi_command& cmd, double& value)
+  {
+    return cmd.response == SCPI_NUMBER && scpi_number(scpi_view(cmd), value);
+  }
 
   /* @brief Function to retreive identifying information about the device
    *
@@ -32,10 +310,36 @@ public:
    */
   std::string idn()
   {
-    return comm->query("*IDN?");
+    return link().query("*IDN?");
+  }
+
+  /* @brief Function to retreive the serial number field of @idn
+   *
+   * @return std::string The serial number, or an empty string if the response
+   *         could not be parsed
+   */
+  std::string serial()
+  {
+    return idn_serial(idn());
   }
 };
 
+/* @class scpi_device
+ *
+ * @brief Class to represent a generic device which supports the SCPI protocol
+ */
+class scpi_device : public base_device, public scpi_protocol<scpi_device>
+{
+public:
+  /* @brief Constructor for scpi device
+   *
+   * @param A shared_ptr to a communication interface
+   */
+  scpi_device(std::shared_ptr<interface> port)
+    : base_device(port)
+  { }
+};
+
 } // namespace cyrial
 
 #endif // CYRIAL_DEVICES_SCPI_HPP
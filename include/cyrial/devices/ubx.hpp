@@ -2,20 +2,117 @@
 #define CYRIAL_DEVICES_UBX_HPP
 
 #include <array>
+#include <cstdio>
 #include <string>
+#include <vector>
 
 #include "nmea.hpp"
+#include "../expected.hpp"
+#include "../log.hpp"
 
 namespace cyrial
 {
 
-/* @class ubx_device
+/* @brief Function to decode one byte of hex encoded data
  *
- * @brief Class to represent a generic device which supports the UBX (u-blox)
- *        communication protocol
+ * @return The byte, or -1 if the characters are not hex digits
+ */
+inline int hex_byte(const std::string& hex, size_t pos)
+{
+  int value = 0;
+
+  for (size_t i = pos; i < pos + 2; ++i)
+  {
+    char c = hex[i];
+    value <<= 4;
+
+    if (c >= '0' && c <= '9')      value |= c - '0';
+    else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+    else return -1;
+  }
+
+  return value;
+}
+
+/* @brief Function to locate and verify an UBX message in hex encoded data
+ *
+ * @param hex Data as returned by @interface::read_hex
+ * @param cls Class of the message sought
+ * @param id ID of the message sought
+ * @return Offset of the message in hex, or errc::timeout if there is no data,
+ *         errc::nak if the receiver answered with UBX-ACK-NAK for the
+ *         message, errc::checksum if the message failed its checksum, and
+ *         errc::framing if it was not found
  */
-class ubx_device : public nmea_device
+inline expected<size_t> check_ubx_frame(const std::string& hex, uint8_t cls,
+    uint8_t id)
 {
+  if (hex.empty())
+    return error(errc::timeout);
+
+  bool corrupt = false;
+
+  for (size_t pos = hex.find("b562"); pos != std::string::npos;
+       pos = hex.find("b562", pos + 2))
+  {
+    // Header: sync chars, class, ID, and little endian payload length
+    if (pos % 2 != 0 || hex.size() < pos + 12)
+      continue;
+
+    int c = hex_byte(hex, pos + 4);
+    int i = hex_byte(hex, pos + 6);
+    int length = hex_byte(hex, pos + 8) | hex_byte(hex, pos + 10) << 8;
+
+    if (c < 0 || i < 0 || length < 0
+        || hex.size() < pos + 2 * (8 + (size_t)length))
+      continue;
+
+    bool nak = c == 0x05 && i == 0x00 && length == 2
+               && hex_byte(hex, pos + 12) == cls
+               && hex_byte(hex, pos + 14) == id;
+
+    if (!nak && (c != cls || i != id))
+      continue;
+
+    uint8_t check_a = 0;
+    uint8_t check_b = 0;
+
+    for (size_t b = 0; b < 4 + (size_t)length; ++b)
+      check_b += (check_a += hex_byte(hex, pos + 4 + 2 * b));
+
+    size_t end = pos + 2 * (6 + length);
+
+    if (hex_byte(hex, end) != check_a || hex_byte(hex, end + 2) != check_b)
+    {
+      corrupt = true;
+      continue;
+    }
+
+    if (nak)
+      return error(errc::nak, "UBX-ACK-NAK");
+
+    return pos;
+  }
+
+  return error(corrupt ? errc::checksum : errc::framing);
+}
+
+/* @class ubx_protocol
+ *
+ * @brief Mixin providing the PUBX and UBX (u-blox) commands to a device class
+ *        derived from base_device
+ *
+ * @tparam Device The device class (CRTP)
+ */
+template <typename Device>
+class ubx_protocol
+{
+  interface& link()
+  {
+    return *static_cast<Device*>(this)->port();
+  }
+
   uint8_t s_mu = 0xb5; // μ sync character
   uint8_t s_b  = 0x62; // b sync character
 
@@ -23,21 +120,20 @@ class ubx_device : public nmea_device
 
   /* @bring Function to compute the checksum (XOR) of NMEA messages
    *
-   * @param The message to compute the checksum on, containing both '$' and '*'
+   * @param msg The message to compute the checksum on, containing both '$' and
+   *        '*', to which the checksum is appended
+   * @param length The length of the message
+   * @param size The size of the buffer holding the message
    */
-  void add_pubx_checksum(std::string &msg)
+  void add_pubx_checksum(char* msg, size_t length, size_t size)
   {
     uint8_t check = 0x00;
-    std::ostringstream checksum;
 
     // Start at 1 to skip '$', stop at (n - 1) to skip '*'
-    for (size_t i = 1; i < msg.length() - 1; ++i)
+    for (size_t i = 1; i < length - 1; ++i)
       check ^= (uint8_t)msg[i];
 
-    checksum << std::setw(2) << std::setfill('0') << std::hex << std::uppercase
-      << (int)check;
-
-    msg += checksum.str();
+    std::snprintf(msg + length, size - length, "%02X", check);
   }
 
   /* @brief Function to compute the Fletcher checksums of an UBX message and
@@ -66,28 +162,37 @@ class ubx_device : public nmea_device
    */
   std::string escape_ubx_message(std::vector<uint8_t> &msg)
   {
-    std::ostringstream result;
+    static const char digits[] = "0123456789abcdef";
+    std::string result;
+    result.reserve(4 * msg.size());
 
     for (size_t i = 0; i < msg.size(); ++i)
-      result << "\\x"
-        << std::setw(2) << std::setfill('0') << std::hex << (int)msg[i];
+    {
+      result += "\\x";
+      result += digits[msg[i] >> 4];
+      result += digits[msg[i] & 0xf];
+    }
 
-    std::cout << result.str() << std::endl;
-    return result.str();
+    CYRIAL_LOG(LOG_UBX, LOG_DEBUG, "tx {}", result);
+
+    return result;
   }
 
-public:
-  /* @brief Constructor for UBX device
-   *
-   * @param A shared_ptr to a communication interface
-   */
-  ubx_device(std::shared_ptr<interface> port)
-    : nmea_device(port), base_device(port)
+  // The escaped UBX-MON-HW poll
+  std::string ubx_mon_hw_message()
   {
-    comm->set_timeout(1000);
-    comm->set_baud(9600);
+    uint8_t length_a = 0x00;  // UBX_MON_HW passes no parameters
+    uint8_t length_b = 0x00;  //    so the length is always 0
+
+    std::vector<uint8_t> packet = { s_mu, s_b, c_mon, 0x09 /* ID */,
+                                    length_a, length_b };
+
+    add_ubx_checksum(packet);
+
+    return escape_ubx_message(packet);
   }
 
+public:
   // PUBX Messages
 
   /* @brief Function to control the output of NMEA messages on each interface.
@@ -103,13 +208,18 @@ public:
   void pubx_rate(std::string nmea_type, size_t i2c_rate=0, size_t uart_rate=0,
       size_t usb_rate=0, size_t spi_rate=0)
   {
-    std::string command = "$PUBX,40," + nmea_type + ","
-      + std::to_string(i2c_rate) + "," + std::to_string(uart_rate) + ","
-      + std::to_string(usb_rate) + "," + std::to_string(spi_rate) + ",0,0*";
+    char command[96];
+    int length = std::snprintf(command, sizeof(command) - 2,
+                               "$PUBX,40,%s,%zu,%zu,%zu,%zu,0,0*",
+                               nmea_type.c_str(), i2c_rate, uart_rate,
+                               usb_rate, spi_rate);
+
+    if (length < 0 || (size_t)length >= sizeof(command) - 2)
+      return;
 
-    add_pubx_checksum(command);
+    add_pubx_checksum(command, length, sizeof(command));
 
-    comm->write(command);
+    link().write(command);
   }
 
   // UBX Messages
@@ -149,15 +259,29 @@ public:
    */
   std::string ubx_mon_hw()
   {
-    uint8_t length_a = 0x00;  // UBX_MON_HW passes no parameters
-    uint8_t length_b = 0x00;  //    so the length is always 0
+    return link().query_hex(ubx_mon_hw_message());
+  }
 
-    std::vector<uint8_t> packet = { s_mu, s_b, c_mon, 0x09 /* ID */,
-                                    length_a, length_b };
+  /* @brief Function to get the results of the UBX-MON-HW command, verifying
+   *        the response
+   *
+   * @return The output of the UBX-MON-HW command, errc::disconnected or
+   *         errc::timeout if the port failed or nothing arrived, or the error
+   *         reported by @check_ubx_frame
+   */
+  expected<std::string> try_ubx_mon_hw()
+  {
+    expected<std::string> hex = link().try_query_hex(ubx_mon_hw_message());
 
-    add_ubx_checksum(packet);
+    if (!hex)
+      return hex.error();
+
+    expected<size_t> frame = check_ubx_frame(*hex, c_mon, 0x09);
+
+    if (!frame)
+      return frame.error();
 
-    return comm->query_hex(escape_ubx_message(packet));
+    return hex;
   }
 
   /* @brief Function to get the results of the UBX-MON-VER command
@@ -177,7 +301,28 @@ public:
 
     add_ubx_checksum(packet);
 
-    return comm->query_raw(escape_ubx_message(packet));
+    return link().query_raw(escape_ubx_message(packet));
+  }
+};
+
+/* @class ubx_device
+ *
+ * @brief Class to represent a generic device which supports the UBX (u-blox)
+ *        communication protocol
+ */
+class ubx_device : public base_device, public nmea_protocol<ubx_device>,
+                   public ubx_protocol<ubx_device>
+{
+public:
+  /* @brief Constructor for UBX device
+   *
+   * @param A shared_ptr to a communication interface
+   */
+  ubx_device(std::shared_ptr<interface> port)
+    : base_device(port)
+  {
+    comm->set_timeout(1000);
+    comm->set_baud(9600);
   }
 };
 
@@ -0,0 +1,205 @@
+#ifndef CYRIAL_EXPECTED_HPP
+#define CYRIAL_EXPECTED_HPP
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace cyrial
+{
+
+/* @brief Reasons for a command to fail
+ */
+enum class errc
+{
+  timeout,        // No response within the port's timeout
+  framing,        // A response arrived but its structure was not recognized
+  checksum,       // A framed response failed its checksum
+  range,          // An argument was outside the range the command accepts
+  nak,            // The device rejected the command
+  disconnected    // The port could not be read or written
+};
+
+inline const char* errc_name(errc code)
+{
+  switch (code)
+  {
+    case errc::timeout:      return "timeout";
+    case errc::framing:      return "framing";
+    case errc::checksum:     return "checksum";
+    case errc::range:        return "range";
+    case errc::nak:          return "nak";
+    case errc::disconnected: return "disconnected";
+  }
+
+  return "unknown";
+}
+
+/* @struct error
+ *
+ * @brief A failed command: its code and, optionally, a static description
+ */
+struct error
+{
+  errc code;
+  const char* detail;
+
+  error(errc c, const char* d=nullptr)
+    : code(c), detail(d)
+  { }
+
+  std::string message() const
+  {
+    return detail ? std::string(errc_name(code)) + ": " + detail
+                  : std::string(errc_name(code));
+  }
+};
+
+/* @class bad_expected_access
+ *
+ * @brief Thrown by @expected::value when it holds an error
+ */
+class bad_expected_access : public std::runtime_error
+{
+  cyrial::error err;
+
+public:
+  bad_expected_access(const cyrial::error& e)
+    : std::runtime_error(e.message()), err(e)
+  { }
+
+  const cyrial::error& error() const
+  {
+    return err;
+  }
+};
+
+/* @class expected
+ *
+ * @brief The result of a command: either a value or an error, in the manner of
+ *        C++23's std::expected<T, cyrial::error>
+ *
+ * T must be default constructible
+ *
+ * @tparam T The type of the value
+ */
+template <typename T>
+class expected
+{
+  T val;
+  cyrial::error err;
+  bool has;
+
+public:
+  expected(const T& v)
+    : val(v), err(errc::timeout), has(true)
+  { }
+
+  expected(T&& v)
+    : val(std::move(v)), err(errc::timeout), has(true)
+  { }
+
+  expected(const cyrial::error& e)
+    : val(), err(e), has(false)
+  { }
+
+  bool has_value() const
+  {
+    return has;
+  }
+
+  explicit operator bool() const
+  {
+    return has;
+  }
+
+  /* @brief Function to get the value
+   *
+   * @throw bad_expected_access If an error is held
+   */
+  const T& value() const
+  {
+    if (!has)
+      throw bad_expected_access(err);
+
+    return val;
+  }
+
+  T& value()
+  {
+    if (!has)
+      throw bad_expected_access(err);
+
+    return val;
+  }
+
+  const T& operator*() const
+  {
+    return val;
+  }
+
+  T& operator*()
+  {
+    return val;
+  }
+
+  const T* operator->() const
+  {
+    return &val;
+  }
+
+  T value_or(const T& fallback) const
+  {
+    return has ? val : fallback;
+  }
+
+  /* @brief Function to get the error, only meaningful if no value is held
+   */
+  const cyrial::error& error() const
+  {
+    return err;
+  }
+};
+
+/* @brief Specialization for commands which return no value
+ */
+template <>
+class expected<void>
+{
+  cyrial::error err;
+  bool has;
+
+public:
+  expected()
+    : err(errc::timeout), has(true)
+  { }
+
+  expected(const cyrial::error& e)
+    : err(e), has(false)
+  { }
+
+  bool has_value() const
+  {
+    return has;
+  }
+
+  explicit operator bool() const
+  {
+    return has;
+  }
+
+  void value() const
+  {
+    if (!has)
+      throw bad_expected_access(err);
+  }
+
+  const cyrial::error& error() const
+  {
+    return err;
+  }
+};
+
+} // namespace cyrial
+
+#endif // CYRIAL_EXPECTED_HPP
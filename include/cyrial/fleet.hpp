@@ -0,0 +1,673 @@
+#ifndef CYRIAL_FLEET_HPP
+#define CYRIAL_FLEET_HPP
+
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <istream>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "csv.hpp"
+#include "devices/csac.hpp"
+#include "devices/gpsdo.hpp"
+#include "devices/ubx.hpp"
+#include "telemetry/sampler.hpp"
+
+namespace cyrial
+{
+
+/* @brief Function to remove leading and trailing whitespace
+ */
+inline std::string strip(const std::string& s)
+{
+  size_t first = s.find_first_not_of(" \t\r\n");
+
+  if (first == std::string::npos)
+    return "";
+
+  return s.substr(first, s.find_last_not_of(" \t\r\n") - first + 1);
+}
+
+/* @class fleet_config
+ *
+ * @brief Class to hold the desired settings of a fleet of devices
+ *
+ * The file format is INI-like. A section names a device type, optionally
+ * followed by the name (serial number) of one device whose settings override
+ * those of its type:
+ *
+ *   # Every GPSDO
+ *   [gpsdo]
+ *   serv.efcs = 6.0
+ *   gps.gpgga = 0
+ *
+ *   [gpsdo:12345]
+ *   serv.efcs = 0.7
+ *
+ *   [ubx]
+ *   pubx.GGA = 0,1,0,0
+ *
+ * Lines starting with '#' or ';' are comments
+ */
+class fleet_config
+{
+  typedef std::map<std::string, std::string> settings;
+
+  std::map<std::string, settings> sections;
+
+public:
+  fleet_config() { }
+
+  /* @brief Constructor for fleet_config reading a file
+   *
+   * @param path Location of the file
+   */
+  fleet_config(const std::string& path)
+  {
+    std::ifstream in(path);
+
+    if (!in)
+      throw std::runtime_error("Failed to open " + path);
+
+    parse(in);
+  }
+
+  /* @brief Function to read settings, adding to or replacing those already
+   *        held
+   *
+   * @param in The stream to read
+   */
+  void parse(std::istream& in)
+  {
+    std::string line;
+    std::string section;
+    size_t number = 0;
+
+    while (std::getline(in, line))
+    {
+      ++number;
+      line = strip(line);
+
+      if (line.empty() || line[0] == '#' || line[0] == ';')
+        continue;
+
+      if (line[0] == '[')
+      {
+        if (line.back() != ']')
+          throw std::runtime_error("Unterminated section on line "
+                                   + std::to_string(number));
+
+        section = strip(line.substr(1, line.size() - 2));
+        continue;
+      }
+
+      size_t eq = line.find('=');
+
+      if (eq == std::string::npos || section.empty())
+        throw std::runtime_error("Expected key = value on line "
+                                 + std::to_string(number));
+
+      sections[section][strip(line.substr(0, eq))] = strip(line.substr(eq + 1));
+    }
+  }
+
+  /* @brief Function to get the desired settings of a device
+   *
+   * @param type The device type, e.g. "gpsdo"
+   * @param name The device name
+   * @return The settings of the type, overridden by those of the device
+   */
+  settings desired(const std::string& type, const std::string& name) const
+  {
+    settings result;
+    auto it = sections.find(type);
+
+    if (it != sections.end())
+      result = it->second;
+
+    it = sections.find(type + ":" + name);
+
+    if (it != sections.end())
+      for (const auto& entry : it->second)
+        result[entry.first] = entry.second;
+
+    return result;
+  }
+};
+
+/* @class configurable
+ *
+ * @brief Interface through which the fleet engine reads and applies the
+ *        settings of a device
+ */
+class configurable
+{
+public:
+  virtual ~configurable() { }
+
+  /* @brief Function to get the section name of the device type
+   */
+  virtual std::string type() const = 0;
+
+  /* @brief Function to get the name of the device, e.g. its serial number
+   */
+  virtual std::string name() const = 0;
+
+  /* @brief Function to read the current value of every readable setting
+   *
+   * @param current Map from setting key to value, to fill
+   */
+  virtual void read(std::map<std::string, std::string>& current) = 0;
+
+  /* @brief Function to apply a setting
+   *
+   * @param key The setting
+   * @param value The value
+   * @return Whether the setting is known and the value valid
+   */
+  virtual bool apply(const std::string& key, const std::string& value) = 0;
+};
+
+/* @brief Function to parse SCPI responses made of "MNEMONIC value" lines (as
+ *        returned by SERV? and GPS?) into a map
+ *
+ * @param response The device response
+ * @param out Map from upper case mnemonic to value
+ */
+inline void parse_scpi_settings(const std::string& response,
+    std::map<std::string, std::string>& out)
+{
+  std::istringstream in(response);
+  std::string line;
+
+  while (std::getline(in, line))
+  {
+    // Strip a prompt, if enabled
+    size_t prompt = line.find('>');
+
+    if (prompt != std::string::npos)
+      line = line.substr(prompt + 1);
+
+    line = strip(line);
+    size_t space = line.find_first_of(" \t");
+
+    if (space == std::string::npos || line.find(':') > space
+        || line.find('?') != std::string::npos)
+      continue;
+
+    std::string key = line.substr(0, space);
+
+    for (char& c : key)
+      c = std::toupper(c);
+
+    out[key] = strip(line.substr(space + 1));
+  }
+}
+
+/* @brief Function to get the value of a single-valued query, i.e. the last
+ *        line which is not the echoed command or a prompt
+ */
+inline std::string scpi_value(const std::string& response)
+{
+  std::istringstream in(response);
+  std::string line;
+  std::string value;
+
+  while (std::getline(in, line))
+  {
+    size_t prompt = line.find('>');
+
+    if (prompt != std::string::npos)
+      line = line.substr(prompt + 1);
+
+    line = strip(line);
+
+    if (!line.empty() && line.find('?') == std::string::npos)
+      value = line;
+  }
+
+  return value;
+}
+
+/* @class gpsdo_configurable
+ *
+ * @brief Settings of a GPSDO: servo coefficients (serv.*), NMEA output rates
+ *        (gps.*), and command echo and prompt (syst.echo, syst.prompt)
+ */
+class gpsdo_configurable : public configurable
+{
+  struct parameter
+  {
+    const char* key;
+    const scpi_command* command;  // Mnemonic as reported by SERV? or GPS?
+  };
+
+  static const std::vector<parameter>& parameters()
+  {
+    namespace c = gpsdo_command;
+
+    static const std::vector<parameter> table = {
+      { "serv.efcs",    &c::serv_efcs    },
+      { "serv.efcd",    &c::serv_efcd    },
+      { "serv.tempco",  &c::serv_tempco  },
+      { "serv.aging",   &c::serv_aging   },
+      { "serv.phaseco", &c::serv_phaseco },
+      { "serv.1pps",    &c::serv_1pps    },
+      { "gps.gpgga",    &c::gps_gpgga    },
+      { "gps.ggast",    &c::gps_ggast    },
+      { "gps.gprmc",    &c::gps_gprmc    },
+      { "gps.xyzsp",    &c::gps_xyzsp    }
+    };
+
+    return table;
+  }
+
+  std::shared_ptr<gpsdo_device> dev;
+  std::string id;
+
+public:
+  gpsdo_configurable(std::shared_ptr<gpsdo_device> d, const std::string& n)
+    : dev(d), id(n)
+  { }
+
+  std::string type() const override
+  {
+    return "gpsdo";
+  }
+
+  std::string name() const override
+  {
+    return id;
+  }
+
+  void read(std::map<std::string, std::string>& current) override
+  {
+    std::map<std::string, std::string> scpi;
+
+    // One query per group rather than one per setting
+    parse_scpi_settings(dev->serv(), scpi);
+    parse_scpi_settings(dev->gps(), scpi);
+
+    for (const auto& p : parameters())
+    {
+      auto it = scpi.find(p.command->mnemonic);
+
+      if (it != scpi.end())
+        current[p.key] = it->second;
+    }
+
+    current["syst.echo"] = scpi_value(dev->syst_comm_ser_echo());
+    current["syst.prompt"] = scpi_value(dev->syst_comm_ser_pro());
+  }
+
+  bool apply(const std::string& key, const std::string& value) override
+  {
+    if (key == "syst.echo" || key == "syst.prompt")
+    {
+      std::string v = value;
+
+      for (char& c : v)
+        c = std::toupper(c);
+
+      if (v != "ON" && v != "OFF")
+        return false;
+
+      if (key == "syst.echo")
+        dev->syst_comm_ser_echo(v == "ON");
+      else
+        dev->syst_comm_ser_pro(v == "ON");
+
+      return true;
+    }
+
+    for (const auto& p : parameters())
+      if (key == p.key)
+      {
+        char* end;
+        double v = std::strtod(value.c_str(), &end);
+
+        // Out of range values are rejected by the command table
+        return end != value.c_str() && *end == '\0'
+               && dev->scpi_set(*p.command, v);
+      }
+
+    return false;
+  }
+};
+
+/* @class ubx_configurable
+ *
+ * @brief Settings of a u-blox receiver: NMEA output rates per interface
+ *        (pubx.<message> = <i2c>,<uart>,<usb>,<spi>)
+ *
+ * The rates cannot be read back, so they are applied on every run and
+ * reported as unverified
+ */
+class ubx_configurable : public configurable
+{
+  std::shared_ptr<ubx_device> dev;
+  std::string id;
+
+public:
+  ubx_configurable(std::shared_ptr<ubx_device> d, const std::string& n)
+    : dev(d), id(n)
+  { }
+
+  std::string type() const override
+  {
+    return "ubx";
+  }
+
+  std::string name() const override
+  {
+    return id;
+  }
+
+  void read(std::map<std::string, std::string>&) override
+  { }
+
+  bool apply(const std::string& key, const std::string& value) override
+  {
+    if (key.compare(0, 5, "pubx.") != 0 || key.size() == 5)
+      return false;
+
+    size_t rates[4] = { 0, 0, 0, 0 };
+    std::istringstream in(value);
+    std::string field;
+
+    for (size_t i = 0; i < 4 && std::getline(in, field, ','); ++i)
+    {
+      char* end = nullptr;
+      rates[i] = std::strtoul(field.c_str(), &end, 10);
+
+      if (end == field.c_str())
+        return false;
+    }
+
+    dev->pubx_rate(key.substr(5), rates[0], rates[1], rates[2], rates[3]);
+
+    return true;
+  }
+};
+
+/* @class csac_configurable
+ *
+ * @brief Settings of a CSAC: the absolute frequency steer (csac.steer, in
+ *        pp10^15), read back from telemetry
+ *
+ * The steer is never latched with @csac_device::STEER_FREQ_LOCK, which
+ * consumes one of the unit's limited flash writes
+ */
+class csac_configurable : public configurable
+{
+  std::shared_ptr<csac_device> dev;
+  std::string id;
+
+public:
+  csac_configurable(std::shared_ptr<csac_device> d, const std::string& n)
+    : dev(d), id(n)
+  { }
+
+  std::string type() const override
+  {
+    return "csac";
+  }
+
+  std::string name() const override
+  {
+    return id;
+  }
+
+  void read(std::map<std::string, std::string>& current) override
+  {
+    std::vector<sample> samples;
+
+    parse_csac_telemetry(dev->telemetry_header(), dev->telemetry_data(), 0,
+                         now_ns(), samples);
+
+    for (const auto& s : samples)
+      if (s.metric == metric::csac_steer)
+        current["csac.steer"] = std::to_string((long long)s.value);
+  }
+
+  bool apply(const std::string& key, const std::string& value) override
+  {
+    if (key != "csac.steer")
+      return false;
+
+    char* end;
+    long steer = std::strtol(value.c_str(), &end, 10);
+
+    return end != value.c_str() && *end == '\0' && steer >= INT_MIN
+           && steer <= INT_MAX && dev->try_steer_freq_abs(steer).has_value();
+  }
+};
+
+/* @brief Function to compare a desired setting with the value reported by a
+ *        device
+ *
+ * Numbers are equal if they agree to the precision the device reports, so
+ * "6" matches "6.00" but "0.72" does not match "0.70". ON/OFF, 1/0 and
+ * TRUE/FALSE are interchangeable
+ */
+inline bool setting_matches(const std::string& desired,
+    const std::string& current)
+{
+  char* end_d = nullptr;
+  char* end_c = nullptr;
+  double d = std::strtod(desired.c_str(), &end_d);
+  double c = std::strtod(current.c_str(), &end_c);
+
+  if (!desired.empty() && !current.empty() && *end_d == '\0'
+      && *end_c == '\0')
+  {
+    if (current.find_first_of("eE") != std::string::npos)
+      return std::fabs(d - c) <= 1e-6 * std::fabs(c);
+
+    size_t dot = current.find('.');
+    int decimals = 0;
+
+    if (dot != std::string::npos)
+      decimals = current.size() - dot - 1;
+
+    return std::fabs(d - c) <= 0.5 * std::pow(10.0, -decimals) + 1e-12;
+  }
+
+  auto normalize = [](std::string v) {
+    for (char& ch : v)
+      ch = std::toupper(ch);
+
+    if (v == "1" || v == "TRUE")  return std::string("ON");
+    if (v == "0" || v == "FALSE") return std::string("OFF");
+
+    return v;
+  };
+
+  return normalize(desired) == normalize(current);
+}
+
+/* @brief Outcome of a setting
+ *
+ * SET_UNCHANGED : already at the desired value, nothing written
+ * SET_VERIFIED  : written and read back at the desired value
+ * SET_APPLIED   : written, but the device does not report it
+ * SET_FAILED    : written, but read back at a different value
+ * SET_INVALID   : unknown setting or invalid value, nothing written
+ * SET_PENDING   : differs, not written (dry run)
+ */
+enum setting_status { SET_UNCHANGED, SET_VERIFIED, SET_APPLIED, SET_FAILED,
+                      SET_INVALID, SET_PENDING };
+
+/* @struct setting_change
+ *
+ * @brief A setting of one device considered by the fleet engine
+ */
+struct setting_change
+{
+  std::string key;
+  std::string desired;
+  std::string before;         // Empty if unreadable
+  std::string after;
+  setting_status status;
+};
+
+/* @struct device_report
+ *
+ * @brief Outcome of configuring one device
+ */
+struct device_report
+{
+  std::string type;
+  std::string name;
+  std::string error;          // Empty on success
+  std::vector<setting_change> settings;
+};
+
+/* @class fleet
+ *
+ * @brief Class to bring a fleet of devices to the settings of a fleet_config
+ *
+ * Each device is handled on its own thread: its current settings are read
+ * with as few queries as possible, only those which differ from the desired
+ * values are written, one after another as a single transaction, and the
+ * device is read once more to verify them. Settings which already match are
+ * never rewritten, which spares devices that persist settings to flash
+ */
+class fleet
+{
+  std::vector<std::shared_ptr<configurable>> devices;
+
+  static void configure(configurable& dev, const fleet_config& config,
+      bool dry_run, device_report& report)
+  {
+    report.type = dev.type();
+    report.name = dev.name();
+
+    try
+    {
+      std::map<std::string, std::string> current;
+      dev.read(current);
+
+      bool written = false;
+
+      for (const auto& entry : config.desired(report.type, report.name))
+      {
+        setting_change c{ entry.first, entry.second, "", "", SET_UNCHANGED };
+        auto it = current.find(c.key);
+
+        if (it != current.end())
+          c.before = c.after = it->second;
+
+        if (it == current.end() || !setting_matches(c.desired, c.before))
+        {
+          if (dry_run)
+            c.status = SET_PENDING;
+          else if (dev.apply(c.key, c.desired))
+          {
+            c.status = SET_APPLIED;
+            written = true;
+          }
+          else
+            c.status = SET_INVALID;
+        }
+
+        report.settings.push_back(c);
+      }
+
+      if (!written)
+        return;
+
+      current.clear();
+      dev.read(current);
+
+      for (auto& c : report.settings)
+      {
+        auto it = current.find(c.key);
+
+        if (c.status != SET_APPLIED || it == current.end())
+          continue;
+
+        c.after = it->second;
+        c.status = setting_matches(c.desired, c.after) ? SET_VERIFIED
+                                                       : SET_FAILED;
+      }
+    }
+    catch (const std::exception& e)
+    {
+      report.error = e.what();
+    }
+  }
+
+public:
+  /* @brief Function to add a device to the fleet
+   */
+  void add(std::shared_ptr<configurable> dev)
+  {
+    devices.push_back(dev);
+  }
+
+  /* @brief Function to configure every device concurrently
+   *
+   * @param config The desired settings
+   * @param dry_run Whether to only report the differences
+   * @return One report per device, in the order they were added
+   */
+  std::vector<device_report> apply(const fleet_config& config,
+      bool dry_run=false)
+  {
+    std::vector<device_report> reports(devices.size());
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < devices.size(); ++i)
+      threads.emplace_back(&fleet::configure, std::ref(*devices[i]),
+                           std::cref(config), dry_run, std::ref(reports[i]));
+
+    for (auto& t : threads)
+      t.join();
+
+    return reports;
+  }
+};
+
+/* @brief Function to write the outcome of a fleet run as CSV, one line per
+ *        setting (or per device which could not be configured)
+ *
+ * @param out Stream to write to
+ * @param reports The reports
+ * @param changes_only Whether to omit settings which were already correct
+ */
+inline void write_fleet_report(std::ostream& out,
+    const std::vector<device_report>& reports, bool changes_only=false)
+{
+  static const char* status[] = { "unchanged", "verified", "applied",
+                                  "failed", "invalid", "pending" };
+
+  out << "type,name,setting,desired,before,after,status\n";
+
+  for (const auto& r : reports)
+  {
+    std::string device = csv_field(r.type) + ',' + csv_field(r.name) + ',';
+
+    if (!r.error.empty())
+      out << device << ",,,," << csv_field("error: " + r.error) << '\n';
+
+    for (const auto& c : r.settings)
+      if (!changes_only || c.status != SET_UNCHANGED)
+        out << device << csv_field(c.key) << ',' << csv_field(c.desired)
+            << ',' << csv_field(c.before) << ',' << csv_field(c.after) << ','
+            << status[c.status] << '\n';
+  }
+}
+
+} // namespace cyrial
+
+#endif // CYRIAL_FLEET_HPP
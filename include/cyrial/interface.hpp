@@ -2,9 +2,17 @@
 #define CYRIAL_INTERFACE_HPP
 
 #include <array>
+#include <cstdio>
+#include <memory>
 #include <string>
 
+#ifndef CYRIAL_NO_PYTHON
 #include <Python.h>
+#endif
+
+#include "expected.hpp"
+#include "journal.hpp"
+#include "trace.hpp"
 
 namespace cyrial
 {
@@ -17,6 +25,91 @@ std::array<size_t, 31> baud_rates{ 50,      75,      110,     134,     150,
                                    2000000, 2500000, 3000000, 3500000, 4000000,
                                    0 };
 
+/* @brief Function to convert a string containing Python escape sequences (as
+ *        produced by repr, or accepted in a string literal) into raw bytes
+ *
+ * @param escaped The escaped string
+ * @return The raw bytes
+ */
+inline std::string unescape(const std::string& escaped)
+{
+  std::string raw;
+  raw.reserve(escaped.size());
+
+  for (size_t i = 0; i < escaped.size(); ++i)
+  {
+    if (escaped[i] != '\\' || i + 1 == escaped.size())
+    {
+      raw += escaped[i];
+      continue;
+    }
+
+    switch (escaped[++i])
+    {
+      case 'n': raw += '\n'; break;
+      case 'r': raw += '\r'; break;
+      case 't': raw += '\t'; break;
+      case '0': raw += '\0'; break;
+      case 'x':
+        if (i + 2 < escaped.size())
+        {
+          raw += (char)std::stoi(escaped.substr(i + 1, 2), nullptr, 16);
+          i += 2;
+          break;
+        }
+        // fall through
+      default:  raw += escaped[i]; break;
+    }
+  }
+
+  return raw;
+}
+
+/* @brief Function to convert a string of hex digits into raw bytes
+ *
+ * @param hex The hex string, two digits per byte
+ * @return The raw bytes
+ */
+inline std::string unhex(const std::string& hex)
+{
+  std::string raw;
+
+  for (size_t i = 0; i + 1 < hex.size(); i += 2)
+    raw += (char)std::stoi(hex.substr(i, 2), nullptr, 16);
+
+  return raw;
+}
+
+#ifndef CYRIAL_NO_PYTHON
+
+/* @class py_lock
+ *
+ * @brief Class to hold the Python global interpreter lock for its lifetime
+ *
+ * Every call into the interpreter is made under a py_lock so that interfaces
+ * may be used from several threads. Blocking I/O in pyserial releases the
+ * lock, so devices on different ports still communicate concurrently.
+ * Acquisition is recursive, and a thread which already holds the lock (e.g.
+ * an application embedding cyrial) is unaffected
+ */
+class py_lock
+{
+  PyGILState_STATE state;
+
+public:
+  py_lock()
+    : state(PyGILState_Ensure())
+  { }
+
+  ~py_lock()
+  {
+    PyGILState_Release(state);
+  }
+
+  py_lock(const py_lock&) = delete;
+  py_lock& operator=(const py_lock&) = delete;
+};
+
 /* @class interface
  *
  * @brief Class to represent a interface which supports serial
@@ -36,10 +129,28 @@ class interface
   std::string location;
   std::string name;
 
+  // Interpreter variable holding the last response of this port, distinct per
+  // port so that threads cannot clobber each other's results
+  std::string result_var;
+
+  // Reused to build statements and hold responses. The interpreter still
+  // allocates, so unlike the native implementation this path is not
+  // allocation free
+  std::string statement;
+  std::string rx;
+
   PyObject* py_device;
   PyObject* py_context;
   PyObject* py_main;
 
+  std::shared_ptr<journal> traffic;
+
+  void record(direction dir, const std::string& data)
+  {
+    if (traffic)
+      traffic->record(idx, location, dir, data);
+  }
+
 public:
   /* @brief Constructor for interface
    *
@@ -50,8 +161,11 @@ public:
    */
   interface(Py_ssize_t i, PyObject* py_dev, PyObject* py_cxt,
       PyObject* py_mn)
-    : idx(i), py_device(py_dev), py_context(py_cxt), py_main(py_mn)
+    : idx(i), result_var("c_tmp" + std::to_string(i)), py_device(py_dev),
+      py_context(py_cxt), py_main(py_mn)
   {
+    py_lock lock;
+
     // Set default timeout in ms
     PyObject* py_default_timeout = PyInt_FromLong(200);
     PyObject_SetAttrString(py_device, "timeout", py_default_timeout);
@@ -72,6 +186,27 @@ public:
     return idx;
   }
 
+  /* @brief Function to get the location (resource name) of the interface
+   *
+   * @return The location
+   */
+  const std::string& get_location()
+  {
+    return location;
+  }
+
+  /* @brief Function to record all future traffic of the interface
+   *
+   * Python mode only observes decoded data, so the payload of @read is
+   * recorded without line terminators
+   *
+   * @param j The journal to record to, or nullptr to stop recording
+   */
+  void set_journal(std::shared_ptr<journal> j)
+  {
+    traffic = j;
+  }
+
   /* @brief Function to get device baud rate
    *
    * @return The current setting for baud rate
@@ -91,6 +226,7 @@ public:
     for (size_t i = 0; proposed != baud_rate && i < baud_rates.size(); ++i)
       if (proposed == baud_rates[i])
       {
+        py_lock lock;
         PyObject* py_new_baud_rate = PyInt_FromLong(proposed);
         PyObject_SetAttrString(py_device, "baud_rate", py_new_baud_rate);
         Py_DECREF(py_new_baud_rate);
@@ -118,6 +254,7 @@ public:
   {
     if (t != timeout)
     {
+      py_lock lock;
       PyObject* py_new_timeout = PyInt_FromLong(t);
       PyObject_SetAttrString(py_device, "timeout", py_new_timeout);
       Py_DECREF(py_new_timeout);
@@ -130,22 +267,21 @@ public:
    */
   void write_raw(std::string data)
   {
-    std::string command = "c_dev[" + std::to_string(idx) + "].write_raw('"
-      + data + "')";
-
-    PyRun_SimpleString(command.c_str());
+    try_write_raw(data);
   }
 
   /* @brief Function to write commands to device
    *
    * @param cmd Command to send to device
    */
-  void write(std::string cmd)
+  void write(const char* cmd)
   {
-    std::string command = "c_dev[" + std::to_string(idx) + "].write('" + cmd
-                                                                         + "')";
+    try_write(cmd);
+  }
 
-    PyRun_SimpleString(command.c_str());
+  void write(const std::string& cmd)
+  {
+    write(cmd.c_str());
   }
 
   /* @brief Function to read raw data from buffer of device
@@ -154,14 +290,16 @@ public:
    */
   std::string read_raw()
   {
+    CYRIAL_TRACE_SPAN("read", idx);
     std::string temp = "";
     std::string response;
-    std::string command = "temp = repr(c_dev[" + std::to_string(idx)
+    std::string command = result_var + " = repr(c_dev[" + std::to_string(idx)
                                                         + "].read_raw())[1:-1]";
 
+    py_lock lock;
     PyObject* py_resp = PyRun_String(command.c_str(), Py_single_input,
                                      py_context, py_context);
-    PyObject* py_temp = PyObject_GetAttrString(py_main, "temp");
+    PyObject* py_temp = PyObject_GetAttrString(py_main, result_var.c_str());
 
     response = PyString_AsString(PyObject_Str(py_temp));
 
@@ -171,12 +309,15 @@ public:
 
       py_resp = PyRun_String(command.c_str(), Py_single_input,
                              py_context, py_context);
-      py_temp = PyObject_GetAttrString(py_main, "temp");
+      py_temp = PyObject_GetAttrString(py_main, result_var.c_str());
 
       temp = PyString_AsString(PyObject_Str(py_temp));
 
     } while (!temp.empty());
 
+    if (traffic)
+      record(DIR_IN, unescape(response));
+
     return response;
   }
 
@@ -186,14 +327,16 @@ public:
    */
   std::string read_hex()
   {
+    CYRIAL_TRACE_SPAN("read", idx);
     std::string temp = "";
     std::string response;
-    std::string command = "temp = repr(c_dev[" + std::to_string(idx)
+    std::string command = result_var + " = repr(c_dev[" + std::to_string(idx)
                                           + "].read_raw().encode('hex'))[1:-1]";
 
+    py_lock lock;
     PyObject* py_resp = PyRun_String(command.c_str(), Py_single_input,
                                      py_context, py_context);
-    PyObject* py_temp = PyObject_GetAttrString(py_main, "temp");
+    PyObject* py_temp = PyObject_GetAttrString(py_main, result_var.c_str());
 
     response = PyString_AsString(PyObject_Str(py_temp));
 
@@ -203,29 +346,38 @@ public:
 
       py_resp = PyRun_String(command.c_str(), Py_single_input,
                              py_context, py_context);
-      py_temp = PyObject_GetAttrString(py_main, "temp");
+      py_temp = PyObject_GetAttrString(py_main, result_var.c_str());
 
       temp = PyString_AsString(PyObject_Str(py_temp));
 
     } while (!temp.empty());
 
+    if (traffic)
+      record(DIR_IN, unhex(response));
+
     return response;
   }
 
-  /* @brief Function to read from buffer of device
+  /* @brief Function to read from buffer of device into the port's receive
+   *        buffer
+   *
+   * The returned reference is only valid until the next read from this port,
+   * and must not be used concurrently with one
    *
    * @return String containing raw device buffer contents
    */
-  std::string read()
+  const std::string& read_view()
   {
+    CYRIAL_TRACE_SPAN("read", idx);
     std::string temp = "";
-    std::string response;
-    std::string command = "temp = c_dev[" + std::to_string(idx)
+    std::string& response = rx;
+    std::string command = result_var + " = c_dev[" + std::to_string(idx)
                                                           + "].read().rstrip()";
 
+    py_lock lock;
     PyObject* py_resp = PyRun_String(command.c_str(), Py_single_input,
                                      py_context, py_context);
-    PyObject* py_temp = PyObject_GetAttrString(py_main, "temp");
+    PyObject* py_temp = PyObject_GetAttrString(py_main, result_var.c_str());
 
     response = PyString_AsString(PyObject_Str(py_temp));
 
@@ -235,15 +387,27 @@ public:
 
       py_resp = PyRun_String(command.c_str(), Py_single_input,
                              py_context, py_context);
-      py_temp = PyObject_GetAttrString(py_main, "temp");
+      py_temp = PyObject_GetAttrString(py_main, result_var.c_str());
 
       temp = PyString_AsString(PyObject_Str(py_temp));
 
     } while (!temp.empty());
 
+    if (traffic)
+      record(DIR_IN, response);
+
     return response;
   }
 
+  /* @brief Function to read from buffer of device
+   *
+   * @return String containing raw device buffer contents
+   */
+  std::string read()
+  {
+    return read_view();
+  }
+
   /* @brief Convenience function to write a command and read the result without
    *        attempting to decode
    *
@@ -275,13 +439,130 @@ public:
    * @param cmd Command to send to device
    * @return String containing device buffer contents
    */
-  std::string query(std::string command)
+  std::string query(const std::string& command)
   {
     write(command);
 
     return read();
   }
 
+  /* @brief Convenience function to write a command and read the result into
+   *        the port's receive buffer, see @read_view
+   *
+   * @param cmd Command to send to device
+   * @return The device response, valid until the next read from this port
+   */
+  const std::string& query_view(const char* command)
+  {
+    write(command);
+
+    return read_view();
+  }
+
+  /* @brief Function to write a command to the device
+   *
+   * @param cmd Command to send to device
+   * @return Nothing, or errc::disconnected if PyVISA raised an exception
+   */
+  expected<void> try_write(const char* cmd)
+  {
+    CYRIAL_TRACE_SPAN("write", idx);
+    char prefix[48];
+    std::snprintf(prefix, sizeof(prefix), "c_dev[%ld].write('", (long)idx);
+
+    py_lock lock;
+
+    statement.assign(prefix).append(cmd).append("')");
+
+    if (PyRun_SimpleString(statement.c_str()) != 0)
+      return error(errc::disconnected, "write raised an exception");
+
+    if (traffic)
+      record(DIR_OUT, std::string(cmd) + "\r\n");
+
+    return expected<void>();
+  }
+
+  /* @brief Function to write raw data to the device, see @write_raw
+   *
+   * @param data Data to send to device
+   * @return Nothing, or errc::disconnected if PyVISA raised an exception
+   */
+  expected<void> try_write_raw(const std::string& data)
+  {
+    CYRIAL_TRACE_SPAN("write", idx);
+    std::string command = "c_dev[" + std::to_string(idx) + "].write_raw('"
+      + data + "')";
+
+    {
+      py_lock lock;
+
+      if (PyRun_SimpleString(command.c_str()) != 0)
+        return error(errc::disconnected, "write raised an exception");
+    }
+
+    if (traffic)
+      record(DIR_OUT, unescape(data));
+
+    return expected<void>();
+  }
+
+  /* @brief Function to write raw data and read the hex result, see
+   *        @query_hex
+   *
+   * @param command Data to send to device
+   * @return The hex response, or errc::timeout if there was none
+   */
+  expected<std::string> try_query_hex(const std::string& command)
+  {
+    expected<void> written = try_write_raw(command);
+
+    if (!written)
+      return written.error();
+
+    std::string hex = read_hex();
+
+    if (hex.empty())
+      return error(errc::timeout);
+
+    return hex;
+  }
+
+  /* @brief Function to write a command and read the result into the port's
+   *        receive buffer, see @read_view
+   *
+   * @param cmd Command to send to device
+   * @return The device response, valid until the next read from this port,
+   *         or errc::timeout if there was none
+   */
+  expected<const std::string*> try_query_view(const char* command)
+  {
+    expected<void> written = try_write(command);
+
+    if (!written)
+      return written.error();
+
+    const std::string& response = read_view();
+
+    if (response.find_first_not_of("\n") == std::string::npos)
+      return error(errc::timeout);
+
+    return &response;
+  }
+
+  /* @brief Function to write a command and read the result, see
+   *        @try_query_view
+   */
+  expected<std::string> try_query(const std::string& command)
+  {
+    expected<const std::string*> response = try_query_view(command.c_str());
+
+    if (!response)
+      return response.error();
+
+    return **response;
+  }
+
   /* @brief Function to eat lines off the buffer of the device, useful when
    *        issuing commands which will be echoed but do not produce a response
    *
@@ -291,14 +572,40 @@ public:
    */
   void eat(size_t lines=2)
   {
-    std::string command = "temp = c_dev[" + std::to_string(idx) + "].read()";
+    CYRIAL_TRACE_SPAN("eat", idx);
+    std::string command = result_var + " = c_dev[" + std::to_string(idx)
+                                                                   + "].read()";
+
+    py_lock lock;
 
     for (size_t i = 0; i < lines; ++i)
+    {
       PyRun_SimpleString(command.c_str());
+
+      if (traffic)
+      {
+        PyObject* py_temp = PyObject_GetAttrString(py_main,
+                                                   result_var.c_str());
+        PyObject* py_str = PyObject_Str(py_temp);
+
+        record(DIR_IN, PyString_AsString(py_str));
+
+        Py_XDECREF(py_str);
+        Py_XDECREF(py_temp);
+      }
+    }
   }
 
 };
 
+#endif // CYRIAL_NO_PYTHON
+
 } // namespace cyrial
 
+// Defining CYRIAL_NO_PYTHON replaces the PyVISA implementation with one that
+// drives serial ports directly
+#ifdef CYRIAL_NO_PYTHON
+#include "native_interface.hpp"
+#endif
+
 #endif // CYRIAL_INTERFACE_HPP
@@ -0,0 +1,153 @@
+#ifndef CYRIAL_JOURNAL_HPP
+#define CYRIAL_JOURNAL_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace cyrial
+{
+
+/* @brief Direction of traffic relative to the host
+ */
+enum direction : uint8_t { DIR_IN, DIR_OUT };
+
+/* @struct journal_record
+ *
+ * @brief A single chunk of data written to or read from a port
+ */
+struct journal_record
+{
+  uint64_t time;       // ns since the Unix epoch
+  uint32_t port;       // Index of the port in the manager
+  direction dir;
+  std::string data;
+};
+
+/* @class journal_sink
+ *
+ * @brief Interface for consumers which want to observe traffic as it happens
+ */
+class journal_sink
+{
+public:
+  virtual ~journal_sink() { }
+
+  /* @brief Function called for each chunk of traffic
+   *
+   * Called with the journal's lock held, so implementations must not call
+   * back into the journal
+   *
+   * @param rec The traffic
+   * @param port_name Location of the port (e.g. its resource name)
+   */
+  virtual void record(const journal_record& rec,
+      const std::string& port_name) = 0;
+};
+
+/* @class journal
+ *
+ * @brief Class to record the traffic of one or more ports
+ *
+ * The most recent traffic is retained in memory, up to a configurable number
+ * of bytes, and every chunk is forwarded to the attached sinks
+ */
+class journal
+{
+  mutable std::mutex lock;
+
+  std::deque<journal_record> records;
+  size_t retained_bytes;
+  size_t capacity;
+
+  std::vector<std::string> port_names;
+  std::vector<std::shared_ptr<journal_sink>> sinks;
+
+public:
+  /* @brief Constructor for journal
+   *
+   * @param bytes Maximum number of payload bytes to retain in memory, 0 to
+   *        only forward traffic to sinks
+   */
+  journal(size_t bytes=16 << 20)
+    : retained_bytes(0), capacity(bytes)
+  { }
+
+  /* @brief Function to attach a sink which will observe all future traffic
+   */
+  void attach(std::shared_ptr<journal_sink> sink)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    sinks.push_back(sink);
+  }
+
+  /* @brief Function to record traffic
+   *
+   * @param port Index of the port
+   * @param port_name Location of the port
+   * @param dir Direction of the traffic
+   * @param data The bytes transferred
+   */
+  void record(uint32_t port, const std::string& port_name, direction dir,
+      const std::string& data)
+  {
+    if (data.empty())
+      return;
+
+    journal_record rec{
+      (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count(),
+      port, dir, data };
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (port >= port_names.size())
+      port_names.resize(port + 1);
+
+    port_names[port] = port_name;
+
+    for (const auto& sink : sinks)
+      sink->record(rec, port_name);
+
+    if (capacity == 0)
+      return;
+
+    retained_bytes += data.size();
+    records.push_back(std::move(rec));
+
+    while (retained_bytes > capacity)
+    {
+      retained_bytes -= records.front().data.size();
+      records.pop_front();
+    }
+  }
+
+  /* @brief Function to replay the retained traffic into a sink
+   */
+  void replay(journal_sink& sink) const
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (const auto& rec : records)
+      sink.record(rec, port_names[rec.port]);
+  }
+
+  /* @brief Function to discard the retained traffic
+   */
+  void clear()
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    records.clear();
+    retained_bytes = 0;
+  }
+};
+
+} // namespace cyrial
+
+#endif // CYRIAL_JOURNAL_HPP
@@ -0,0 +1,589 @@
+#ifndef CYRIAL_LOG_HPP
+#define CYRIAL_LOG_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cyrial
+{
+
+/* @brief Severity of a log record
+ */
+enum log_level : uint8_t { LOG_TRACE, LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR,
+                           LOG_OFF };
+
+/* @brief Subsystem which produced a log record, each with its own level
+ */
+enum log_module : uint8_t { LOG_INTERFACE, LOG_SCPI, LOG_NMEA, LOG_UBX,
+                            LOG_CSAC, LOG_TELEMETRY, LOG_CALIBRATION,
+                            LOG_FLEET, log_module_count };
+
+inline const char* log_level_name(log_level level)
+{
+  static const char* names[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERROR",
+                                 "OFF" };
+
+  return level <= LOG_OFF ? names[level] : "?";
+}
+
+inline const char* log_module_name(log_module module)
+{
+  static const char* names[] = { "interface", "scpi", "nmea", "ubx", "csac",
+                                 "telemetry", "calibration", "fleet" };
+
+  return module < log_module_count ? names[module] : "?";
+}
+
+/* @struct log_record
+ *
+ * @brief A log record as captured by the producing thread: the address of its
+ *        format string, which identifies it, and its arguments in binary
+ *
+ * String arguments are copied into text, and truncated once it is full
+ */
+struct log_record
+{
+  enum arg_type : uint8_t { ARG_INT, ARG_UINT, ARG_REAL, ARG_TEXT };
+
+  static const size_t max_args = 6;
+  static const size_t text_size = 128;
+
+  uint64_t time;              // ns since the Unix epoch
+  const char* format;         // Static storage, "{}" marks each argument
+  log_module module;
+  log_level level;
+  uint8_t count;
+
+  arg_type type[max_args];
+  union
+  {
+    int64_t i;
+    uint64_t u;
+    double d;
+    struct { uint16_t offset, length; } text;
+  } arg[max_args];
+
+  uint16_t text_used;
+  char text[text_size];
+};
+
+/* @brief Functions to append an argument to a log record
+ */
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value
+                               && std::is_signed<T>::value>::type
+log_encode(log_record& r, T value)
+{
+  r.type[r.count] = log_record::ARG_INT;
+  r.arg[r.count++].i = value;
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value
+                               && !std::is_signed<T>::value>::type
+log_encode(log_record& r, T value)
+{
+  r.type[r.count] = log_record::ARG_UINT;
+  r.arg[r.count++].u = value;
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type
+log_encode(log_record& r, T value)
+{
+  r.type[r.count] = log_record::ARG_REAL;
+  r.arg[r.count++].d = value;
+}
+
+inline void log_encode(log_record& r, const char* value, size_t length)
+{
+  length = std::min(length, log_record::text_size - r.text_used);
+  std::memcpy(r.text + r.text_used, value, length);
+
+  r.type[r.count] = log_record::ARG_TEXT;
+  r.arg[r.count].text.offset = r.text_used;
+  r.arg[r.count++].text.length = length;
+  r.text_used += length;
+}
+
+inline void log_encode(log_record& r, const char* value)
+{
+  log_encode(r, value, std::strlen(value));
+}
+
+inline void log_encode(log_record& r, const std::string& value)
+{
+  log_encode(r, value.data(), value.size());
+}
+
+inline void log_encode_all(log_record&)
+{ }
+
+template <typename T, typename... Args>
+inline void log_encode_all(log_record& r, const T& value, const Args&... args)
+{
+  log_encode(r, value);
+  log_encode_all(r, args...);
+}
+
+/* @brief Function to format a log record as a line of text, substituting
+ *        each "{}" of its format string with the next argument
+ *
+ * @param r The record
+ * @param line Set to the line, without a terminator
+ */
+inline void format_log_record(const log_record& r, std::string& line)
+{
+  char prefix[64];
+  std::snprintf(prefix, sizeof(prefix), "%llu.%06llu %-5s %s: ",
+                (unsigned long long)(r.time / 1000000000),
+                (unsigned long long)(r.time % 1000000000 / 1000),
+                log_level_name(r.level), log_module_name(r.module));
+
+  line = prefix;
+
+  size_t next = 0;
+
+  for (const char* p = r.format; *p; ++p)
+  {
+    if (p[0] != '{' || p[1] != '}' || next >= r.count)
+    {
+      line += *p;
+      continue;
+    }
+
+    char value[32];
+
+    switch (r.type[next])
+    {
+      case log_record::ARG_INT:
+        std::snprintf(value, sizeof(value), "%lld", (long long)r.arg[next].i);
+        break;
+
+      case log_record::ARG_UINT:
+        std::snprintf(value, sizeof(value), "%llu",
+                      (unsigned long long)r.arg[next].u);
+        break;
+
+      case log_record::ARG_REAL:
+        std::snprintf(value, sizeof(value), "%g", r.arg[next].d);
+        break;
+
+      case log_record::ARG_TEXT:
+        value[0] = '\0';
+        line.append(r.text + r.arg[next].text.offset,
+                    r.arg[next].text.length);
+        break;
+    }
+
+    line += value;
+    ++next;
+    ++p;
+  }
+}
+
+/* @class log_sink
+ *
+ * @brief Interface for the destination of formatted log records
+ */
+class log_sink
+{
+public:
+  virtual ~log_sink() { }
+
+  /* @brief Function called, on the logger's thread, for each record
+   *
+   * @param r The record
+   * @param line The formatted record, without a terminator
+   */
+  virtual void write(const log_record& r, const std::string& line) = 0;
+
+  /* @brief Function called whenever the logger has drained its rings
+   */
+  virtual void flush() { }
+};
+
+/* @class stream_log_sink
+ *
+ * @brief Sink writing one line per record to a stream
+ */
+class stream_log_sink : public log_sink
+{
+  std::ostream& out;
+
+public:
+  stream_log_sink(std::ostream& stream)
+    : out(stream)
+  { }
+
+  void write(const log_record&, const std::string& line) override
+  {
+    out << line << '\n';
+  }
+
+  void flush() override
+  {
+    out.flush();
+  }
+};
+
+/* @class log_ring
+ *
+ * @brief Single producer, single consumer ring of log records
+ */
+class log_ring
+{
+  std::vector<log_record> slots;
+  size_t mask;
+
+  std::atomic<size_t> head;   // Next slot written by the producer
+  std::atomic<size_t> tail;   // Next slot read by the consumer
+
+public:
+  std::atomic<uint64_t> dropped;
+  std::atomic<bool> orphaned; // Producing thread has exited
+
+  /* @brief Constructor for log_ring
+   *
+   * @param capacity Number of records, rounded up to a power of two
+   */
+  log_ring(size_t capacity)
+    : head(0), tail(0), dropped(0), orphaned(false)
+  {
+    size_t size = 1;
+
+    while (size < capacity)
+      size <<= 1;
+
+    slots.resize(size);
+    mask = size - 1;
+  }
+
+  /* @brief Function to get the slot for the next record, or nullptr if the
+   *        ring is full. The record is published by @commit
+   */
+  log_record* claim()
+  {
+    size_t h = head.load(std::memory_order_relaxed);
+
+    if (h - tail.load(std::memory_order_acquire) > mask)
+      return nullptr;
+
+    return &slots[h & mask];
+  }
+
+  void commit()
+  {
+    head.store(head.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  }
+
+  /* @brief Function to get the oldest record, or nullptr if the ring is
+   *        empty. The slot is released by @release
+   */
+  const log_record* peek()
+  {
+    size_t t = tail.load(std::memory_order_relaxed);
+
+    if (t == head.load(std::memory_order_acquire))
+      return nullptr;
+
+    return &slots[t & mask];
+  }
+
+  void release()
+  {
+    tail.store(tail.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  }
+};
+
+/* @class logger
+ *
+ * @brief Class to log diagnostics without blocking the calling thread
+ *
+ * Each thread writes binary records into its own lock-free ring, and a
+ * background thread formats them and passes them to the sink. Arguments are
+ * only captured if the module's level admits the record; when a ring is full
+ * the record is dropped and counted rather than waiting. Use through
+ * @CYRIAL_LOG
+ */
+class logger
+{
+  std::array<std::atomic<uint8_t>, log_module_count> levels;
+
+  std::mutex rings_lock;
+  std::vector<std::shared_ptr<log_ring>> rings;
+  size_t ring_capacity;
+
+  std::mutex drain_lock;
+  std::shared_ptr<log_sink> sink;
+  uint64_t orphan_dropped;
+
+  std::once_flag started;
+  std::atomic<bool> running;
+  std::thread worker;
+  std::chrono::milliseconds interval;
+
+  uint64_t id;
+
+  // The rings of the calling thread, one per logger, which are released when
+  // the thread exits
+  struct ring_owner
+  {
+    std::vector<std::pair<uint64_t, std::shared_ptr<log_ring>>> rings;
+
+    ~ring_owner()
+    {
+      for (auto& r : rings)
+        r.second->orphaned = true;
+    }
+  };
+
+  static uint64_t next_id()
+  {
+    static std::atomic<uint64_t> count(0);
+
+    return ++count;
+  }
+
+  log_ring& local_ring()
+  {
+    static thread_local ring_owner owner;
+    log_ring* ring = nullptr;
+
+    for (auto& r : owner.rings)
+      if (r.first == id)
+        ring = r.second.get();
+
+    if (!ring)
+    {
+      auto created = std::make_shared<log_ring>(ring_capacity);
+      owner.rings.push_back(std::make_pair(id, created));
+      ring = created.get();
+
+      std::lock_guard<std::mutex> guard(rings_lock);
+      rings.push_back(created);
+    }
+
+    std::call_once(started, [this]() {
+      running = true;
+      worker = std::thread([this]() { run(); });
+    });
+
+    return *ring;
+  }
+
+  void run()
+  {
+    while (running)
+    {
+      std::this_thread::sleep_for(interval);
+      drain();
+    }
+
+    drain();
+  }
+
+public:
+  /* @brief Constructor for logger
+   *
+   * @param output Destination of formatted records, std::clog by default
+   * @param capacity Records held by each thread's ring
+   * @param period How often the background thread drains the rings
+   */
+  logger(std::shared_ptr<log_sink> output=nullptr, size_t capacity=1024,
+      std::chrono::milliseconds period=std::chrono::milliseconds(20))
+    : ring_capacity(capacity),
+      sink(output ? output : std::make_shared<stream_log_sink>(std::clog)),
+      orphan_dropped(0), running(false), interval(period), id(next_id())
+  {
+    for (auto& level : levels)
+      level = LOG_WARN;
+  }
+
+  logger(const logger&) = delete;
+  logger& operator=(const logger&) = delete;
+
+  ~logger()
+  {
+    running = false;
+
+    if (worker.joinable())
+      worker.join();
+  }
+
+  /* @brief Function to get the process-wide logger used by @CYRIAL_LOG
+   */
+  static logger& instance()
+  {
+    static logger global;
+
+    return global;
+  }
+
+  /* @brief Function to set the minimum level recorded for a module
+   */
+  void set_level(log_module module, log_level level)
+  {
+    levels[module].store(level, std::memory_order_relaxed);
+  }
+
+  /* @brief Function to set the minimum level recorded for every module
+   */
+  void set_level(log_level level)
+  {
+    for (auto& l : levels)
+      l.store(level, std::memory_order_relaxed);
+  }
+
+  log_level get_level(log_module module) const
+  {
+    return (log_level)levels[module].load(std::memory_order_relaxed);
+  }
+
+  bool enabled(log_module module, log_level level) const
+  {
+    return level >= levels[module].load(std::memory_order_relaxed)
+           && level != LOG_OFF;
+  }
+
+  /* @brief Function to replace the sink. Records already queued may be
+   *        written to either sink
+   */
+  void set_sink(std::shared_ptr<log_sink> output)
+  {
+    std::lock_guard<std::mutex> guard(drain_lock);
+
+    sink = output;
+  }
+
+  /* @brief Function to queue a record from the calling thread
+   *
+   * @param module The module producing the record
+   * @param level The severity of the record
+   * @param format A string literal, in which each "{}" is replaced by the
+   *        next argument. Its address identifies the record, so it must not
+   *        be a temporary
+   * @param args Up to log_record::max_args integers, reals, or strings
+   * @return Whether the record was queued, false if the ring was full
+   */
+  template <typename... Args>
+  bool write(log_module module, log_level level, const char* format,
+      const Args&... args)
+  {
+    static_assert(sizeof...(Args) <= log_record::max_args,
+                  "too many log arguments");
+
+    log_ring& ring = local_ring();
+    log_record* r = ring.claim();
+
+    if (!r)
+    {
+      ring.dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    r->time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+    r->format = format;
+    r->module = module;
+    r->level = level;
+    r->count = 0;
+    r->text_used = 0;
+
+    log_encode_all(*r, args...);
+    ring.commit();
+
+    return true;
+  }
+
+  /* @brief Function to format and write every queued record
+   *
+   * Called periodically by the background thread, and may be called by any
+   * thread to make sure earlier records have been written
+   */
+  void drain()
+  {
+    std::lock_guard<std::mutex> guard(drain_lock);
+    std::vector<std::shared_ptr<log_ring>> current;
+
+    {
+      std::lock_guard<std::mutex> ring_guard(rings_lock);
+      current = rings;
+    }
+
+    std::string line;
+    bool any = false;
+
+    for (const auto& ring : current)
+      while (const log_record* r = ring->peek())
+      {
+        format_log_record(*r, line);
+
+        if (sink)
+          sink->write(*r, line);
+
+        ring->release();
+        any = true;
+      }
+
+    if (any && sink)
+      sink->flush();
+
+    // Rings of exited threads are dropped once empty
+    std::lock_guard<std::mutex> ring_guard(rings_lock);
+
+    for (size_t i = 0; i < rings.size(); )
+      if (rings[i]->orphaned && !rings[i]->peek())
+      {
+        orphan_dropped += rings[i]->dropped;
+        rings.erase(rings.begin() + i);
+      }
+      else
+        ++i;
+  }
+
+  /* @brief Function to count the records dropped because a ring was full
+   */
+  uint64_t dropped()
+  {
+    std::lock_guard<std::mutex> guard(rings_lock);
+    uint64_t total = orphan_dropped;
+
+    for (const auto& ring : rings)
+      total += ring->dropped;
+
+    return total;
+  }
+};
+
+} // namespace cyrial
+
+/* @brief Macro to log a record through @logger::instance, e.g.
+ *
+ *   CYRIAL_LOG(cyrial::LOG_UBX, cyrial::LOG_DEBUG, "tx {} bytes", n);
+ *
+ * Arguments are not evaluated unless the module's level admits the record
+ */
+#define CYRIAL_LOG(module, level, ...)                                        \
+  do                                                                          \
+  {                                                                           \
+    if (::cyrial::logger::instance().enabled(module, level))                  \
+      ::cyrial::logger::instance().write(module, level, __VA_ARGS__);         \
+  } while (0)
+
+#endif // CYRIAL_LOG_HPP
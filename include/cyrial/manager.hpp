@@ -5,14 +5,56 @@
 #include <string>
 #include <memory>
 #include <stdexcept>
+#include <utility>
 
+#include <climits>
+#include <cstdlib>
+
+#include <dirent.h>
+
+#ifndef CYRIAL_NO_PYTHON
 #include <Python.h>
+#endif
 
 #include "interface.hpp"
+#include "registry.hpp"
 
 namespace cyrial
 {
 
+/* @brief Function to list the serial ports under /dev/serial/by-id, whose
+ *        names follow the adapter rather than the order of enumeration
+ *
+ * @return Pairs of by-id path and the device node it currently refers to
+ */
+inline std::vector<std::pair<std::string, std::string>> serial_ports_by_id()
+{
+  const std::string dir = "/dev/serial/by-id/";
+  std::vector<std::pair<std::string, std::string>> result;
+  DIR* d = opendir(dir.c_str());
+
+  if (d == NULL)
+    return result;
+
+  while (dirent* entry = readdir(d))
+  {
+    if (entry->d_name[0] == '.')
+      continue;
+
+    char node[PATH_MAX];
+    std::string path = dir + entry->d_name;
+
+    if (realpath(path.c_str(), node) != NULL)
+      result.push_back(std::make_pair(path, std::string(node)));
+  }
+
+  closedir(d);
+
+  return result;
+}
+
+#ifndef CYRIAL_NO_PYTHON
+
 /* @class manager
  * @brief Class to represent a communication interface
  *
@@ -20,10 +62,17 @@ namespace cyrial
  * being able to successfully call resource methods otherwise. If possible it
  * would be more consistent to have everything exist as a PyObject and to use
  * the PyObject_* interfaces for all operations.
+ *
+ * When the manager owns the interpreter it releases the global interpreter
+ * lock once constructed, so that its interfaces may be used from any thread
+ * (see py_lock). An application which provides its own interpreter remains
+ * responsible for releasing the lock before using interfaces from other
+ * threads
  */
 class manager
 {
   bool finalize;
+  PyThreadState* py_thread_state;
 
   PyObject* py_main;
   PyObject* py_context;
@@ -32,23 +81,11 @@ class manager
   PyObject* py_device_list;
 
   std::vector<std::shared_ptr<interface>> ports;
+  std::vector<handle> port_handles;
+  registry<interface> port_registry;
 
-public:
-  manager()
+  void init()
   {
-    Py_Initialize();
-    finalize = true;
-
-    py_main = PyImport_AddModule("__main__");
-
-    if (py_main == NULL)
-      throw std::runtime_error("Python failed to get main module");
-
-    py_context = PyModule_GetDict(py_main);
-
-    if (py_context == NULL)
-      throw std::runtime_error("Python failed to get context");
-
     PyObject* py_sys_module    = PyImport_ImportModule("sys"   );
     PyObject* py_serial_module = PyImport_ImportModule("serial");
     PyObject* py_visa_module   = PyImport_ImportModule("visa"  );
@@ -77,32 +114,62 @@ public:
 
     PyRun_SimpleString("c_rm = visa.ResourceManager('@py')");
     py_resource_manager = PyObject_GetAttrString(py_main, "c_rm");
+  }
 
-    PyObject* py_rm_list_res = PyObject_GetAttrString(py_resource_manager,
-                                                      "list_resources");
-
-    PyObject* py_available_list = PyObject_CallFunction(py_rm_list_res, NULL);
-    Py_ssize_t py_available_devices = PyTuple_Size(py_available_list);
+  void open_all()
+  {
+    std::vector<std::string> available = list_resources();
 
-    if (py_available_devices == 0)
+    if (available.empty())
       throw std::runtime_error("No connected devices found");
 
-    for (Py_ssize_t i = 0; i < py_available_devices; ++i)
-    {
-      std::string command =
-        "c_dev.append(c_rm.open_resource(c_rm.list_resources()["
-          + std::to_string(i) + "]))";
-      PyRun_SimpleString(command.c_str());
+    for (const auto& resource : available)
+      open(resource);
+  }
 
-      PyObject* py_device = PyList_GetItem(py_device_list, i);
+public:
+  /* @brief Constructor for manager which owns the Python interpreter
+   *
+   * @param connect Whether to open every available resource; if false,
+   *        resources are opened selectively with @open
+   */
+  manager(bool connect=true)
+  {
+    Py_Initialize();
 
-      ports.push_back(std::make_shared<interface>(i, py_device, py_context,
-                                                                      py_main));
-    }
+    // Py_Initialize creates the GIL itself from Python 3.7
+#if PY_VERSION_HEX < 0x03070000
+    PyEval_InitThreads();
+#endif
+    finalize = true;
+
+    py_main = PyImport_AddModule("__main__");
+
+    if (py_main == NULL)
+      throw std::runtime_error("Python failed to get main module");
+
+    py_context = PyModule_GetDict(py_main);
+
+    if (py_context == NULL)
+      throw std::runtime_error("Python failed to get context");
+
+    init();
+
+    if (connect)
+      open_all();
+
+    py_thread_state = PyEval_SaveThread();
   }
 
-  manager(PyObject* py_mn, PyObject* py_cxt=NULL)
-    : py_main(py_mn), py_context(py_cxt)
+  /* @brief Constructor for manager using an existing Python interpreter
+   *
+   * @param py_mn PyObject pointer to the main module
+   * @param py_cxt PyObject pointer to the context, by default that of the
+   *        main module
+   * @param connect Whether to open every available resource
+   */
+  manager(PyObject* py_mn, PyObject* py_cxt=NULL, bool connect=true)
+    : py_thread_state(NULL), py_main(py_mn), py_context(py_cxt)
   {
     finalize = false;
 
@@ -112,59 +179,108 @@ public:
     if (py_context == NULL)
       throw std::runtime_error("Python failed to get context");
 
-    PyObject* py_sys_module    = PyImport_ImportModule("sys"   );
-    PyObject* py_serial_module = PyImport_ImportModule("serial");
-    PyObject* py_visa_module   = PyImport_ImportModule("visa"  );
+    init();
 
-    if (py_sys_module == NULL || py_serial_module == NULL
-        || py_visa_module == NULL)
-      throw std::runtime_error("Python failed to load required module");
+    if (connect)
+      open_all();
+  }
 
-    PyModule_AddObject(py_main, "sys"   , py_sys_module   );
-    PyModule_AddObject(py_main, "serial", py_serial_module);
-    PyModule_AddObject(py_main, "visa"  , py_visa_module  );
+  /* @brief Function to list the resources which could be opened
+   *
+   * Note that PyVISA probes every serial port to build this list, which may
+   * take some time
+   *
+   * @return The resource names, e.g. "ASRL/dev/ttyUSB0::INSTR"
+   */
+  std::vector<std::string> list_resources()
+  {
+    py_lock lock;
+    std::vector<std::string> result;
 
-    PyObject* py_system_path = PySys_GetObject((char*)"path");
-    PyObject* py_here = PyUnicode_FromString(".");
-    PyList_Append(py_system_path, py_here);
-    Py_DECREF(py_here);
+    PyObject* py_rm_list_res = PyObject_GetAttrString(py_resource_manager,
+                                                      "list_resources");
+    PyObject* py_available_list = PyObject_CallFunction(py_rm_list_res, NULL);
 
-    if (PyObject_HasAttrString(py_main, "c_dev"))
-      throw std::runtime_error("Python var 'c_dev' clobbered");
+    if (py_available_list == NULL)
+      throw std::runtime_error("Python failed to list resources");
 
-    PyRun_SimpleString("c_dev = []");
-    py_device_list = PyObject_GetAttrString(py_main, "c_dev");
+    for (Py_ssize_t i = 0; i < PyTuple_Size(py_available_list); ++i)
+      result.push_back(PyString_AsString(
+                         PyTuple_GetItem(py_available_list, i)));
 
-    if (PyObject_HasAttrString(py_main, "c_rm"))
-      throw std::runtime_error("Python var 'c_rm' clobbered");
+    Py_DECREF(py_available_list);
+    Py_DECREF(py_rm_list_res);
 
-    PyRun_SimpleString("c_rm = visa.ResourceManager('@py')");
-    py_resource_manager = PyObject_GetAttrString(py_main, "c_rm");
+    return result;
+  }
 
-    PyObject* py_rm_list_res = PyObject_GetAttrString(py_resource_manager,
-                                                      "list_resources");
+  /* @brief Function to open a resource and add it to the connected devices
+   *
+   * @param resource The resource name, e.g. "ASRL/dev/ttyUSB0::INSTR"
+   * @return shared_ptr Pointer to the opened port, or errc::disconnected if
+   *         it could not be opened or the registry of ports is full
+   */
+  expected<std::shared_ptr<interface>> try_open(const std::string& resource)
+  {
+    py_lock lock;
 
-    // TODO: Connecting to devices should be pulled out into a seperate fucntion
-    // so that it can be performed selectively
+    // The name is passed as an argument rather than pasted into Python
+    // source, so that quotes in it cannot break or alter the statement
+    PyObject* py_resource = PyObject_CallMethod(py_resource_manager,
+                                                (char*)"open_resource",
+                                                (char*)"s", resource.c_str());
 
-    PyObject* py_available_list = PyObject_CallFunction(py_rm_list_res, NULL);
-    Py_ssize_t py_available_devices = PyTuple_Size(py_available_list);
+    if (py_resource == NULL)
+    {
+      PyErr_Clear();
+      return error(errc::disconnected, "resource could not be opened");
+    }
 
-    if (py_available_devices == 0)
-      throw std::runtime_error("No connected devices found");
+    int appended = PyList_Append(py_device_list, py_resource);
+    Py_DECREF(py_resource);
 
-    for (Py_ssize_t i = 0; i < py_available_devices; ++i)
+    if (appended != 0)
     {
-      std::string command =
-        "c_dev.append(c_rm.open_resource(c_rm.list_resources()["
-          + std::to_string(i) + "]))";
-      PyRun_SimpleString(command.c_str());
+      PyErr_Clear();
+      return error(errc::disconnected, "resource could not be recorded");
+    }
+
+    Py_ssize_t i = PyList_Size(py_device_list) - 1;
+    PyObject* py_device = PyList_GetItem(py_device_list, i);
 
-      PyObject* py_device = PyList_GetItem(py_device_list, i);
+    std::shared_ptr<interface> port = std::make_shared<interface>(i,
+                                                py_device, py_context, py_main);
+    handle h = port_registry.insert(port);
+
+    if (!h.valid())
+    {
+      PyObject* py_closed = PyObject_CallMethod(py_device, (char*)"close",
+                                                NULL);
+      Py_XDECREF(py_closed);
+      PySequence_DelItem(py_device_list, i);
+      PyErr_Clear();
 
-      ports.push_back(std::make_shared<interface>(i, py_device, py_context,
-                                                                      py_main));
+      return error(errc::disconnected, "registry of ports is full");
     }
+
+    ports.push_back(port);
+    port_handles.push_back(h);
+
+    return port;
+  }
+
+  /* @brief Function to open a resource, see @try_open
+   *
+   * @throw std::runtime_error If the resource could not be opened
+   */
+  std::shared_ptr<interface> open(const std::string& resource)
+  {
+    expected<std::shared_ptr<interface>> port = try_open(resource);
+
+    if (!port)
+      throw std::runtime_error("Failed to open " + resource);
+
+    return *port;
   }
 
   /* @brief Function to return the total number of connected devices
@@ -178,20 +294,70 @@ public:
 
   /* @brief Function to return a shared_ptr to a connected ports
    *
-   * @return shared_ptr Pointer to a connected port
+   * @return shared_ptr Pointer to a connected port, or nullptr if it has been
+   *         closed (see @close)
    */
   std::shared_ptr<interface> dev(size_t number)
   {
     return ports[number];
   }
 
+  /* @brief Function to return the stable handle of a connected port
+   *
+   * @return handle The port's handle, which fails lookup once it is closed
+   */
+  handle dev_handle(size_t number)
+  {
+    return port_handles[number];
+  }
+
+  /* @brief Function to return the registry of open ports, for lookups by
+   *        handle which avoid reference counting, e.g.
+   *
+   *   registry<interface>::reader guard(m.ports_registry());
+   *   if (interface* port = m.ports_registry().find(h)) ...
+   */
+  registry<interface>& ports_registry()
+  {
+    return port_registry;
+  }
+
+  /* @brief Function to close a port, e.g. once it has been unplugged. Its
+   *        index remains allocated and @dev returns nullptr for it; the port
+   *        is destroyed once no reader of the registry still holds it.
+   *        Unlike lookups through the registry, it must not race @dev
+   *
+   * @param h The port's handle
+   * @return Whether the handle referred to an open port
+   */
+  bool close(handle h)
+  {
+    for (size_t i = 0; i < port_handles.size(); ++i)
+      if (port_handles[i] == h && port_registry.erase(h))
+      {
+        ports[i].reset();
+        return true;
+      }
+
+    return false;
+  }
+
   ~manager()
   {
     if (finalize)
+    {
+      PyEval_RestoreThread(py_thread_state);
       Py_Finalize();
+    }
   }
 };
 
+#endif // CYRIAL_NO_PYTHON
+
 } // namespace cyrial
 
+#ifdef CYRIAL_NO_PYTHON
+#include "native_manager.hpp"
+#endif
+
 #endif // CYRIAL_MANAGER_HPP
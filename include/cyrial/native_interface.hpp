@@ -0,0 +1,693 @@
+#ifndef CYRIAL_NATIVE_INTERFACE_HPP
+#define CYRIAL_NATIVE_INTERFACE_HPP
+
+// Included by interface.hpp when CYRIAL_NO_PYTHON is defined
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "expected.hpp"
+#include "interface.hpp"
+#include "trace.hpp"
+
+namespace cyrial
+{
+
+/* @brief Function to escape raw bytes the way Python's repr does for a byte
+ *        string, without the surrounding quotes
+ *
+ * This is the inverse of @unescape, and reproduces the format returned by
+ * @interface::read_raw when PyVISA is used
+ *
+ * @param raw The raw bytes
+ * @return The escaped string
+ */
+inline std::string repr_escape(const std::string& raw)
+{
+  static const char digits[] = "0123456789abcdef";
+  std::string escaped;
+  escaped.reserve(raw.size());
+
+  for (unsigned char c : raw)
+    switch (c)
+    {
+      case '\\': escaped += "\\\\"; break;
+      case '\'': escaped += "\\'";  break;
+      case '\n': escaped += "\\n";  break;
+      case '\r': escaped += "\\r";  break;
+      case '\t': escaped += "\\t";  break;
+      default:
+        if (c >= 0x20 && c < 0x7f)
+          escaped += (char)c;
+        else
+        {
+          escaped += "\\x";
+          escaped += digits[c >> 4];
+          escaped += digits[c & 0xf];
+        }
+    }
+
+  return escaped;
+}
+
+/* @brief Function to map a baud rate onto its termios speed
+ *
+ * @param baud The baud rate
+ * @return The speed, or B0 if the rate is not supported on this platform
+ */
+inline speed_t termios_speed(size_t baud)
+{
+  switch (baud)
+  {
+    case 50:      return B50;
+    case 75:      return B75;
+    case 110:     return B110;
+    case 134:     return B134;
+    case 150:     return B150;
+    case 200:     return B200;
+    case 300:     return B300;
+    case 600:     return B600;
+    case 1200:    return B1200;
+    case 1800:    return B1800;
+    case 2400:    return B2400;
+    case 4800:    return B4800;
+    case 9600:    return B9600;
+    case 19200:   return B19200;
+    case 38400:   return B38400;
+    case 57600:   return B57600;
+    case 115200:  return B115200;
+    case 230400:  return B230400;
+#ifdef B460800
+    case 460800:  return B460800;
+    case 500000:  return B500000;
+    case 576000:  return B576000;
+    case 921600:  return B921600;
+    case 1000000: return B1000000;
+    case 1152000: return B1152000;
+    case 1500000: return B1500000;
+    case 2000000: return B2000000;
+    case 2500000: return B2500000;
+    case 3000000: return B3000000;
+    case 3500000: return B3500000;
+    case 4000000: return B4000000;
+#endif
+    default:      return B0;
+  }
+}
+
+/* @class interface
+ *
+ * @brief Class to represent a interface which supports serial
+ *        communication
+ *
+ * Native implementation used when CYRIAL_NO_PYTHON is defined. The port is
+ * driven directly through termios (8N1, raw, no flow control) and provides
+ * the same API and response formats as the PyVISA implementation: commands
+ * are terminated with "\r\n", @write_raw takes Python-escaped data,
+ * @read_raw returns it, and @read returns the lines received before the
+ * timeout, stripped of their terminators
+ */
+class interface
+{
+  size_t idx;
+  size_t timeout;
+  size_t baud_rate;
+
+  std::string location;
+  std::string name;
+
+  int fd;
+
+  // Bytes received beyond the end of the last line read
+  std::string pending;
+
+  // Reused for every command and response so that, once grown to the
+  // longest seen, polling does not allocate
+  std::string tx;
+  std::string rx;
+  std::string line;
+
+  // Set when a read finds the port closed or failing
+  bool hung_up;
+
+  std::shared_ptr<journal> traffic;
+
+  void record(direction dir, const std::string& data)
+  {
+    if (traffic)
+      traffic->record(idx, location, dir, data);
+  }
+
+  void configure()
+  {
+    termios tty;
+
+    if (tcgetattr(fd, &tty) != 0)
+      throw std::runtime_error("Failed to get attributes of " + location);
+
+    cfmakeraw(&tty);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+
+    cfsetispeed(&tty, termios_speed(baud_rate));
+    cfsetospeed(&tty, termios_speed(baud_rate));
+
+    if (tcsetattr(fd, TCSANOW, &tty) != 0)
+      throw std::runtime_error("Failed to configure " + location);
+  }
+
+  // Writes all of data, or sets reason to why that was not possible
+  bool transmit(const std::string& data, errc& reason)
+  {
+    size_t done = 0;
+
+    while (done < data.size())
+    {
+      ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+
+      if (n > 0)
+      {
+        done += n;
+        continue;
+      }
+
+      if (n < 0 && errno != EINTR && errno != EAGAIN)
+      {
+        reason = errc::disconnected;
+        return false;
+      }
+
+      pollfd p{ fd, POLLOUT, 0 };
+
+      if (poll(&p, 1, timeout) == 0)
+      {
+        reason = errc::timeout;
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  void send(const std::string& data)
+  {
+    errc reason;
+
+    if (!transmit(data, reason))
+      throw std::runtime_error("Failed to write to " + location + ": "
+                               + errc_name(reason));
+  }
+
+  // Appends whatever arrives within the timeout to pending, returning false
+  // if nothing did
+  bool receive()
+  {
+    pollfd p{ fd, POLLIN, 0 };
+    int ready = poll(&p, 1, timeout);
+
+    if (ready <= 0)
+      return false;
+
+    char buffer[4096];
+    ssize_t n = ::read(fd, buffer, sizeof(buffer));
+
+    // Readable without data, or a read error, means the device has gone
+    if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN))
+      hung_up = true;
+
+    if (n <= 0)
+      return false;
+
+    if (pending.empty())
+      CYRIAL_TRACE_INSTANT("first_byte", idx);
+
+    pending.append(buffer, n);
+
+    return true;
+  }
+
+  // Moves one line from pending into line, waiting for it up to the timeout
+  bool next_line()
+  {
+    size_t end;
+
+    while ((end = pending.find('\n')) == std::string::npos)
+      if (!receive())
+      {
+        if (pending.empty())
+          return false;
+
+        // A partial line at the timeout is returned as is
+        end = pending.size();
+        break;
+      }
+
+    line.assign(pending, 0, end);
+    pending.erase(0, end + 1);
+
+    return true;
+  }
+
+  std::string drain()
+  {
+    while (receive())
+      ;
+
+    std::string data;
+    data.swap(pending);
+
+    return data;
+  }
+
+  // Length of line without trailing whitespace
+  size_t stripped_length() const
+  {
+    size_t last = line.find_last_not_of(" \t\r\n");
+
+    return last == std::string::npos ? 0 : last + 1;
+  }
+
+public:
+  /* @brief Constructor for interface
+   *
+   * @param i The index of the device in the manager class' storage
+   * @param path Location of the serial port, e.g. /dev/ttyUSB0
+   */
+  interface(size_t i, const std::string& path)
+    : idx(i), timeout(200), baud_rate(9600), location(path), hung_up(false)
+  {
+    fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0)
+      throw std::runtime_error("Failed to open " + path + ": "
+                               + std::strerror(errno));
+
+    try
+    {
+      configure();
+    }
+    catch (...)
+    {
+      ::close(fd);
+      throw;
+    }
+
+    // Room for typical commands and responses, so that polling does not
+    // allocate even before the longest has been seen
+    tx.reserve(128);
+    rx.reserve(512);
+    line.reserve(256);
+    pending.reserve(4096);
+  }
+
+  interface(const interface&) = delete;
+  interface& operator=(const interface&) = delete;
+
+  ~interface()
+  {
+    ::close(fd);
+  }
+
+  /* @brief Function to return the index of the device in the manager class'
+   *        storage
+   *
+   * @return The index
+   */
+  size_t get_idx()
+  {
+    return idx;
+  }
+
+  /* @brief Function to get the location (device path) of the interface
+   *
+   * @return The location
+   */
+  const std::string& get_location()
+  {
+    return location;
+  }
+
+  /* @brief Function to get the file descriptor of the port, e.g. to wait on
+   *        it with other ports (see reactor)
+   *
+   * @return The file descriptor, open in non-blocking mode
+   */
+  int get_fd()
+  {
+    return fd;
+  }
+
+  /* @brief Function to record all future traffic of the interface
+   *
+   * @param j The journal to record to, or nullptr to stop recording
+   */
+  void set_journal(std::shared_ptr<journal> j)
+  {
+    traffic = j;
+  }
+
+  /* @brief Function to get device baud rate
+   *
+   * @return The current setting for baud rate
+   */
+  size_t get_baud_rate()
+  {
+    return baud_rate;
+  }
+
+  /* @brief Function to set device baud rate
+   *
+   * @param proposed The proposed new baud rate
+   * @return The devices baud rate after attempting to apply proposed change
+   */
+  size_t set_baud(size_t proposed)
+  {
+    if (proposed != baud_rate && termios_speed(proposed) != B0)
+    {
+      size_t previous = baud_rate;
+      baud_rate = proposed;
+
+      try
+      {
+        configure();
+      }
+      catch (const std::runtime_error&)
+      {
+        baud_rate = previous;
+      }
+    }
+
+    return baud_rate;
+  }
+
+  /* @brief Function to get device timeout
+   *
+   * @return The current setting for communication timeout in milliseconds
+   */
+  size_t get_timeout()
+  {
+    return timeout;
+  }
+
+  /* @brief Function to set device timeout
+   *
+   * @param t New communication timeout in milliseconds
+   */
+  void set_timeout(size_t t)
+  {
+    timeout = t;
+  }
+
+  /* @brief Function to write raw data to device
+   *
+   * @param data Data to send to device, with Python escape sequences
+   */
+  void write_raw(std::string data)
+  {
+    expected<void> result = try_write_raw(data);
+
+    if (!result)
+      throw std::runtime_error("Failed to write to " + location + ": "
+                               + result.error().message());
+  }
+
+  /* @brief Function to write commands to device
+   *
+   * @param cmd Command to send to device
+   */
+  void write(const char* cmd)
+  {
+    expected<void> result = try_write(cmd);
+
+    if (!result)
+      throw std::runtime_error("Failed to write to " + location + ": "
+                               + result.error().message());
+  }
+
+  void write(const std::string& cmd)
+  {
+    write(cmd.c_str());
+  }
+
+  /* @brief Function to read raw data from buffer of device
+   *
+   * @return String containing raw device buffer contents, escaped as by
+   *         Python's repr
+   */
+  std::string read_raw()
+  {
+    CYRIAL_TRACE_SPAN("read", idx);
+    std::string raw = drain();
+    record(DIR_IN, raw);
+
+    return repr_escape(raw);
+  }
+
+  /* @brief Function to read hex data from buffer of device
+   *
+   * @return String containing hex device buffer contents
+   */
+  std::string read_hex()
+  {
+    CYRIAL_TRACE_SPAN("read", idx);
+    static const char digits[] = "0123456789abcdef";
+    std::string raw = drain();
+    std::string hex;
+
+    record(DIR_IN, raw);
+
+    for (unsigned char c : raw)
+    {
+      hex += digits[c >> 4];
+      hex += digits[c & 0xf];
+    }
+
+    return hex;
+  }
+
+  /* @brief Function to read from buffer of device into the port's receive
+   *        buffer
+   *
+   * The returned reference is only valid until the next read from this port,
+   * and must not be used concurrently with one
+   *
+   * @return The lines received, separated by '\n'
+   */
+  const std::string& read_view()
+  {
+    CYRIAL_TRACE_SPAN("read", idx);
+    rx.clear();
+    hung_up = false;
+
+    while (next_line())
+    {
+      CYRIAL_TRACE_INSTANT("frame_complete", idx);
+
+      if (traffic)
+      {
+        line += '\n';
+        record(DIR_IN, line);
+      }
+
+      if (!rx.empty())
+        rx += '\n';
+
+      rx.append(line, 0, stripped_length());
+    }
+
+    return rx;
+  }
+
+  /* @brief Function to read from buffer of device
+   *
+   * @return String containing the lines received, separated by '\n'
+   */
+  std::string read()
+  {
+    return read_view();
+  }
+
+  /* @brief Convenience function to write a command and read the result without
+   *        attempting to decode
+   *
+   * @param cmd Command to send to device
+   * @return String containing raw device buffer contents
+   */
+  std::string query_raw(std::string command)
+  {
+    write_raw(command);
+
+    return read_raw();
+  }
+
+  /* @brief Convenience function to write a command and read the hex result
+   *        without attempting to decode
+   *
+   * @param cmd Command to send to device
+   * @return String containing hex device buffer contents
+   */
+  std::string query_hex(std::string command)
+  {
+    write_raw(command);
+
+    return read_hex();
+  }
+
+  /* @brief Convenience function to write a command and read the result
+   *
+   * @param cmd Command to send to device
+   * @return String containing device buffer contents
+   */
+  std::string query(const std::string& command)
+  {
+    write(command);
+
+    return read();
+  }
+
+  /* @brief Convenience function to write a command and read the result into
+   *        the port's receive buffer, see @read_view
+   *
+   * @param cmd Command to send to device
+   * @return The device response, valid until the next read from this port
+   */
+  const std::string& query_view(const char* command)
+  {
+    write(command);
+
+    return read_view();
+  }
+
+  /* @brief Function to write a command to the device
+   *
+   * @param cmd Command to send to device
+   * @return Nothing, or errc::disconnected if the port failed and
+   *         errc::timeout if it would not accept the data in time
+   */
+  expected<void> try_write(const char* cmd)
+  {
+    CYRIAL_TRACE_SPAN("write", idx);
+    errc reason;
+
+    tx.assign(cmd);
+    tx.append("\r\n", 2);
+
+    if (!transmit(tx, reason))
+      return error(reason, "write failed");
+
+    record(DIR_OUT, tx);
+
+    return expected<void>();
+  }
+
+  /* @brief Function to write raw data to the device, see @write_raw
+   *
+   * @param data Data to send to device, with Python escape sequences
+   * @return Nothing, or errc::disconnected if the port failed and
+   *         errc::timeout if it would not accept the data in time
+   */
+  expected<void> try_write_raw(const std::string& data)
+  {
+    CYRIAL_TRACE_SPAN("write", idx);
+    std::string raw = unescape(data);
+    errc reason;
+
+    if (!transmit(raw, reason))
+      return error(reason, "write failed");
+
+    record(DIR_OUT, raw);
+
+    return expected<void>();
+  }
+
+  /* @brief Function to write raw data and read the hex result, see
+   *        @query_hex
+   *
+   * @param command Data to send to device, with Python escape sequences
+   * @return The hex response, or errc::timeout if there was none and
+   *         errc::disconnected if the port failed
+   */
+  expected<std::string> try_query_hex(const std::string& command)
+  {
+    expected<void> written = try_write_raw(command);
+
+    if (!written)
+      return written.error();
+
+    hung_up = false;
+    std::string hex = read_hex();
+
+    if (hex.empty())
+      return error(hung_up ? errc::disconnected : errc::timeout);
+
+    return hex;
+  }
+
+  /* @brief Function to write a command and read the result into the port's
+   *        receive buffer, see @read_view
+   *
+   * @param cmd Command to send to device
+   * @return The device response, valid until the next read from this port,
+   *         or errc::timeout if there was none and errc::disconnected if the
+   *         port failed
+   */
+  expected<const std::string*> try_query_view(const char* command)
+  {
+    expected<void> written = try_write(command);
+
+    if (!written)
+      return written.error();
+
+    const std::string& response = read_view();
+
+    if (response.empty())
+      return error(hung_up ? errc::disconnected : errc::timeout);
+
+    return &response;
+  }
+
+  /* @brief Function to write a command and read the result, see
+   *        @try_query_view
+   */
+  expected<std::string> try_query(const std::string& command)
+  {
+    expected<const std::string*> response = try_query_view(command.c_str());
+
+    if (!response)
+      return response.error();
+
+    return **response;
+  }
+
+  /* @brief Function to eat lines off the buffer of the device, useful when
+   *        issuing commands which will be echoed but do not produce a response
+   *
+   * @param lines The number of lines to eat, defaults to 2
+   */
+  void eat(size_t lines=2)
+  {
+    CYRIAL_TRACE_SPAN("eat", idx);
+
+    for (size_t i = 0; i < lines && next_line(); ++i)
+      if (traffic)
+      {
+        line += '\n';
+        record(DIR_IN, line);
+      }
+  }
+};
+
+} // namespace cyrial
+
+#endif // CYRIAL_NATIVE_INTERFACE_HPP
@@ -0,0 +1,202 @@
+#ifndef CYRIAL_NATIVE_MANAGER_HPP
+#define CYRIAL_NATIVE_MANAGER_HPP
+
+// Included by manager.hpp when CYRIAL_NO_PYTHON is defined
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "manager.hpp"
+#include "reactor.hpp"
+#include "registry.hpp"
+
+namespace cyrial
+{
+
+/* @class manager
+ * @brief Class to represent a communication interface
+ *
+ * Native implementation used when CYRIAL_NO_PYTHON is defined. Serial ports
+ * are enumerated from /dev/serial/by-id and opened directly. Resource names
+ * may be given as device paths or in the VISA form used by the PyVISA
+ * implementation ("ASRL/dev/ttyUSB0::INSTR")
+ */
+class manager
+{
+  std::vector<std::shared_ptr<interface>> ports;
+  std::vector<handle> port_handles;
+  registry<interface> port_registry;
+
+  // Declared after the ports so that it stops before they close
+  reactor io;
+
+  static std::string device_path(const std::string& resource)
+  {
+    const std::string prefix = "ASRL";
+    const std::string suffix = "::INSTR";
+    std::string path = resource;
+
+    if (path.compare(0, prefix.size(), prefix) == 0)
+      path.erase(0, prefix.size());
+
+    if (path.size() > suffix.size()
+        && path.compare(path.size() - suffix.size(), suffix.size(),
+                        suffix) == 0)
+      path.erase(path.size() - suffix.size());
+
+    return path;
+  }
+
+public:
+  /* @brief Constructor for manager
+   *
+   * @param connect Whether to open every available serial port; if false,
+   *        ports are opened selectively with @open
+   */
+  manager(bool connect=true)
+  {
+    if (!connect)
+      return;
+
+    std::vector<std::string> available = list_resources();
+
+    if (available.empty())
+      throw std::runtime_error("No connected devices found");
+
+    for (const auto& resource : available)
+      open(resource);
+  }
+
+  /* @brief Function to list the serial ports which could be opened
+   *
+   * @return The resource names, e.g. "ASRL/dev/ttyUSB0::INSTR"
+   */
+  std::vector<std::string> list_resources()
+  {
+    std::vector<std::string> result;
+
+    for (const auto& entry : serial_ports_by_id())
+      result.push_back("ASRL" + entry.second + "::INSTR");
+
+    return result;
+  }
+
+  /* @brief Function to open a serial port and add it to the connected devices
+   *
+   * @param resource The device path or resource name
+   * @return shared_ptr Pointer to the opened port
+   * @throw std::runtime_error If the port could not be opened or the
+   *        registry of ports is full
+   */
+  std::shared_ptr<interface> open(const std::string& resource)
+  {
+    std::shared_ptr<interface> port = std::make_shared<interface>(
+      ports.size(), device_path(resource));
+    handle h = port_registry.insert(port);
+
+    if (!h.valid())
+      throw std::runtime_error("No room to register " + resource);
+
+    ports.push_back(port);
+    port_handles.push_back(h);
+
+    return port;
+  }
+
+  /* @brief Function to open a resource, see @open
+   *
+   * @return shared_ptr Pointer to the opened port, or errc::disconnected if
+   *         it could not be opened or the registry of ports is full
+   */
+  expected<std::shared_ptr<interface>> try_open(const std::string& resource)
+  {
+    try
+    {
+      return open(resource);
+    }
+    catch (const std::runtime_error&)
+    {
+      return error(errc::disconnected, "resource could not be opened");
+    }
+  }
+
+  /* @brief Function to return the total number of connected devices
+   *
+   * @return size_t The number of connected devices
+   */
+  size_t num_dev()
+  {
+    return ports.size();
+  }
+
+  /* @brief Function to return a shared_ptr to a connected ports
+   *
+   * @return shared_ptr Pointer to a connected port, or nullptr if it has been
+   *         closed (see @close)
+   */
+  std::shared_ptr<interface> dev(size_t number)
+  {
+    return ports[number];
+  }
+
+  /* @brief Function to return the I/O reactor, which waits on the ports
+   *        added to it from one thread. Configure it (e.g. CPU pinning and
+   *        realtime priority, see reactor_config) and add ports before
+   *        starting it
+   *
+   * @return The reactor, stopped until started
+   */
+  reactor& get_reactor()
+  {
+    return io;
+  }
+
+  /* @brief Function to return the stable handle of a connected port
+   *
+   * @return handle The port's handle, which fails lookup once it is closed
+   */
+  handle dev_handle(size_t number)
+  {
+    return port_handles[number];
+  }
+
+  /* @brief Function to return the registry of open ports, for lookups by
+   *        handle which avoid reference counting, e.g.
+   *
+   *   registry<interface>::reader guard(m.ports_registry());
+   *   if (interface* port = m.ports_registry().find(h)) ...
+   */
+  registry<interface>& ports_registry()
+  {
+    return port_registry;
+  }
+
+  /* @brief Function to close a port, e.g. once it has been unplugged. The
+   *        reactor stops watching it (see @reactor::remove), its index
+   *        remains allocated and @dev returns nullptr for it; the port is
+   *        destroyed once no reader of the registry still holds it. Unlike
+   *        lookups through the registry, it must not race @dev, nor be called
+   *        from a reactor handler
+   *
+   * @param h The port's handle
+   * @return Whether the handle referred to an open port
+   */
+  bool close(handle h)
+  {
+    for (size_t i = 0; i < port_handles.size(); ++i)
+      if (port_handles[i] == h && port_registry.erase(h))
+      {
+        io.remove(i);
+        ports[i].reset();
+        return true;
+      }
+
+    return false;
+  }
+};
+
+} // namespace cyrial
+
+#endif // CYRIAL_NATIVE_MANAGER_HPP
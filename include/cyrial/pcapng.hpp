@@ -0,0 +1,206 @@
+#ifndef CYRIAL_PCAPNG_HPP
+#define CYRIAL_PCAPNG_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "journal.hpp"
+
+namespace cyrial
+{
+
+/* @brief Link type recorded for serial traffic, LINKTYPE_USER0 unless
+ *        overridden (e.g. to match a custom Wireshark dissector)
+ */
+const uint16_t pcapng_default_linktype = 147;
+
+/* @class pcapng_writer
+ *
+ * @brief Class to write journal traffic as a pcapng capture
+ *
+ * Each port is described by its own Interface Description Block, named after
+ * the port location and using nanosecond timestamps. Each chunk of traffic
+ * becomes an Enhanced Packet Block whose epb_flags option records whether it
+ * was received from (inbound) or sent to (outbound) the device.
+ *
+ * The writer may be attached to a journal to stream live, for instance into a
+ * FIFO read by Wireshark, in which case every packet is flushed
+ */
+class pcapng_writer : public journal_sink
+{
+  std::ostream& out;
+  std::unique_ptr<std::ofstream> file;
+
+  uint16_t linktype;
+  bool live;
+
+  // Maps port index to interface id, -1 if not yet described
+  std::vector<int64_t> interfaces;
+  uint32_t next_interface;
+
+  std::string block;
+
+  void put32(uint32_t value)
+  {
+    for (int i = 0; i < 4; ++i)
+      block.push_back((char)(value >> (8 * i)));
+  }
+
+  void put16(uint16_t value)
+  {
+    block.push_back((char)value);
+    block.push_back((char)(value >> 8));
+  }
+
+  void put_padding()
+  {
+    block.append((4 - block.size() % 4) % 4, '\0');
+  }
+
+  void put_option(uint16_t code, const std::string& value)
+  {
+    put16(code);
+    put16(value.size());
+    block += value;
+    put_padding();
+  }
+
+  void start_block(uint32_t type)
+  {
+    block.clear();
+    put32(type);
+    put32(0); // Length, patched by end_block
+  }
+
+  void end_block()
+  {
+    uint32_t length = block.size() + 4;
+
+    for (int i = 0; i < 4; ++i)
+      block[4 + i] = (char)(length >> (8 * i));
+
+    put32(length);
+    out.write(block.data(), block.size());
+  }
+
+  void write_section_header()
+  {
+    start_block(0x0a0d0d0a);
+    put32(0x1a2b3c4d);       // Byte order magic
+    put16(1);                // Major version
+    put16(0);                // Minor version
+    put32(0xffffffff);       // Section length (unspecified)
+    put32(0xffffffff);
+    put_option(4, "cyrial"); // shb_userappl
+    put32(0);                // opt_endofopt
+    end_block();
+  }
+
+  uint32_t interface_id(uint32_t port, const std::string& port_name)
+  {
+    if (port >= interfaces.size())
+      interfaces.resize(port + 1, -1);
+
+    if (interfaces[port] >= 0)
+      return interfaces[port];
+
+    start_block(0x00000001);
+    put16(linktype);
+    put16(0);                     // Reserved
+    put32(0);                     // Snap length (unlimited)
+    put_option(2, port_name);     // if_name
+    put_option(9, std::string(1, 9)); // if_tsresol: 10^-9
+    put32(0);
+    end_block();
+
+    interfaces[port] = next_interface;
+
+    return next_interface++;
+  }
+
+public:
+  /* @brief Constructor for pcapng_writer writing to an existing stream
+   *
+   * @param output Stream to write to, which must be opened in binary mode
+   * @param flush_each Whether to flush after every packet (for live capture)
+   * @param dlt Link type to record for every interface
+   */
+  pcapng_writer(std::ostream& output, bool flush_each=false,
+      uint16_t dlt=pcapng_default_linktype)
+    : out(output), linktype(dlt), live(flush_each), next_interface(0)
+  {
+    write_section_header();
+  }
+
+  /* @brief Constructor for pcapng_writer writing to a file or FIFO
+   *
+   * Opening a FIFO blocks until a reader (e.g. `wireshark -k -i <fifo>`)
+   * opens the other end
+   *
+   * @param path Location of the file or FIFO
+   * @param flush_each Whether to flush after every packet (for live capture)
+   * @param dlt Link type to record for every interface
+   */
+  pcapng_writer(const std::string& path, bool flush_each=false,
+      uint16_t dlt=pcapng_default_linktype)
+    : out(*new std::ofstream(path, std::ios::binary | std::ios::trunc)),
+      file(static_cast<std::ofstream*>(&out)), linktype(dlt),
+      live(flush_each), next_interface(0)
+  {
+    if (!*file)
+      throw std::runtime_error("Failed to open " + path);
+
+    write_section_header();
+  }
+
+  void record(const journal_record& rec, const std::string& port_name)
+    override
+  {
+    uint32_t id = interface_id(rec.port, port_name);
+
+    start_block(0x00000006);
+    put32(id);
+    put32(rec.time >> 32);
+    put32(rec.time & 0xffffffff);
+    put32(rec.data.size()); // Captured length
+    put32(rec.data.size()); // Original length
+    block += rec.data;
+    put_padding();
+    put16(2);                // epb_flags
+    put16(4);
+    put32(rec.dir == DIR_IN ? 0x1 : 0x2);
+    put32(0);
+    end_block();
+
+    if (live)
+      out.flush();
+  }
+
+  void flush()
+  {
+    out.flush();
+  }
+};
+
+/* @brief Function to export the traffic retained by a journal as a pcapng
+ *        file
+ *
+ * @param traffic The journal
+ * @param path Location of the file to create
+ */
+inline void export_pcapng(const journal& traffic, const std::string& path)
+{
+  pcapng_writer writer(path);
+
+  traffic.replay(writer);
+  writer.flush();
+}
+
+} // namespace cyrial
+
+#endif // CYRIAL_PCAPNG_HPP
@@ -0,0 +1,780 @@
+#ifndef CYRIAL_REACTOR_HPP
+#define CYRIAL_REACTOR_HPP
+
+// Requires the native interface, whose ports have file descriptors
+#ifndef CYRIAL_NO_PYTHON
+#error "reactor requires CYRIAL_NO_PYTHON"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <alloca.h>
+#include <poll.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+
+#include "interface.hpp"
+#include "trace.hpp"
+
+namespace cyrial
+{
+
+/* @struct latency_stats
+ *
+ * @brief Summary of a latency distribution, in nanoseconds
+ */
+struct latency_stats
+{
+  uint64_t count;
+  uint64_t min;
+  uint64_t mean;
+  uint64_t max;
+  uint64_t p50;                 // Percentiles are upper bounds of their
+  uint64_t p99;                 // power-of-two histogram bucket
+  uint64_t p999;
+};
+
+/* @class latency_histogram
+ *
+ * @brief Histogram of latencies in power-of-two buckets, recorded by one
+ *        thread and read by any
+ */
+class latency_histogram
+{
+  static const size_t buckets = 64;
+
+  std::atomic<uint64_t> counts[buckets];
+  std::atomic<uint64_t> total;
+  std::atomic<uint64_t> sum;
+  std::atomic<uint64_t> lowest;
+  std::atomic<uint64_t> highest;
+
+  static size_t bucket(uint64_t ns)
+  {
+    size_t b = 0;
+
+    while (ns > 1 && b < buckets - 1)
+    {
+      ns >>= 1;
+      ++b;
+    }
+
+    return b;
+  }
+
+  uint64_t percentile(double fraction) const
+  {
+    uint64_t n = total.load(std::memory_order_relaxed);
+    uint64_t rank = (uint64_t)(n * fraction);
+    uint64_t seen = 0;
+
+    for (size_t b = 0; b < buckets; ++b)
+    {
+      seen += counts[b].load(std::memory_order_relaxed);
+
+      if (seen > rank)
+        return b + 1 < buckets ? (uint64_t)1 << (b + 1) : UINT64_MAX;
+    }
+
+    return highest.load(std::memory_order_relaxed);
+  }
+
+public:
+  latency_histogram()
+  {
+    clear();
+  }
+
+  void clear()
+  {
+    for (size_t b = 0; b < buckets; ++b)
+      counts[b] = 0;
+
+    total = 0;
+    sum = 0;
+    lowest = UINT64_MAX;
+    highest = 0;
+  }
+
+  // Only called from the recording thread, so min and max need no CAS
+  void record(uint64_t ns)
+  {
+    counts[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(ns, std::memory_order_relaxed);
+
+    if (ns < lowest.load(std::memory_order_relaxed))
+      lowest.store(ns, std::memory_order_relaxed);
+
+    if (ns > highest.load(std::memory_order_relaxed))
+      highest.store(ns, std::memory_order_relaxed);
+  }
+
+  latency_stats summary() const
+  {
+    uint64_t n = total.load(std::memory_order_relaxed);
+
+    if (n == 0)
+      return latency_stats{ 0, 0, 0, 0, 0, 0, 0 };
+
+    return latency_stats{ n, lowest.load(std::memory_order_relaxed),
+                          sum.load(std::memory_order_relaxed) / n,
+                          highest.load(std::memory_order_relaxed),
+                          percentile(0.5), percentile(0.99),
+                          percentile(0.999) };
+  }
+};
+
+/* @struct reactor_config
+ *
+ * @brief Scheduling parameters for the I/O reactor thread
+ */
+struct reactor_config
+{
+  // CPU to pin the thread to, ideally one isolated with isolcpus or cpusets;
+  // -1 to leave it to the scheduler
+  int cpu = -1;
+
+  // SCHED_FIFO priority (1-99), applied only if permitted (CAP_SYS_NICE or
+  // RLIMIT_RTPRIO); 0 for the normal scheduler
+  int priority = 0;
+
+  // Whether to lock all current and future memory of the process and to
+  // prefault the thread's stack, so that page faults cannot delay reads
+  bool lock_memory = false;
+
+  // Bytes of stack prefaulted when lock_memory is set
+  size_t stack_prefault = 256 << 10;
+
+  // Period of the timer used to measure scheduling latency, 0 to disable
+  std::chrono::microseconds latency_period{ 1000 };
+
+  // Maximum number of ports and the size of each port's read buffer, both
+  // allocated when the reactor is constructed
+  size_t max_ports = 32;
+  size_t buffer_size = 4096;
+};
+
+/* @struct busy_poll_config
+ *
+ * @brief Parameters of a port read by its own spinning thread rather than by
+ *        the reactor
+ *
+ * Spinning takes a whole CPU while it lasts, so it is limited to a share of
+ * each window; once that is spent the thread blocks in poll until the window
+ * ends, with latency like the reactor's
+ */
+struct busy_poll_config
+{
+  // CPU to pin the spinning thread to, -1 to leave it to the scheduler. It
+  // should differ from the reactor's
+  int cpu = -1;
+
+  // Length of the budget window, and the share of it which may be spent
+  // spinning (0-1)
+  std::chrono::milliseconds window{ 100 };
+  double budget = 0.5;
+};
+
+/* @struct busy_poll_stats
+ *
+ * @brief Activity and latency of a busy-polled port
+ */
+struct busy_poll_stats
+{
+  // Upper bound on the delay between data arriving and its read: the time
+  // since the start of the previous, empty, read. Recorded only while
+  // spinning, at the start of each burst
+  latency_stats detection;
+
+  uint64_t reads;
+  uint64_t bytes;
+  uint64_t throttled_windows;   // Windows whose budget was spent
+  double cpu_share;             // Share of time spent spinning
+};
+
+/* @struct reactor_state
+ *
+ * @brief Which scheduling parameters of the reactor thread took effect
+ */
+struct reactor_state
+{
+  bool running;
+  bool pinned;
+  bool realtime;
+  bool memory_locked;
+};
+
+/* @brief Function to hint to the CPU that the caller is spinning
+ */
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  __asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
+/* @class reactor
+ *
+ * @brief Class to wait on many ports from one thread with epoll, handing
+ *        each read to the port's handler as it arrives
+ *
+ * The one or two ports whose latency matters most (e.g. those carrying
+ * GPRMC or TIM-TP) may instead be busy polled: each is read by its own
+ * thread in a tight loop, within a CPU budget (see busy_poll_config)
+ *
+ * Intended for ports which stream unsolicited data (NMEA, UBX, PPS
+ * timestamps); command/response traffic on the same port through its
+ * interface would compete for the data. Handlers run on the reactor thread
+ * and must not block. Once running, the reactor reads into buffers allocated
+ * at construction and does not allocate
+ */
+class reactor
+{
+public:
+  /* @brief Handler of the data read from a port
+   *
+   * @param port The index of the port, see interface::get_idx
+   * @param data The bytes read, valid only for the duration of the call
+   * @param size The number of bytes read
+   */
+  typedef std::function<void(size_t port, const char* data, size_t size)>
+    handler;
+
+private:
+  struct entry
+  {
+    size_t port;
+    int fd;
+    handler on_read;
+  };
+
+  struct spinner
+  {
+    size_t port;
+    int fd;
+    handler on_read;
+    busy_poll_config config;
+
+    std::unique_ptr<char[]> buffer;
+    std::thread thread;
+
+    latency_histogram detection;
+    std::atomic<uint64_t> reads;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> throttled;
+    std::atomic<uint64_t> spin_ns;
+    std::atomic<uint64_t> total_ns;
+
+    spinner(size_t p, int f, handler h, const busy_poll_config& cfg,
+            size_t buffer_size)
+      : port(p), fd(f), on_read(h), config(cfg),
+        buffer(new char[buffer_size]), reads(0), bytes(0), throttled(0),
+        spin_ns(0), total_ns(0)
+    {
+      std::memset(buffer.get(), 0, buffer_size);
+    }
+  };
+
+  reactor_config config;
+
+  int epoll_fd;
+  int timer_fd;
+
+  std::vector<entry> entries;
+  std::vector<std::unique_ptr<spinner>> spinners;
+  std::unique_ptr<char[]> buffer;
+
+  std::atomic<bool> running;
+  std::atomic<bool> pinned;
+  std::atomic<bool> realtime;
+  std::atomic<bool> memory_locked;
+
+  latency_histogram wakeup_latency;
+  std::atomic<uint64_t> overruns;
+  std::atomic<uint64_t> reads;
+  std::atomic<uint64_t> bytes;
+
+  std::thread worker;
+
+  static uint64_t monotonic_ns()
+  {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+
+  // Applies the configured scheduling parameters to the calling thread
+  void prepare()
+  {
+    if (config.cpu >= 0)
+    {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(config.cpu, &set);
+
+      pinned = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+
+    if (config.lock_memory)
+    {
+      memory_locked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+
+      // Touch the stack so that its pages are resident before the first read
+      char* stack = (char*)alloca(config.stack_prefault);
+      std::memset(stack, 0, config.stack_prefault);
+      __asm__ __volatile__("" : : "r"(stack) : "memory");
+    }
+
+    if (config.priority > 0)
+    {
+      sched_param param;
+      param.sched_priority = config.priority;
+
+      realtime = pthread_setschedparam(pthread_self(), SCHED_FIFO,
+                                       &param) == 0;
+    }
+  }
+
+  void arm_timer(uint64_t& deadline)
+  {
+    uint64_t period = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      config.latency_period).count();
+
+    deadline = monotonic_ns() + period;
+
+    itimerspec spec;
+    spec.it_value.tv_sec = deadline / 1000000000;
+    spec.it_value.tv_nsec = deadline % 1000000000;
+    spec.it_interval.tv_sec = period / 1000000000;
+    spec.it_interval.tv_nsec = period % 1000000000;
+
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+  }
+
+  void run()
+  {
+    prepare();
+
+    const size_t max_events = 16;
+    epoll_event events[max_events];
+    uint64_t period = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      config.latency_period).count();
+    uint64_t deadline = 0;
+
+    if (period > 0)
+      arm_timer(deadline);
+
+    while (running)
+    {
+      int ready = epoll_wait(epoll_fd, events, max_events, 100);
+
+      for (int i = 0; i < ready; ++i)
+      {
+        // The timer is registered with the index past the last port
+        if (events[i].data.u64 == entries.size())
+        {
+          uint64_t now = monotonic_ns();
+          uint64_t expirations = 0;
+
+          if (::read(timer_fd, &expirations, sizeof(expirations)) > 0)
+          {
+            // Latency is measured from the most recent expiration
+            deadline += (expirations - 1) * period;
+            wakeup_latency.record(now > deadline ? now - deadline : 0);
+            overruns.fetch_add(expirations - 1, std::memory_order_relaxed);
+            deadline += period;
+          }
+
+          continue;
+        }
+
+        entry& e = entries[events[i].data.u64];
+        ssize_t n;
+
+        while ((n = ::read(e.fd, buffer.get(), config.buffer_size)) > 0)
+        {
+          CYRIAL_TRACE_SPAN("dispatch", e.port);
+
+          reads.fetch_add(1, std::memory_order_relaxed);
+          bytes.fetch_add(n, std::memory_order_relaxed);
+          e.on_read(e.port, buffer.get(), n);
+        }
+
+        // A hung-up port would otherwise be reported ready forever. With
+        // VMIN and VTIME of 0 an empty port reads 0, so only the event says
+        if (events[i].events & (EPOLLHUP | EPOLLERR))
+          epoll_ctl(epoll_fd, EPOLL_CTL_DEL, e.fd, nullptr);
+      }
+    }
+  }
+
+  // Reads one port in a tight loop, blocking once the window's budget is
+  // spent
+  void spin(spinner& sp)
+  {
+    if (sp.config.cpu >= 0)
+    {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(sp.config.cpu, &set);
+      pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    const uint64_t window = std::chrono::duration_cast<
+      std::chrono::nanoseconds>(sp.config.window).count();
+    const uint64_t budget = (uint64_t)(window * sp.config.budget);
+
+    while (running)
+    {
+      uint64_t start = monotonic_ns();
+      uint64_t now = start;
+      uint64_t last_empty = 0;
+
+      // Spin until the budget is spent
+      while (running && now - start < budget)
+      {
+        ssize_t n = ::read(sp.fd, sp.buffer.get(), config.buffer_size);
+        uint64_t before = now;
+        now = monotonic_ns();
+
+        if (n <= 0)
+        {
+          last_empty = before;
+          cpu_relax();
+          continue;
+        }
+
+        if (last_empty != 0)
+          sp.detection.record(now - last_empty);
+
+        last_empty = 0;
+        sp.reads.fetch_add(1, std::memory_order_relaxed);
+        sp.bytes.fetch_add(n, std::memory_order_relaxed);
+        sp.on_read(sp.port, sp.buffer.get(), n);
+        now = monotonic_ns();
+      }
+
+      sp.spin_ns.fetch_add(now - start, std::memory_order_relaxed);
+
+      if (now - start >= budget && budget < window)
+        sp.throttled.fetch_add(1, std::memory_order_relaxed);
+
+      // Block for the rest of the window
+      while (running && now - start < window)
+      {
+        uint64_t left = std::min<uint64_t>(window - (now - start), 100000000);
+        timespec timeout{ (time_t)(left / 1000000000),
+                          (long)(left % 1000000000) };
+        pollfd p{ sp.fd, POLLIN, 0 };
+
+        if (ppoll(&p, 1, &timeout, nullptr) > 0)
+        {
+          if (p.revents & (POLLHUP | POLLERR))
+            return;
+
+          ssize_t n = ::read(sp.fd, sp.buffer.get(), config.buffer_size);
+
+          if (n > 0)
+          {
+            sp.reads.fetch_add(1, std::memory_order_relaxed);
+            sp.bytes.fetch_add(n, std::memory_order_relaxed);
+            sp.on_read(sp.port, sp.buffer.get(), n);
+          }
+        }
+
+        now = monotonic_ns();
+      }
+
+      sp.total_ns.fetch_add(now - start, std::memory_order_relaxed);
+    }
+  }
+
+public:
+  /* @brief Constructor for reactor
+   *
+   * @param cfg Scheduling parameters and buffer sizes
+   */
+  reactor(const reactor_config& cfg=reactor_config())
+    : config(cfg), buffer(new char[cfg.buffer_size]), running(false),
+      pinned(false), realtime(false), memory_locked(false), overruns(0),
+      reads(0), bytes(0)
+  {
+    entries.reserve(config.max_ports);
+    std::memset(buffer.get(), 0, config.buffer_size);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (epoll_fd < 0)
+      throw std::runtime_error("Failed to create epoll instance");
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (timer_fd < 0)
+    {
+      ::close(epoll_fd);
+      throw std::runtime_error("Failed to create latency timer");
+    }
+  }
+
+  reactor(const reactor&) = delete;
+  reactor& operator=(const reactor&) = delete;
+
+  /* @brief Function to change the scheduling parameters, which take effect
+   *        at the next @start
+   *
+   * @throw std::runtime_error If the reactor is running
+   */
+  void configure(const reactor_config& cfg)
+  {
+    if (running)
+      throw std::runtime_error("Reactor must be stopped to configure");
+
+    if (cfg.buffer_size != config.buffer_size)
+    {
+      buffer.reset(new char[cfg.buffer_size]);
+      std::memset(buffer.get(), 0, cfg.buffer_size);
+    }
+
+    config = cfg;
+    entries.reserve(config.max_ports);
+
+    for (auto& sp : spinners)
+      sp->buffer.reset(new char[config.buffer_size]);
+  }
+
+  /* @brief Function to watch a port, which must outlive the reactor or be
+   *        watched only until @stop or @remove
+   *
+   * @param port The port
+   * @param on_read Called on the reactor thread with each read from the port
+   * @throw std::runtime_error If the reactor is running or full
+   */
+  void add(interface& port, handler on_read)
+  {
+    if (running)
+      throw std::runtime_error("Reactor must be stopped to add ports");
+
+    if (entries.size() + spinners.size() == config.max_ports)
+      throw std::runtime_error("Reactor has no room for " +
+                               port.get_location());
+
+    entries.push_back(entry{ port.get_idx(), port.get_fd(), on_read });
+  }
+
+  /* @brief Function to busy poll a port from its own thread instead of
+   *        watching it with epoll, see @add
+   *
+   * @param port The port
+   * @param on_read Called on the port's thread with each read from it
+   * @param cfg The spinning thread's CPU and budget
+   * @throw std::runtime_error If the reactor is running or full
+   */
+  void add_busy_poll(interface& port, handler on_read,
+                     const busy_poll_config& cfg=busy_poll_config())
+  {
+    if (running)
+      throw std::runtime_error("Reactor must be stopped to add ports");
+
+    if (entries.size() + spinners.size() == config.max_ports)
+      throw std::runtime_error("Reactor has no room for " +
+                               port.get_location());
+
+    spinners.emplace_back(new spinner(port.get_idx(), port.get_fd(), on_read,
+                                      cfg, config.buffer_size));
+  }
+
+  /* @brief Function to stop watching a port, e.g. before it is closed, so
+   *        that its file descriptor is not read once the number is reused.
+   *        If the reactor is running it is stopped and restarted, so this
+   *        must not be called from a handler
+   *
+   * @param port The index of the port, see interface::get_idx
+   * @return Whether the port was watched
+   */
+  bool remove(size_t port)
+  {
+    auto watched = [port](const entry& e) { return e.port == port; };
+    auto spinning = [port](const std::unique_ptr<spinner>& sp) {
+      return sp->port == port;
+    };
+
+    if (std::none_of(entries.begin(), entries.end(), watched)
+        && std::none_of(spinners.begin(), spinners.end(), spinning))
+      return false;
+
+    bool restart = running;
+    stop();
+
+    entries.erase(std::remove_if(entries.begin(), entries.end(), watched),
+                  entries.end());
+    spinners.erase(std::remove_if(spinners.begin(), spinners.end(),
+                                  spinning),
+                   spinners.end());
+
+    if (restart)
+      start();
+
+    return true;
+  }
+
+  /* @brief Function to start the reactor thread
+   */
+  void start()
+  {
+    if (running)
+      return;
+
+    // Registrations are rebuilt each time, as the timer's index follows the
+    // ports
+    ::close(epoll_fd);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (epoll_fd < 0)
+      throw std::runtime_error("Failed to create epoll instance");
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+      epoll_event ev;
+      ev.events = EPOLLIN;
+      ev.data.u64 = i;
+
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, entries[i].fd, &ev) != 0)
+        throw std::runtime_error("Failed to watch port "
+                                 + std::to_string(entries[i].port));
+    }
+
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = entries.size();
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+
+    pinned = realtime = memory_locked = false;
+    running = true;
+    worker = std::thread(&reactor::run, this);
+
+    for (auto& sp : spinners)
+      sp->thread = std::thread(&reactor::spin, this, std::ref(*sp));
+  }
+
+  /* @brief Function to stop the reactor thread, returning once it has
+   */
+  void stop()
+  {
+    running = false;
+
+    if (worker.joinable())
+      worker.join();
+
+    for (auto& sp : spinners)
+      if (sp->thread.joinable())
+        sp->thread.join();
+  }
+
+  /* @brief Function to report which scheduling parameters took effect, e.g.
+   *        realtime is false without permission to use SCHED_FIFO
+   */
+  reactor_state state() const
+  {
+    return reactor_state{ running, pinned, realtime, memory_locked };
+  }
+
+  /* @brief Function to get the scheduling latency of the reactor thread: the
+   *        delay between each expiry of a periodic timer and the thread
+   *        handling it
+   */
+  latency_stats scheduling_latency() const
+  {
+    return wakeup_latency.summary();
+  }
+
+  /* @brief Function to count the timer periods the thread missed entirely
+   */
+  uint64_t missed_periods() const
+  {
+    return overruns.load(std::memory_order_relaxed);
+  }
+
+  /* @brief Function to count the reads dispatched and bytes read
+   */
+  uint64_t read_count() const
+  {
+    return reads.load(std::memory_order_relaxed);
+  }
+
+  uint64_t byte_count() const
+  {
+    return bytes.load(std::memory_order_relaxed);
+  }
+
+  /* @brief Function to get the activity and latency of a busy-polled port
+   *
+   * Compare its detection latency with @scheduling_latency, the delay the
+   * reactor would add to each read of the port
+   *
+   * @param port The index of the port
+   * @throw std::out_of_range If the port is not busy polled
+   */
+  busy_poll_stats busy_poll(size_t port) const
+  {
+    for (const auto& sp : spinners)
+      if (sp->port == port)
+      {
+        uint64_t total = sp->total_ns.load(std::memory_order_relaxed);
+
+        return busy_poll_stats{
+          sp->detection.summary(),
+          sp->reads.load(std::memory_order_relaxed),
+          sp->bytes.load(std::memory_order_relaxed),
+          sp->throttled.load(std::memory_order_relaxed),
+          total ? (double)sp->spin_ns.load(std::memory_order_relaxed) / total
+                : 0.0 };
+      }
+
+    throw std::out_of_range("Port " + std::to_string(port)
+                            + " is not busy polled");
+  }
+
+  /* @brief Function to discard the latency statistics, e.g. after warm up
+   */
+  void clear_stats()
+  {
+    wakeup_latency.clear();
+    overruns = 0;
+
+    for (auto& sp : spinners)
+      sp->detection.clear();
+  }
+
+  ~reactor()
+  {
+    stop();
+
+    ::close(timer_fd);
+    ::close(epoll_fd);
+  }
+};
+
+} // namespace cyrial
+
+#endif // CYRIAL_REACTOR_HPP
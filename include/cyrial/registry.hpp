@@ -0,0 +1,341 @@
+#ifndef CYRIAL_REGISTRY_HPP
+#define CYRIAL_REGISTRY_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace cyrial
+{
+
+/* @struct handle
+ *
+ * @brief Stable reference to an object in a registry
+ *
+ * A handle outlives the object it refers to: once the object is removed,
+ * lookups of the handle fail even if its slot has been reused
+ */
+struct handle
+{
+  uint32_t index;
+  uint32_t generation;        // 0 for the null handle
+
+  bool valid() const
+  {
+    return generation != 0;
+  }
+
+  bool operator==(const handle& other) const
+  {
+    return index == other.index && generation == other.generation;
+  }
+
+  bool operator!=(const handle& other) const
+  {
+    return !(*this == other);
+  }
+};
+
+/* @class registry
+ *
+ * @brief Slot map of objects addressed by generation-checked handles
+ *
+ * Lookups are O(1) and lock free, and touch no reference counts: they return
+ * a plain pointer which remains valid while the caller holds a @reader. Objects
+ * removed while readers are active are retired, and destroyed once every
+ * reader which could have seen them has left (epoch-based reclamation), so
+ * hot-plug updates never wait for I/O threads and I/O threads never wait for
+ * updates. Insertion and removal are serialized by a mutex
+ *
+ * @tparam T The type of object held, e.g. interface
+ */
+template <typename T>
+class registry
+{
+  struct slot
+  {
+    std::atomic<T*> object;
+    std::atomic<uint32_t> generation;
+    std::shared_ptr<T> owner;             // Guarded by update_lock
+
+    slot()
+      : object(nullptr), generation(1)
+    { }
+  };
+
+  struct retired
+  {
+    std::shared_ptr<T> owner;
+    uint64_t epoch;
+  };
+
+  static const size_t max_readers = 128;
+
+  // Epoch of each reader in its critical section, 0 when outside one. Shared
+  // so that threads may release their records after the registry is gone
+  struct reader_table
+  {
+    std::atomic<uint64_t> epoch[max_readers];
+    std::atomic<bool> claimed[max_readers];
+
+    reader_table()
+    {
+      for (size_t i = 0; i < max_readers; ++i)
+      {
+        epoch[i] = 0;
+        claimed[i] = false;
+      }
+    }
+  };
+
+  // Records claimed by the calling thread, released when it exits
+  struct thread_claims
+  {
+    struct claim
+    {
+      const reader_table* table;
+      std::weak_ptr<reader_table> owner;
+      size_t index;
+    };
+
+    std::vector<claim> held;
+
+    ~thread_claims()
+    {
+      for (const auto& c : held)
+        if (std::shared_ptr<reader_table> t = c.owner.lock())
+          t->claimed[c.index] = false;
+    }
+  };
+
+  std::unique_ptr<slot[]> slots;
+  size_t capacity;
+
+  std::shared_ptr<reader_table> readers;
+  std::atomic<uint64_t> epoch;
+
+  std::mutex update_lock;
+  std::vector<uint32_t> free_slots;
+  size_t used;
+  std::vector<retired> retired_objects;
+
+  // Index of the calling thread's reader record, claimed on first use
+  size_t reader_index()
+  {
+    static thread_local thread_claims claims;
+
+    for (size_t i = 0; i < claims.held.size(); )
+      if (claims.held[i].owner.expired())
+      {
+        claims.held[i] = claims.held.back();
+        claims.held.pop_back();
+      }
+      else if (claims.held[i].table == readers.get())
+        return claims.held[i].index;
+      else
+        ++i;
+
+    for (size_t i = 0; i < max_readers; ++i)
+    {
+      bool free = false;
+
+      if (readers->claimed[i].compare_exchange_strong(free, true))
+      {
+        claims.held.push_back({ readers.get(), readers, i });
+        return i;
+      }
+    }
+
+    throw std::runtime_error("Too many threads reading registry");
+  }
+
+  // Destroys the retired objects no reader can still hold
+  void reclaim()
+  {
+    uint64_t oldest = UINT64_MAX;
+
+    for (size_t i = 0; i < max_readers; ++i)
+    {
+      uint64_t e = readers->epoch[i].load();
+
+      if (e != 0 && e < oldest)
+        oldest = e;
+    }
+
+    for (size_t i = 0; i < retired_objects.size(); )
+      if (retired_objects[i].epoch < oldest)
+      {
+        retired_objects[i] = std::move(retired_objects.back());
+        retired_objects.pop_back();
+      }
+      else
+        ++i;
+  }
+
+public:
+  /* @class reader
+   *
+   * @brief Read-side critical section: pointers returned by @find remain
+   *        valid until it is destroyed
+   *
+   * Readers are cheap to create, and should be short lived (e.g. one poll
+   * cycle) so that removed objects can be reclaimed
+   */
+  class reader
+  {
+    std::atomic<uint64_t>* record;
+    uint64_t previous;
+
+  public:
+    /* @throw std::runtime_error If more than 128 threads read the registry
+     */
+    reader(registry& r)
+      : record(&r.readers->epoch[r.reader_index()])
+    {
+      // Nested readers keep the outermost epoch
+      previous = record->load(std::memory_order_relaxed);
+
+      if (previous == 0)
+        record->store(r.epoch.load());
+    }
+
+    reader(const reader&) = delete;
+    reader& operator=(const reader&) = delete;
+
+    ~reader()
+    {
+      if (previous == 0)
+        record->store(0, std::memory_order_release);
+    }
+  };
+
+  /* @brief Constructor for registry
+   *
+   * @param slot_count Maximum number of objects held at once
+   */
+  registry(size_t slot_count=256)
+    : slots(new slot[slot_count]), capacity(slot_count),
+      readers(std::make_shared<reader_table>()), epoch(1), used(0)
+  { }
+
+  registry(const registry&) = delete;
+  registry& operator=(const registry&) = delete;
+
+  /* @brief Function to add an object
+   *
+   * @param object The object, which the registry shares ownership of
+   * @return Its handle, or the null handle if every slot is in use
+   */
+  handle insert(std::shared_ptr<T> object)
+  {
+    std::lock_guard<std::mutex> guard(update_lock);
+    uint32_t index;
+
+    if (!free_slots.empty())
+    {
+      index = free_slots.back();
+      free_slots.pop_back();
+    }
+    else if (used < capacity)
+      index = used++;
+    else
+      return handle{ 0, 0 };
+
+    slot& s = slots[index];
+    s.owner = object;
+    s.object.store(object.get());
+
+    return handle{ index, s.generation.load() };
+  }
+
+  /* @brief Function to remove an object. Readers which already found it may
+   *        continue to use it until they leave
+   *
+   * @param h The object's handle
+   * @return Whether the handle referred to an object
+   */
+  bool erase(handle h)
+  {
+    std::lock_guard<std::mutex> guard(update_lock);
+
+    if (h.index >= used || !h.valid())
+      return false;
+
+    slot& s = slots[h.index];
+
+    if (s.generation.load() != h.generation || !s.owner)
+      return false;
+
+    // Invalidate the handle before unpublishing, so that a reused slot is
+    // never mistaken for the old object
+    uint32_t next = h.generation + 1;
+    s.generation.store(next == 0 ? 1 : next);
+    s.object.store(nullptr);
+
+    retired_objects.push_back(retired{ std::move(s.owner), epoch++ });
+    free_slots.push_back(h.index);
+
+    reclaim();
+
+    return true;
+  }
+
+  /* @brief Function to look up an object
+   *
+   * Must be called while the calling thread holds a @reader
+   *
+   * @param h The object's handle
+   * @return The object, or nullptr if it has been removed
+   */
+  T* find(handle h) const
+  {
+    if (h.index >= capacity)
+      return nullptr;
+
+    const slot& s = slots[h.index];
+    T* object = s.object.load();
+
+    return s.generation.load() == h.generation ? object : nullptr;
+  }
+
+  /* @brief Function to get the handles of every object held
+   */
+  std::vector<handle> handles()
+  {
+    std::lock_guard<std::mutex> guard(update_lock);
+    std::vector<handle> result;
+
+    for (size_t i = 0; i < used; ++i)
+      if (slots[i].owner)
+        result.push_back(handle{ (uint32_t)i, slots[i].generation.load() });
+
+    return result;
+  }
+
+  /* @brief Function to destroy removed objects which no reader holds, also
+   *        done on each removal
+   */
+  void collect()
+  {
+    std::lock_guard<std::mutex> guard(update_lock);
+
+    reclaim();
+  }
+
+  /* @brief Function to count removed objects not yet destroyed
+   */
+  size_t pending()
+  {
+    std::lock_guard<std::mutex> guard(update_lock);
+
+    return retired_objects.size();
+  }
+};
+
+} // namespace cyrial
+
+#endif // CYRIAL_REGISTRY_HPP
@@ -0,0 +1,593 @@
+#ifndef CYRIAL_TELEMETRY_AGENT_HPP
+#define CYRIAL_TELEMETRY_AGENT_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "sample.hpp"
+#include "wire.hpp"
+
+namespace cyrial
+{
+
+/* @struct agent_config
+ *
+ * @brief Tuning parameters for the telemetry agent
+ */
+struct agent_config
+{
+  // Maximum number of samples per frame
+  size_t batch_size = 512;
+
+  // Maximum time a sample waits before its batch is sent
+  std::chrono::milliseconds max_delay{ 100 };
+
+  // Number of samples which may be queued before push applies backpressure
+  size_t queue_capacity = 65536;
+
+  // Whether push blocks (true) or rejects samples (false) when the queue is
+  // full
+  bool block_when_full = false;
+
+  // Encoded frames retained while the collector is unreachable; the oldest
+  // frames are discarded beyond this limit
+  size_t buffer_bytes = 16 << 20;
+
+  // Delay between connection attempts
+  std::chrono::milliseconds reconnect_delay{ 1000 };
+
+  // Time allowed for each address of the collector to accept a connection,
+  // so that an unresponsive host does not stall the worker or its shutdown
+  std::chrono::milliseconds connect_timeout{ 1000 };
+};
+
+/* @struct agent_stats
+ *
+ * @brief Counters describing the activity of an agent
+ */
+struct agent_stats
+{
+  uint64_t samples_sent;
+  uint64_t samples_rejected;
+  uint64_t frames_sent;
+  uint64_t frames_dropped;
+  uint64_t bytes_sent;
+  uint64_t connects;
+};
+
+/* @class agent
+ *
+ * @brief Class to stream samples to a central collector over TCP
+ *
+ * Samples are queued by push and encoded into frames (see wire.hpp) by a
+ * background thread, which also owns the connection. Frames are buffered
+ * while the collector is unreachable and sent in order once it reconnects
+ */
+class agent : public sample_sink
+{
+  std::string host;
+  std::string port;
+  agent_config config;
+
+  std::mutex lock;
+  std::condition_variable ready;
+  std::condition_variable space;
+  std::vector<sample> queue;
+  bool running;
+
+  std::deque<std::vector<uint8_t>> pending;
+  size_t pending_bytes;
+  size_t pending_offset;
+
+  int sock;
+  std::chrono::steady_clock::time_point next_attempt;
+
+  std::atomic<uint64_t> samples_sent;
+  std::atomic<uint64_t> samples_rejected;
+  std::atomic<uint64_t> frames_sent;
+  std::atomic<uint64_t> frames_dropped;
+  std::atomic<uint64_t> bytes_sent;
+  std::atomic<uint64_t> connects;
+
+  std::thread worker;
+
+  void disconnect()
+  {
+    if (sock >= 0)
+      ::close(sock);
+
+    sock = -1;
+    pending_offset = 0;
+    next_attempt = std::chrono::steady_clock::now() + config.reconnect_delay;
+  }
+
+  // Connects sock to an address without blocking for longer than timeout.
+  // The socket is left non-blocking; sends use MSG_DONTWAIT regardless
+  bool connect_within(const addrinfo* ai, std::chrono::milliseconds timeout)
+  {
+    int flags = fcntl(sock, F_GETFL, 0);
+
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) != 0)
+      return false;
+
+    if (::connect(sock, ai->ai_addr, ai->ai_addrlen) == 0)
+      return true;
+
+    if (errno != EINPROGRESS)
+      return false;
+
+    pollfd pfd = { sock, POLLOUT, 0 };
+
+    if (::poll(&pfd, 1, timeout.count()) <= 0)
+      return false;
+
+    int err = 0;
+    socklen_t size = sizeof(err);
+
+    return getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &size) == 0
+           && err == 0;
+  }
+
+  bool connect()
+  {
+    if (sock >= 0)
+      return true;
+
+    if (std::chrono::steady_clock::now() < next_attempt)
+      return false;
+
+    addrinfo hints = addrinfo();
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* result = nullptr;
+
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0)
+    {
+      disconnect();
+      return false;
+    }
+
+    for (addrinfo* ai = result; ai && sock < 0; ai = ai->ai_next)
+    {
+      sock = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+      if (sock >= 0 && !connect_within(ai, config.connect_timeout))
+      {
+        ::close(sock);
+        sock = -1;
+      }
+    }
+
+    freeaddrinfo(result);
+
+    if (sock < 0)
+    {
+      disconnect();
+      return false;
+    }
+
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    ++connects;
+
+    return true;
+  }
+
+  /* @brief Function to write as much of the pending data as the socket will
+   *        accept without blocking the caller for longer than max_delay
+   */
+  void send_pending()
+  {
+    while (!pending.empty() && connect())
+    {
+      const std::vector<uint8_t>& frame = pending.front();
+
+      pollfd pfd = { sock, POLLOUT, 0 };
+
+      if (::poll(&pfd, 1, config.max_delay.count()) <= 0)
+        return;
+
+      if (pfd.revents & (POLLERR | POLLHUP))
+      {
+        disconnect();
+        return;
+      }
+
+      ssize_t n = ::send(sock, frame.data() + pending_offset,
+                         frame.size() - pending_offset,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+
+      if (n < 0)
+      {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+          disconnect();
+
+        return;
+      }
+
+      bytes_sent += n;
+      pending_offset += n;
+
+      if (pending_offset == frame.size())
+      {
+        pending_bytes -= frame.size();
+        pending_offset = 0;
+        pending.pop_front();
+        ++frames_sent;
+      }
+    }
+  }
+
+  /* @brief Function to buffer an encoded frame, discarding the oldest
+   *        buffered frames if the limit is exceeded
+   *
+   * @param frame The encoded frame
+   * @param count The number of samples contained in the frame
+   */
+  void enqueue_frame(const std::vector<uint8_t>& frame, size_t count)
+  {
+    pending.push_back(frame);
+    pending_bytes += frame.size();
+    samples_sent += count;
+
+    // A partially sent frame cannot be dropped without corrupting the stream
+    while (pending_bytes > config.buffer_bytes && pending.size() > 1
+           && (pending_offset == 0 || pending.size() > 2))
+    {
+      auto victim = pending.begin() + (pending_offset == 0 ? 0 : 1);
+
+      pending_bytes -= victim->size();
+      pending.erase(victim);
+      ++frames_dropped;
+    }
+  }
+
+  void run()
+  {
+    batch_writer writer;
+    std::vector<sample> batch;
+
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (running || !queue.empty())
+    {
+      ready.wait_for(guard, config.max_delay, [this]
+      {
+        return !running || queue.size() >= config.batch_size;
+      });
+
+      batch.swap(queue);
+      space.notify_all();
+      guard.unlock();
+
+      for (size_t i = 0; i < batch.size(); ++i)
+      {
+        writer.push(batch[i]);
+
+        if (writer.size() == config.batch_size || i + 1 == batch.size())
+        {
+          size_t count = writer.size();
+          enqueue_frame(writer.finish(), count);
+        }
+      }
+
+      batch.clear();
+      send_pending();
+
+      guard.lock();
+    }
+
+    guard.unlock();
+
+    // Make a final attempt to deliver buffered frames
+    next_attempt = std::chrono::steady_clock::now();
+    send_pending();
+    disconnect();
+  }
+
+public:
+  /* @brief Constructor for agent
+   *
+   * The connection is established lazily, so the collector does not need to
+   * be reachable when the agent is created
+   *
+   * @param collector_host Host name or address of the collector
+   * @param collector_port TCP port of the collector
+   * @param cfg Batching, buffering, and backpressure parameters
+   */
+  agent(const std::string& collector_host, uint16_t collector_port,
+      const agent_config& cfg=agent_config())
+    : host(collector_host), port(std::to_string(collector_port)), config(cfg),
+      running(true), pending_bytes(0), pending_offset(0), sock(-1),
+      next_attempt(std::chrono::steady_clock::now()), samples_sent(0),
+      samples_rejected(0), frames_sent(0), frames_dropped(0), bytes_sent(0),
+      connects(0)
+  {
+    queue.reserve(config.batch_size);
+    worker = std::thread(&agent::run, this);
+  }
+
+  agent(const agent&) = delete;
+  agent& operator=(const agent&) = delete;
+
+  /* @brief Function to queue a sample for transmission
+   *
+   * @param s The sample
+   * @return Whether the sample was accepted; false only if the queue is full
+   *         and block_when_full is not set
+   */
+  bool offer(const sample& s)
+  {
+    std::unique_lock<std::mutex> guard(lock);
+
+    if (queue.size() >= config.queue_capacity)
+    {
+      if (!config.block_when_full)
+      {
+        ++samples_rejected;
+        return false;
+      }
+
+      space.wait(guard, [this]
+      {
+        return queue.size() < config.queue_capacity;
+      });
+    }
+
+    queue.push_back(s);
+
+    if (queue.size() == config.batch_size)
+      ready.notify_one();
+
+    return true;
+  }
+
+  void push(const sample& s) override
+  {
+    offer(s);
+  }
+
+  /* @brief Function to get the activity counters of the agent
+   */
+  agent_stats stats() const
+  {
+    return agent_stats{ samples_sent, samples_rejected, frames_sent,
+                        frames_dropped, bytes_sent, connects };
+  }
+
+  /* @brief Destructor for agent, sends queued samples before returning if
+   *        the collector is reachable
+   */
+  ~agent()
+  {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      running = false;
+    }
+
+    ready.notify_one();
+    worker.join();
+  }
+};
+
+/* @class collector
+ *
+ * @brief Class to receive frames from any number of agents
+ *
+ * Frames are decoded in place from the receive buffer of each connection and
+ * handed to the handler as a batch_view, which is only valid for the duration
+ * of the call
+ */
+class collector
+{
+public:
+  typedef std::function<void(const batch_view&, int)> handler_type;
+
+  // Frames larger than this are treated as a corrupt stream
+  static const size_t max_frame_size = 64 << 20;
+
+private:
+  struct connection
+  {
+    int fd;
+    std::vector<uint8_t> buffer;
+    size_t start;
+    size_t end;
+  };
+
+  int listener;
+  uint16_t bound_port;
+  handler_type handler;
+
+  std::atomic<bool> running;
+  std::vector<connection> connections;
+
+  /* @brief Function to read from a connection and dispatch complete frames
+   *
+   * @return Whether the connection remains open
+   */
+  bool receive(connection& c)
+  {
+    if (c.end == c.buffer.size())
+    {
+      // Reclaim consumed space before growing
+      if (c.start > 0)
+      {
+        std::memmove(c.buffer.data(), c.buffer.data() + c.start,
+                     c.end - c.start);
+        c.end -= c.start;
+        c.start = 0;
+      }
+      else
+        c.buffer.resize(c.buffer.size() * 2);
+    }
+
+    ssize_t n = ::recv(c.fd, c.buffer.data() + c.end, c.buffer.size() - c.end,
+                       0);
+
+    if (n <= 0)
+      return n < 0 && (errno == EAGAIN || errno == EINTR);
+
+    c.end += n;
+
+    for (;;)
+    {
+      const uint8_t* data = c.buffer.data() + c.start;
+      size_t available = c.end - c.start;
+      size_t size = frame_size(data, available);
+
+      if (size == 0)
+        break;
+
+      if (!frame_valid(data, available) || size > max_frame_size)
+        return false;
+
+      if (size > available)
+      {
+        if (size > c.buffer.size())
+          c.buffer.resize(size);
+
+        break;
+      }
+
+      handler(batch_view(data, size), c.fd);
+      c.start += size;
+    }
+
+    if (c.start == c.end)
+      c.start = c.end = 0;
+
+    return true;
+  }
+
+public:
+  /* @brief Constructor for collector
+   *
+   * @param port TCP port to listen on, 0 selects an ephemeral port
+   * @param h Function to call with each received batch and the descriptor of
+   *        the connection it arrived on
+   * @param loopback_only Whether to only accept connections from localhost
+   */
+  collector(uint16_t port, handler_type h, bool loopback_only=false)
+    : handler(h), running(false)
+  {
+    listener = ::socket(AF_INET, SOCK_STREAM, 0);
+
+    if (listener < 0)
+      throw std::runtime_error("Failed to create collector socket");
+
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr = sockaddr_in();
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(loopback_only ? INADDR_LOOPBACK : INADDR_ANY);
+
+    socklen_t length = sizeof(addr);
+
+    if (::bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0
+        || ::listen(listener, 64) != 0
+        || getsockname(listener, (sockaddr*)&addr, &length) != 0)
+    {
+      ::close(listener);
+      throw std::runtime_error("Failed to listen on collector port");
+    }
+
+    bound_port = ntohs(addr.sin_port);
+  }
+
+  collector(const collector&) = delete;
+  collector& operator=(const collector&) = delete;
+
+  /* @brief Function to get the port the collector is listening on
+   */
+  uint16_t get_port() const
+  {
+    return bound_port;
+  }
+
+  /* @brief Function to accept connections and dispatch frames until @stop is
+   *        called
+   */
+  void run()
+  {
+    std::vector<pollfd> fds;
+    running = true;
+
+    while (running)
+    {
+      fds.clear();
+      fds.push_back(pollfd{ listener, POLLIN, 0 });
+
+      for (const auto& c : connections)
+        fds.push_back(pollfd{ c.fd, POLLIN, 0 });
+
+      if (::poll(fds.data(), fds.size(), 100) <= 0)
+        continue;
+
+      if (fds[0].revents & POLLIN)
+      {
+        int fd = ::accept(listener, nullptr, nullptr);
+
+        if (fd >= 0)
+          connections.push_back(connection{ fd,
+                                            std::vector<uint8_t>(1 << 16),
+                                            0, 0 });
+      }
+
+      // Iterate backwards so that closed connections can be erased in place;
+      // connections accepted above have no entry in fds and are skipped
+      for (size_t i = fds.size() - 1; i > 0; --i)
+      {
+        if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+          continue;
+
+        if (!receive(connections[i - 1]))
+        {
+          ::close(connections[i - 1].fd);
+          connections.erase(connections.begin() + (i - 1));
+        }
+      }
+    }
+  }
+
+  /* @brief Function to make @run return, may be called from any thread
+   */
+  void stop()
+  {
+    running = false;
+  }
+
+  ~collector()
+  {
+    for (const auto& c : connections)
+      ::close(c.fd);
+
+    ::close(listener);
+  }
+};
+
+} // namespace cyrial
+
+#endif // CYRIAL_TELEMETRY_AGENT_HPP
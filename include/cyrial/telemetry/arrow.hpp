@@ -0,0 +1,588 @@
+#ifndef CYRIAL_TELEMETRY_ARROW_HPP
+#define CYRIAL_TELEMETRY_ARROW_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sample.hpp"
+#include "series.hpp"
+
+namespace cyrial
+{
+
+/* @class flatbuffer_builder
+ *
+ * @brief Minimal FlatBuffers builder, sufficient for Arrow IPC metadata
+ *
+ * As with the reference implementation the buffer is built back to front, so
+ * children (strings, vectors, tables) must be finished before the table which
+ * refers to them is started. References returned by the builder are offsets
+ * from the end of the buffer. Bytes are stored in reverse order and flipped
+ * by finish
+ */
+class flatbuffer_builder
+{
+  std::vector<uint8_t> rev;
+  size_t minalign;
+
+  uint32_t table_start;
+  std::vector<std::pair<uint16_t, uint32_t>> fields;
+
+  void pad(size_t n)
+  {
+    rev.insert(rev.end(), n, 0);
+  }
+
+  template <typename T>
+  void put(T value)
+  {
+    uint64_t bits = (uint64_t)value;
+
+    for (size_t i = sizeof(T); i-- > 0;)
+      rev.push_back((uint8_t)(bits >> (8 * i)));
+  }
+
+public:
+  flatbuffer_builder()
+    : minalign(1), table_start(0)
+  { }
+
+  /* @brief Function to pad so that the next size bytes end on an alignment
+   *        boundary
+   */
+  void align(size_t size, size_t alignment)
+  {
+    if (alignment > minalign)
+      minalign = alignment;
+
+    pad((alignment - (rev.size() + size) % alignment) % alignment);
+  }
+
+  uint32_t ref() const
+  {
+    return rev.size();
+  }
+
+  template <typename T>
+  void scalar(T value)
+  {
+    align(sizeof(T), sizeof(T));
+    put(value);
+  }
+
+  void offset(uint32_t target)
+  {
+    align(4, 4);
+    put<uint32_t>(ref() + 4 - target);
+  }
+
+  uint32_t string(const std::string& s)
+  {
+    align(s.size() + 1, 4);
+    pad(1);
+
+    for (size_t i = s.size(); i-- > 0;)
+      rev.push_back((uint8_t)s[i]);
+
+    put<uint32_t>(s.size());
+
+    return ref();
+  }
+
+  /* @brief Function to start a vector, elements must then be added in reverse
+   *        order before calling @end_vector
+   */
+  void start_vector(size_t count, size_t elem_size, size_t alignment)
+  {
+    align(count * elem_size, 4);
+    align(count * elem_size, alignment);
+  }
+
+  uint32_t end_vector(size_t count)
+  {
+    put<uint32_t>(count);
+
+    return ref();
+  }
+
+  uint32_t offsets(const std::vector<uint32_t>& targets)
+  {
+    start_vector(targets.size(), 4, 4);
+
+    for (size_t i = targets.size(); i-- > 0;)
+      offset(targets[i]);
+
+    return end_vector(targets.size());
+  }
+
+  void start_table()
+  {
+    fields.clear();
+    table_start = ref();
+  }
+
+  template <typename T>
+  void add(uint16_t slot, T value)
+  {
+    scalar(value);
+    fields.push_back(std::make_pair(slot, ref()));
+  }
+
+  void add_offset(uint16_t slot, uint32_t target)
+  {
+    offset(target);
+    fields.push_back(std::make_pair(slot, ref()));
+  }
+
+  uint32_t end_table()
+  {
+    scalar<int32_t>(0);
+    uint32_t table = ref();
+
+    size_t n = 0;
+    for (const auto& f : fields)
+      if (f.first + 1u > n)
+        n = f.first + 1u;
+
+    std::vector<uint16_t> vtable(n, 0);
+    for (const auto& f : fields)
+      vtable[f.first] = table - f.second;
+
+    for (size_t i = n; i-- > 0;)
+      put<uint16_t>(vtable[i]);
+
+    put<uint16_t>(table - table_start);
+    put<uint16_t>(4 + 2 * n);
+
+    // Patch the table's offset to its vtable, which precedes it
+    uint32_t soffset = ref() - table;
+
+    for (size_t i = 0; i < 4; ++i)
+      rev[table - 1 - i] = (uint8_t)(soffset >> (8 * i));
+
+    return table;
+  }
+
+  /* @brief Function to complete the buffer
+   *
+   * @param root Reference to the root table
+   * @return The buffer, in memory order
+   */
+  std::vector<uint8_t> finish(uint32_t root)
+  {
+    align(4, minalign);
+    offset(root);
+
+    return std::vector<uint8_t>(rev.rbegin(), rev.rend());
+  }
+};
+
+/* @brief Output formats supported by arrow_writer
+ *
+ * ARROW_FILE   : Arrow IPC file (Feather V2), supports random access and memory
+ *                mapping
+ * ARROW_STREAM : Arrow IPC stream of record batches
+ */
+enum arrow_format { ARROW_FILE, ARROW_STREAM };
+
+/* @class arrow_writer
+ *
+ * @brief Class to export series as Arrow IPC record batches
+ *
+ * Each series becomes one record batch with the columns
+ *
+ *   time   : timestamp[ns, tz=UTC]
+ *   source : uint32
+ *   metric : dictionary<int16, utf8> (a categorical of the metric names)
+ *   value  : float64
+ *
+ * and the unit of each metric is recorded in the schema metadata under
+ * "unit.<metric name>". Time and value buffers are written directly from the
+ * series, which assumes a little endian host
+ */
+class arrow_writer
+{
+  struct block
+  {
+    int64_t offset;
+    int32_t metadata;
+    int64_t body;
+  };
+
+  std::ostream& out;
+  arrow_format format;
+  bool closed;
+
+  int64_t position;
+  std::vector<block> dictionaries;
+  std::vector<block> batches;
+
+  enum : uint8_t { TYPE_INT = 2, TYPE_FLOAT = 3, TYPE_UTF8 = 5,
+                   TYPE_TIMESTAMP = 10 };
+  enum : uint8_t { HEADER_SCHEMA = 1, HEADER_DICTIONARY = 2,
+                   HEADER_BATCH = 3 };
+  enum : int16_t { METADATA_V5 = 4 };
+
+  void write(const void* data, size_t size)
+  {
+    out.write((const char*)data, size);
+    position += size;
+  }
+
+  void write_padding(size_t size)
+  {
+    static const char zeros[8] = { 0 };
+
+    write(zeros, (8 - size % 8) % 8);
+  }
+
+  template <typename T>
+  void write_fill(T value, size_t count)
+  {
+    T chunk[512];
+
+    for (size_t i = 0; i < 512; ++i)
+      chunk[i] = value;
+
+    for (size_t i = 0; i < count; i += 512)
+      write(chunk, sizeof(T) * std::min<size_t>(512, count - i));
+
+    write_padding(sizeof(T) * count);
+  }
+
+  static size_t padded(size_t size)
+  {
+    return (size + 7) & ~(size_t)7;
+  }
+
+  static uint32_t build_int(flatbuffer_builder& fb, int32_t width, bool sign)
+  {
+    fb.start_table();
+    fb.add<int32_t>(0, width);
+    fb.add<uint8_t>(1, sign);
+
+    return fb.end_table();
+  }
+
+  static uint32_t build_field(flatbuffer_builder& fb, const std::string& name,
+      uint8_t type_type, uint32_t type, uint32_t dictionary=0)
+  {
+    uint32_t name_ref = fb.string(name);
+    uint32_t children = fb.offsets(std::vector<uint32_t>());
+
+    fb.start_table();
+    fb.add_offset(0, name_ref);
+    fb.add<uint8_t>(1, false);
+    fb.add<uint8_t>(2, type_type);
+    fb.add_offset(3, type);
+
+    if (dictionary)
+      fb.add_offset(4, dictionary);
+
+    fb.add_offset(5, children);
+
+    return fb.end_table();
+  }
+
+  static uint32_t build_schema(flatbuffer_builder& fb)
+  {
+    std::vector<uint32_t> fields;
+
+    uint32_t timezone = fb.string("UTC");
+    fb.start_table();
+    fb.add<int16_t>(0, 3); // NANOSECOND
+    fb.add_offset(1, timezone);
+    uint32_t timestamp = fb.end_table();
+    fields.push_back(build_field(fb, "time", TYPE_TIMESTAMP, timestamp));
+
+    uint32_t uint32 = build_int(fb, 32, false);
+    fields.push_back(build_field(fb, "source", TYPE_INT, uint32));
+
+    uint32_t index = build_int(fb, 16, true);
+    fb.start_table();
+    fb.add<int64_t>(0, 0); // Dictionary id
+    fb.add_offset(1, index);
+    uint32_t encoding = fb.end_table();
+    fb.start_table();
+    uint32_t utf8 = fb.end_table();
+    fields.push_back(build_field(fb, "metric", TYPE_UTF8, utf8, encoding));
+
+    fb.start_table();
+    fb.add<int16_t>(0, 2); // DOUBLE
+    uint32_t float64 = fb.end_table();
+    fields.push_back(build_field(fb, "value", TYPE_FLOAT, float64));
+
+    std::vector<uint32_t> metadata;
+
+    for (const auto& info : metric_table)
+    {
+      if (!*info.unit)
+        continue;
+
+      uint32_t key = fb.string(std::string("unit.") + info.name);
+      uint32_t value = fb.string(info.unit);
+
+      fb.start_table();
+      fb.add_offset(0, key);
+      fb.add_offset(1, value);
+      metadata.push_back(fb.end_table());
+    }
+
+    uint32_t field_vector = fb.offsets(fields);
+    uint32_t metadata_vector = fb.offsets(metadata);
+
+    fb.start_table();
+    fb.add<int16_t>(0, 0); // Little endian
+    fb.add_offset(1, field_vector);
+    fb.add_offset(2, metadata_vector);
+
+    return fb.end_table();
+  }
+
+  /* @brief Function to build a RecordBatch table
+   *
+   * @param rows Number of rows in the batch
+   * @param nodes Number of columns
+   * @param buffers Buffer lengths, in body order (unpadded)
+   */
+  static uint32_t build_batch(flatbuffer_builder& fb, int64_t rows,
+      size_t nodes, const std::vector<int64_t>& buffers)
+  {
+    fb.start_vector(nodes, 16, 8);
+    for (size_t i = 0; i < nodes; ++i)
+    {
+      fb.scalar<int64_t>(0);    // null_count
+      fb.scalar<int64_t>(rows); // length
+    }
+    uint32_t node_vector = fb.end_vector(nodes);
+
+    std::vector<int64_t> offsets(buffers.size());
+    for (size_t i = 1; i < buffers.size(); ++i)
+      offsets[i] = offsets[i - 1] + padded(buffers[i - 1]);
+
+    fb.start_vector(buffers.size(), 16, 8);
+    for (size_t i = buffers.size(); i-- > 0;)
+    {
+      fb.scalar<int64_t>(buffers[i]);
+      fb.scalar<int64_t>(offsets[i]);
+    }
+    uint32_t buffer_vector = fb.end_vector(buffers.size());
+
+    fb.start_table();
+    fb.add<int64_t>(0, rows);
+    fb.add_offset(1, node_vector);
+    fb.add_offset(2, buffer_vector);
+
+    return fb.end_table();
+  }
+
+  /* @brief Function to write an encapsulated message header
+   *
+   * @return The length of the metadata including its prefix and padding
+   */
+  int32_t write_message(flatbuffer_builder& fb, uint8_t header_type,
+      uint32_t header, int64_t body_length)
+  {
+    fb.start_table();
+    fb.add<int16_t>(0, METADATA_V5);
+    fb.add<uint8_t>(1, header_type);
+    fb.add_offset(2, header);
+    fb.add<int64_t>(3, body_length);
+
+    std::vector<uint8_t> metadata = fb.finish(fb.end_table());
+    int32_t length = padded(metadata.size());
+
+    const uint32_t continuation = 0xffffffff;
+    write(&continuation, 4);
+    write(&length, 4);
+    write(metadata.data(), metadata.size());
+    write_padding(metadata.size());
+
+    return length + 8;
+  }
+
+  void write_schema()
+  {
+    if (format == ARROW_FILE)
+      write("ARROW1\0\0", 8);
+
+    flatbuffer_builder fb;
+    write_message(fb, HEADER_SCHEMA, build_schema(fb), 0);
+
+    // The metric dictionary holds the names of all metrics, indexed by id
+    std::vector<int32_t> offsets(1, 0);
+    std::string names;
+
+    for (const auto& info : metric_table)
+    {
+      names += info.name;
+      offsets.push_back(names.size());
+    }
+
+    std::vector<int64_t> buffers = { 0, (int64_t)offsets.size() * 4,
+                                     (int64_t)names.size() };
+    int64_t body = padded(buffers[1]) + padded(buffers[2]);
+
+    flatbuffer_builder dfb;
+    uint32_t data = build_batch(dfb, metric_table.size(), 1, buffers);
+    dfb.start_table();
+    dfb.add<int64_t>(0, 0);
+    dfb.add_offset(1, data);
+    uint32_t dictionary = dfb.end_table();
+
+    block b = { position, 0, body };
+    b.metadata = write_message(dfb, HEADER_DICTIONARY, dictionary, body);
+    dictionaries.push_back(b);
+
+    write(offsets.data(), buffers[1]);
+    write_padding(buffers[1]);
+    write(names.data(), names.size());
+    write_padding(names.size());
+  }
+
+public:
+  /* @brief Constructor for arrow_writer, writes the schema immediately
+   *
+   * @param output Stream to write to, which must be opened in binary mode
+   * @param f Whether to produce an IPC file or an IPC stream
+   */
+  arrow_writer(std::ostream& output, arrow_format f=ARROW_FILE)
+    : out(output), format(f), closed(false), position(0)
+  {
+    write_schema();
+  }
+
+  arrow_writer(const arrow_writer&) = delete;
+  arrow_writer& operator=(const arrow_writer&) = delete;
+
+  /* @brief Function to write a series as a record batch
+   *
+   * @param key The device and metric the series belongs to
+   * @param s The series
+   */
+  void write(const series_key& key, const series& s)
+  {
+    if (closed)
+      throw std::runtime_error("Arrow writer already closed");
+
+    int64_t rows = s.size();
+
+    if (rows == 0)
+      return;
+
+    std::vector<int64_t> buffers = { 0, rows * 8, 0, rows * 4, 0, rows * 2,
+                                     0, rows * 8 };
+    int64_t body = 0;
+
+    for (auto length : buffers)
+      body += padded(length);
+
+    flatbuffer_builder fb;
+    uint32_t batch = build_batch(fb, rows, 4, buffers);
+
+    block b = { position, 0, body };
+    b.metadata = write_message(fb, HEADER_BATCH, batch, body);
+    batches.push_back(b);
+
+    write(s.time.data(), rows * 8);
+    write_fill<uint32_t>(key.source, rows);
+    write_fill<int16_t>(key.metric, rows);
+    write(s.value.data(), rows * 8);
+  }
+
+  /* @brief Function to write every series of a store
+   */
+  void write(const series_store& store)
+  {
+    for (const auto& entry : store)
+      write(entry.first, entry.second);
+  }
+
+  /* @brief Function to write the end of stream marker and, for files, the
+   *        footer. Called by the destructor if not called explicitly
+   */
+  void close()
+  {
+    if (closed)
+      return;
+
+    closed = true;
+
+    const uint32_t eos[2] = { 0xffffffff, 0 };
+    write(eos, 8);
+
+    if (format == ARROW_FILE)
+    {
+      flatbuffer_builder fb;
+      uint32_t schema = build_schema(fb);
+      uint32_t refs[2];
+
+      const std::vector<block>* lists[2] = { &dictionaries, &batches };
+
+      for (size_t l = 0; l < 2; ++l)
+      {
+        const std::vector<block>& blocks = *lists[l];
+
+        fb.start_vector(blocks.size(), 24, 8);
+        for (size_t i = blocks.size(); i-- > 0;)
+        {
+          fb.scalar<int64_t>(blocks[i].body);
+          fb.scalar<int32_t>(0);
+          fb.scalar<int32_t>(blocks[i].metadata);
+          fb.scalar<int64_t>(blocks[i].offset);
+        }
+        refs[l] = fb.end_vector(blocks.size());
+      }
+
+      fb.start_table();
+      fb.add<int16_t>(0, METADATA_V5);
+      fb.add_offset(1, schema);
+      fb.add_offset(2, refs[0]);
+      fb.add_offset(3, refs[1]);
+
+      std::vector<uint8_t> footer = fb.finish(fb.end_table());
+      int32_t length = footer.size();
+
+      write(footer.data(), footer.size());
+      write(&length, 4);
+      write("ARROW1", 6);
+    }
+
+    out.flush();
+  }
+
+  ~arrow_writer()
+  {
+    close();
+  }
+};
+
+/* @brief Function to export a series store to an Arrow IPC (Feather V2) file
+ *
+ * @param store The series to export
+ * @param path Location of the file to create
+ * @param f Whether to produce an IPC file or an IPC stream
+ */
+inline void export_arrow(const series_store& store, const std::string& path,
+    arrow_format f=ARROW_FILE)
+{
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+  if (!file)
+    throw std::runtime_error("Failed to open " + path);
+
+  arrow_writer writer(file, f);
+  writer.write(store);
+  writer.close();
+}
+
+} // namespace cyrial
+
+#endif // CYRIAL_TELEMETRY_ARROW_HPP
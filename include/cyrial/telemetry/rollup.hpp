@@ -0,0 +1,343 @@
+#ifndef CYRIAL_TELEMETRY_ROLLUP_HPP
+#define CYRIAL_TELEMETRY_ROLLUP_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
+#include <vector>
+
+#include "sample.hpp"
+#include "series.hpp"
+
+namespace cyrial
+{
+
+/* @struct aggregate
+ *
+ * @brief Summary statistics of the samples in one window
+ *
+ * The mean and variance are maintained with Welford's method, so windows can
+ * be updated one sample at a time and merged without loss of precision
+ */
+struct aggregate
+{
+  uint64_t start;       // Start of the window, ns since the Unix epoch
+  uint64_t count;
+  double min;
+  double max;
+  double mean;
+  double m2;            // Sum of squared differences from the mean
+  double first;
+  double last;
+  uint64_t first_time;
+  uint64_t last_time;
+
+  /* @brief Function to reset the aggregate to an empty window
+   *
+   * @param window_start Start of the window
+   */
+  void reset(uint64_t window_start)
+  {
+    start = window_start;
+    count = 0;
+    min = std::numeric_limits<double>::infinity();
+    max = -std::numeric_limits<double>::infinity();
+    mean = m2 = first = last = 0.0;
+    first_time = last_time = 0;
+  }
+
+  /* @brief Function to add a sample to the window
+   *
+   * @param time The time of the sample
+   * @param value The value of the sample
+   */
+  void add(uint64_t time, double value)
+  {
+    ++count;
+
+    double delta = value - mean;
+    mean += delta / count;
+    m2 += delta * (value - mean);
+
+    if (value < min) min = value;
+    if (value > max) max = value;
+
+    if (count == 1 || time < first_time)
+    {
+      first = value;
+      first_time = time;
+    }
+
+    if (count == 1 || time >= last_time)
+    {
+      last = value;
+      last_time = time;
+    }
+  }
+
+  /* @brief Function to combine another window into this one
+   *
+   * @param other The window to merge
+   */
+  void merge(const aggregate& other)
+  {
+    if (other.count == 0)
+      return;
+
+    if (count == 0)
+    {
+      uint64_t s = start;
+      *this = other;
+      start = s;
+      return;
+    }
+
+    uint64_t n = count + other.count;
+    double delta = other.mean - mean;
+
+    mean += delta * other.count / n;
+    m2 += other.m2 + delta * delta * ((double)count * other.count / n);
+    count = n;
+
+    if (other.min < min) min = other.min;
+    if (other.max > max) max = other.max;
+
+    if (other.first_time < first_time)
+    {
+      first = other.first;
+      first_time = other.first_time;
+    }
+
+    if (other.last_time >= last_time)
+    {
+      last = other.last;
+      last_time = other.last_time;
+    }
+  }
+
+  /* @brief Function to get the sample variance of the window
+   */
+  double variance() const
+  {
+    return count > 1 ? m2 / (count - 1) : 0.0;
+  }
+
+  /* @brief Function to get the sample standard deviation of the window
+   */
+  double stddev() const
+  {
+    return std::sqrt(variance());
+  }
+};
+
+/* @struct rollup_level
+ *
+ * @brief Resolution of a rollup and how many closed windows to retain
+ */
+struct rollup_level
+{
+  uint64_t resolution;  // Window length in ns
+  size_t retain;        // Closed windows retained per series, 0 for none
+};
+
+/* @brief The default levels: 1 minute for a day, 1 hour for a month, and
+ *        1 day for a year
+ */
+inline std::vector<rollup_level> default_rollup_levels()
+{
+  const uint64_t minute = 60000000000ull;
+
+  return { { minute, 1440 }, { 60 * minute, 744 }, { 1440 * minute, 366 } };
+}
+
+/* @class rollup
+ *
+ * @brief Class to maintain windowed aggregates of every series as samples
+ *        arrive
+ *
+ * Each sample updates the open window of every level of its series in O(1).
+ * A window is closed when a sample for a later window arrives or when @advance
+ * is called, at which point it is retained for @query and passed to the close
+ * handler (e.g. to be persisted). Samples older than the open window of a
+ * level are counted as late and otherwise ignored by that level
+ */
+class rollup : public sample_sink
+{
+public:
+  typedef std::function<void(const series_key&, size_t level,
+                             const aggregate&)> close_handler;
+
+private:
+  struct level_state
+  {
+    aggregate open;
+    std::deque<aggregate> closed;
+  };
+
+  std::vector<rollup_level> levels;
+  close_handler on_close;
+
+  std::map<series_key, std::vector<level_state>> state;
+  uint64_t late;
+
+  void close(const series_key& key, size_t level, level_state& ls)
+  {
+    if (ls.open.count == 0)
+      return;
+
+    if (on_close)
+      on_close(key, level, ls.open);
+
+    if (levels[level].retain)
+    {
+      ls.closed.push_back(ls.open);
+
+      if (ls.closed.size() > levels[level].retain)
+        ls.closed.pop_front();
+    }
+  }
+
+public:
+  /* @brief Constructor for rollup
+   *
+   * @param lv The window lengths to maintain, finest first
+   * @param handler Function to call with each closed window
+   */
+  rollup(const std::vector<rollup_level>& lv=default_rollup_levels(),
+      close_handler handler=close_handler())
+    : levels(lv), on_close(handler), late(0)
+  { }
+
+  void push(const sample& s) override
+  {
+    series_key key{ s.source, s.metric };
+    auto it = state.find(key);
+
+    if (it == state.end())
+    {
+      it = state.insert(std::make_pair(key,
+                        std::vector<level_state>(levels.size()))).first;
+
+      for (size_t i = 0; i < levels.size(); ++i)
+        it->second[i].open.reset(s.time - s.time % levels[i].resolution);
+    }
+
+    for (size_t i = 0; i < levels.size(); ++i)
+    {
+      level_state& ls = it->second[i];
+      uint64_t start = s.time - s.time % levels[i].resolution;
+
+      if (start > ls.open.start)
+      {
+        close(key, i, ls);
+        ls.open.reset(start);
+      }
+      else if (start < ls.open.start)
+      {
+        ++late;
+        continue;
+      }
+
+      ls.open.add(s.time, s.value);
+    }
+  }
+
+  /* @brief Function to close every window which ends at or before a time,
+   *        so that quiet series still produce their rollups
+   *
+   * @param now The current time, ns since the Unix epoch
+   */
+  void advance(uint64_t now)
+  {
+    for (auto& entry : state)
+      for (size_t i = 0; i < levels.size(); ++i)
+      {
+        level_state& ls = entry.second[i];
+
+        if (ls.open.start + levels[i].resolution <= now)
+        {
+          close(entry.first, i, ls);
+          ls.open.reset(now - now % levels[i].resolution);
+        }
+      }
+  }
+
+  /* @brief Function to get the retained windows of a series which start
+   *        within a time range, including the open window
+   *
+   * @param source The device
+   * @param metric The metric
+   * @param level Index of the level
+   * @param t0 Start of the range (inclusive), ns since the Unix epoch
+   * @param t1 End of the range (inclusive), ns since the Unix epoch
+   * @return The windows in time order
+   */
+  std::vector<aggregate> query(uint32_t source, uint16_t metric, size_t level,
+      uint64_t t0, uint64_t t1) const
+  {
+    std::vector<aggregate> result;
+    auto it = state.find(series_key{ source, metric });
+
+    if (it == state.end() || level >= levels.size())
+      return result;
+
+    const level_state& ls = it->second[level];
+
+    auto first = std::lower_bound(ls.closed.begin(), ls.closed.end(), t0,
+      [](const aggregate& a, uint64_t t) { return a.start < t; });
+
+    for (; first != ls.closed.end() && first->start <= t1; ++first)
+      result.push_back(*first);
+
+    if (ls.open.count && ls.open.start >= t0 && ls.open.start <= t1)
+      result.push_back(ls.open);
+
+    return result;
+  }
+
+  /* @brief Function to summarise a series over a time range using the
+   *        coarsest level whose windows fit within it
+   *
+   * Windows which only partially overlap the range are included, so the
+   * result may cover up to one window more at each end
+   */
+  aggregate summary(uint32_t source, uint16_t metric, uint64_t t0,
+      uint64_t t1) const
+  {
+    size_t level = 0;
+
+    for (size_t i = 0; i < levels.size(); ++i)
+      if (levels[i].resolution <= t1 - t0)
+        level = i;
+
+    aggregate result;
+    result.reset(t0 - t0 % levels[level].resolution);
+
+    for (const auto& a : query(source, metric, level,
+                               t0 - t0 % levels[level].resolution, t1))
+      result.merge(a);
+
+    return result;
+  }
+
+  /* @brief Function to get the number of samples which arrived after their
+   *        window had been closed, summed over levels
+   */
+  uint64_t late_samples() const
+  {
+    return late;
+  }
+
+  const std::vector<rollup_level>& get_levels() const
+  {
+    return levels;
+  }
+};
+
+} // namespace cyrial
+
+#endif // CYRIAL_TELEMETRY_ROLLUP_HPP
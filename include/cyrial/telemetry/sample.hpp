@@ -0,0 +1,249 @@
+#ifndef CYRIAL_TELEMETRY_SAMPLE_HPP
+#define CYRIAL_TELEMETRY_SAMPLE_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "../channel.hpp"
+
+namespace cyrial
+{
+
+/* @brief Identifiers for the numeric quantities which can be parsed out of
+ *        device responses
+ *
+ * Values are part of the wire and storage formats, so new metrics must only
+ * ever be appended before metric_count
+ */
+enum metric : uint16_t
+{
+  gps_sat_tracked,   // Number of tracked SV's
+  gps_sat_visible,   // Number of SV's visible per the almanac
+  sync_tint,         // Shift between GPSDO and GPS time
+  sync_fee,          // Frequency error estimate
+  sync_lock,         // PLL lock status (0: OFF)
+  sync_health,       // Health status bit field
+  sync_sour_state,   // Synchronization source, see source_state
+  sync_hold_dur,     // Duration of the most recent holdover
+  efc_rel,           // Electronic frequency control value
+  efc_abs,           // Electronic frequency control voltage
+  pps_offset,        // 1PPS offset to UTC
+  csac_status,       // CSAC unit status
+  csac_alarm,        // CSAC alarm bit field
+  csac_mode,         // CSAC operating mode bit field
+  csac_contrast,     // CSAC signal contrast
+  csac_laser_i,      // CSAC laser current
+  csac_tcxo,         // CSAC TCXO tuning voltage
+  csac_heat_p,       // CSAC physics package heater power
+  csac_signal,       // CSAC signal level
+  csac_temp,         // CSAC temperature
+  csac_steer,        // CSAC frequency steer
+  csac_phase,        // CSAC 1PPS phase difference
+  ubx_noise,         // UBX-MON-HW noise level
+  ubx_agc,           // UBX-MON-HW AGC monitor
+  ubx_jamming,       // UBX-MON-HW CW jamming indicator
+  query_latency,     // Round trip time of a device query
+  metric_count
+};
+
+/* @brief Wildcards for selecting samples from any device or of any metric
+ */
+const uint32_t any_source = 0xffffffff;
+const uint16_t any_metric = 0xffff;
+
+/* @brief Values reported by the sync_sour_state metric
+ */
+enum source_state : uint8_t { SRC_GPS, SRC_EXT, SRC_HOLD, SRC_NONE };
+
+/* @struct metric_info
+ *
+ * @brief Static description of a metric, used when exporting data
+ */
+struct metric_info
+{
+  const char* name;
+  const char* unit;
+};
+
+const std::array<metric_info, metric_count> metric_table{ {
+  { "gps_sat_tracked", ""    },
+  { "gps_sat_visible", ""    },
+  { "sync_tint",       "s"   },
+  { "sync_fee",        ""    },
+  { "sync_lock",       ""    },
+  { "sync_health",     ""    },
+  { "sync_sour_state", ""    },
+  { "sync_hold_dur",   "s"   },
+  { "efc_rel",         "%"   },
+  { "efc_abs",         "V"   },
+  { "pps_offset",      "ns"  },
+  { "csac_status",     ""    },
+  { "csac_alarm",      ""    },
+  { "csac_mode",       ""    },
+  { "csac_contrast",   ""    },
+  { "csac_laser_i",    "mA"  },
+  { "csac_tcxo",       "V"   },
+  { "csac_heat_p",     "mW"  },
+  { "csac_signal",     "V"   },
+  { "csac_temp",       "degC"},
+  { "csac_steer",      "pp10^15" },
+  { "csac_phase",      "ns"  },
+  { "ubx_noise",       ""    },
+  { "ubx_agc",         ""    },
+  { "ubx_jamming",     ""    },
+  { "query_latency",   "s"   }
+} };
+
+/* @struct sample
+ *
+ * @brief A single parsed measurement
+ *
+ * time is in nanoseconds since the Unix epoch and source identifies the device
+ * which produced the measurement (typically the index of its port)
+ */
+struct sample
+{
+  uint64_t time;
+  uint32_t source;
+  uint16_t metric;
+  double value;
+};
+
+/* @class sample_sink
+ *
+ * @brief Interface for consumers of parsed samples
+ */
+class sample_sink
+{
+public:
+  virtual ~sample_sink() { }
+
+  /* @brief Function to consume a sample
+   *
+   * @param s The sample
+   */
+  virtual void push(const sample& s) = 0;
+};
+
+/* @class channel_sink
+ *
+ * @brief Sink queueing samples in a bounded channel, so that a consumer on
+ *        another thread which falls behind costs bounded memory rather than
+ *        stalling the sampler
+ */
+class channel_sink : public sample_sink
+{
+  channel<sample> queue;
+
+public:
+  /* @brief Constructor for channel_sink, see channel
+   */
+  channel_sink(size_t capacity=4096,
+               channel_policy overflow=CHANNEL_DROP_OLDEST, size_t every=10)
+    : queue(capacity, overflow, every)
+  { }
+
+  void push(const sample& s)
+  {
+    queue.push(s);
+  }
+
+  /* @brief Function to get the channel, to consume samples from it and read
+   *        its counters
+   */
+  channel<sample>& samples()
+  {
+    return queue;
+  }
+};
+
+/* @brief Function to get the current time in the representation used by
+ *        sample
+ *
+ * @return Nanoseconds since the Unix epoch
+ */
+inline uint64_t now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/* @brief Function to extract a numeric value from a device response
+ *
+ * Responses may contain the echoed command, a prompt, and several lines, so
+ * the value of the first line which begins with a number is used. Hex values
+ * (e.g. the GPSDO health status) are accepted
+ *
+ * @param begin Start of the device response
+ * @param end End of the device response
+ * @param value Set to the parsed value on success
+ * @return Whether a value was found
+ */
+inline bool parse_number(const char* begin, const char* end, double& value)
+{
+  const char* pos = begin;
+
+  while (pos < end)
+  {
+    const char* line_end = pos;
+
+    while (line_end < end && *line_end != '\r' && *line_end != '\n')
+      ++line_end;
+
+    const char* start = pos;
+
+    while (start < line_end && (*start == ' ' || *start == '\t'))
+      ++start;
+
+    if (start < line_end)
+    {
+      char c = *start;
+
+      if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.')
+      {
+        // Copy so that strtod cannot read beyond the line, onto the stack as
+        // this runs for every polled value
+        char line[64];
+        size_t length = std::min<size_t>(line_end - start, sizeof(line) - 1);
+
+        std::memcpy(line, start, length);
+        line[length] = '\0';
+
+        char* last = nullptr;
+        double v = std::strtod(line, &last);
+
+        if (last != line)
+        {
+          value = v;
+          return true;
+        }
+      }
+    }
+
+    pos = line_end + 1;
+  }
+
+  return false;
+}
+
+/* @brief Function to extract a numeric value from a device response, see
+ *        @parse_number
+ *
+ * @param response The device response
+ * @param value Set to the parsed value on success
+ * @return Whether a value was found
+ */
+inline bool parse_number(const std::string& response, double& value)
+{
+  return parse_number(response.data(), response.data() + response.size(),
+                      value);
+}
+
+} // namespace cyrial
+
+#endif // CYRIAL_TELEMETRY_SAMPLE_HPP
@@ -0,0 +1,286 @@
+#ifndef CYRIAL_TELEMETRY_SAMPLER_HPP
+#define CYRIAL_TELEMETRY_SAMPLER_HPP
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "sample.hpp"
+#include "../trace.hpp"
+#include "../devices/gpsdo.hpp"
+#include "../devices/csac.hpp"
+#include "../devices/ubx.hpp"
+
+namespace cyrial
+{
+
+/* @brief Function to map the response of SYNC:SOUR:STATE? onto source_state
+ *
+ * @param response The device response
+ * @param state Set to the corresponding source_state
+ * @return Whether the response named a state; false on a timeout or an
+ *         unrecognised response, which must not be mistaken for SRC_NONE
+ */
+inline bool parse_source_state(const std::string& response,
+    source_state& state)
+{
+  if      (response.find("HOLD") != std::string::npos) state = SRC_HOLD;
+  else if (response.find("EXT" ) != std::string::npos) state = SRC_EXT;
+  else if (response.find("GPS" ) != std::string::npos) state = SRC_GPS;
+  else if (response.find("NONE") != std::string::npos) state = SRC_NONE;
+  else
+    return false;
+
+  return true;
+}
+
+/* @brief Function to parse a response and append it to a list of samples
+ *
+ * @param out The list of samples
+ * @param response The device response
+ * @param source Identifier of the device which produced the response
+ * @param m The metric which the response represents
+ * @param time The time at which the response was received
+ * @return Whether a value was parsed from the response
+ */
+inline bool append_sample(std::vector<sample>& out, const std::string& response,
+    uint32_t source, metric m, uint64_t time)
+{
+  CYRIAL_TRACE_SPAN("parse", source);
+  double value;
+
+  if (!parse_number(response, value))
+    return false;
+
+  out.push_back(sample{ time, source, m, value });
+
+  return true;
+}
+
+/* @brief Function to poll the numeric status of a GPSDO
+ *
+ * @param dev The GPSDO to poll
+ * @param source Identifier to attach to the samples
+ * @param out The list to which samples are appended
+ */
+inline void sample_gpsdo(gpsdo_device& dev, uint32_t source,
+    std::vector<sample>& out)
+{
+  namespace c = gpsdo_command;
+
+  // Responses are parsed in place in the port's receive buffer, so once out
+  // has grown to hold a poll this does not allocate
+  uint64_t start = now_ns();
+  const std::string& tint = dev.scpi_view(c::sync_tint);
+  uint64_t time = now_ns();
+
+  if (append_sample(out, tint, source, metric::sync_tint, time))
+    out.push_back(sample{ time, source, metric::query_latency,
+                          (time - start) * 1e-9 });
+
+  append_sample(out, dev.scpi_view(c::sync_fee), source, metric::sync_fee,
+                now_ns());
+  append_sample(out, dev.scpi_view(c::sync_lock), source, metric::sync_lock,
+                now_ns());
+  append_sample(out, dev.scpi_view(c::sync_health), source,
+                metric::sync_health, now_ns());
+  append_sample(out, dev.scpi_view(c::diag_rosc_efc_abs), source,
+                metric::efc_abs, now_ns());
+  append_sample(out, dev.scpi_view(c::diag_rosc_efc_rel), source,
+                metric::efc_rel, now_ns());
+  append_sample(out, dev.scpi_view(c::gps_sat_tra_coun), source,
+                metric::gps_sat_tracked, now_ns());
+  append_sample(out, dev.scpi_view(c::gps_sat_vis_coun), source,
+                metric::gps_sat_visible, now_ns());
+
+  source_state state;
+
+  if (parse_source_state(dev.scpi_view(c::sync_sour_state), state))
+    out.push_back(sample{ now_ns(), source, metric::sync_sour_state,
+                          (double)state });
+}
+
+/* @brief Function to map a CSAC telemetry column name onto a metric
+ *
+ * @param name Column name as reported by @csac_device::telemetry_header
+ * @param length Length of the name
+ * @return The metric, or metric_count if the column is not numeric
+ */
+inline metric csac_column(const char* name, size_t length)
+{
+  static const struct { const char* name; metric m; } columns[] = {
+    { "Status",   metric::csac_status   },
+    { "Alarm",    metric::csac_alarm    },
+    { "Mode",     metric::csac_mode     },
+    { "Contrast", metric::csac_contrast },
+    { "LaserI",   metric::csac_laser_i  },
+    { "TCXO",     metric::csac_tcxo     },
+    { "HeatP",    metric::csac_heat_p   },
+    { "Sig",      metric::csac_signal   },
+    { "Temp",     metric::csac_temp     },
+    { "Steer",    metric::csac_steer    },
+    { "Phase",    metric::csac_phase    }
+  };
+
+  for (const auto& c : columns)
+    if (std::strlen(c.name) == length
+        && std::strncmp(name, c.name, length) == 0)
+      return c.m;
+
+  return metric::metric_count;
+}
+
+/* @brief Function to parse CSAC telemetry into samples
+ *
+ * @param header The telemetry header (CSV column names)
+ * @param data The telemetry data (CSV)
+ * @param source Identifier to attach to the samples
+ * @param time The time at which the telemetry was received
+ * @param out The list to which samples are appended
+ */
+inline void parse_csac_telemetry(const std::string& header,
+    const std::string& data, uint32_t source, uint64_t time,
+    std::vector<sample>& out)
+{
+  size_t h = header.find_first_not_of("\r\n ");
+  size_t d = data.find_first_not_of("\r\n ");
+
+  while (h != std::string::npos && d != std::string::npos)
+  {
+    size_t h_end = header.find_first_of(",\r\n", h);
+    size_t d_end = data.find_first_of(",\r\n", d);
+
+    if (h_end == std::string::npos)
+      h_end = header.size();
+
+    if (d_end == std::string::npos)
+      d_end = data.size();
+
+    double value;
+    metric m = csac_column(header.data() + h, h_end - h);
+
+    if (m != metric::metric_count
+        && parse_number(data.data() + d, data.data() + d_end, value))
+      out.push_back(sample{ time, source, m, value });
+
+    if (h_end == header.size() || header[h_end] != ','
+        || d_end == data.size() || data[d_end] != ',')
+      break;
+
+    h = h_end + 1;
+    d = d_end + 1;
+  }
+}
+
+/* @brief Function to poll the telemetry of a CSAC
+ *
+ * The header only changes with firmware, so callers should query it once and
+ * reuse it across calls
+ *
+ * @param dev The CSAC to poll
+ * @param header The telemetry header previously returned by the device
+ * @param source Identifier to attach to the samples
+ * @param out The list to which samples are appended
+ */
+inline void sample_csac(csac_device& dev, const std::string& header,
+    uint32_t source, std::vector<sample>& out)
+{
+  parse_csac_telemetry(header, dev.telemetry_view(), source, now_ns(), out);
+}
+
+/* @brief Function to parse the hex output of UBX-MON-HW into samples
+ *
+ * @param hex The response of @ubx_device::ubx_mon_hw
+ * @param source Identifier to attach to the samples
+ * @param time The time at which the response was received
+ * @param out The list to which samples are appended
+ */
+inline void parse_ubx_mon_hw(const std::string& hex, uint32_t source,
+    uint64_t time, std::vector<sample>& out)
+{
+  // Locate the header: sync chars, class 0x0a, id 0x09, length 60
+  size_t pos = hex.find("b5620a093c00");
+
+  // Payload offsets are doubled as the input contains two chars per byte
+  if (pos == std::string::npos || hex.size() < pos + 12 + 2 * 60)
+    return;
+
+  auto byte = [&](size_t offset) -> unsigned
+  {
+    return std::stoul(hex.substr(pos + 12 + 2 * offset, 2), nullptr, 16);
+  };
+
+  out.push_back(sample{ time, source, metric::ubx_noise,
+                        (double)(byte(16) | byte(17) << 8) });
+  out.push_back(sample{ time, source, metric::ubx_agc,
+                        (double)(byte(18) | byte(19) << 8) });
+  out.push_back(sample{ time, source, metric::ubx_jamming,
+                        (double)byte(45) });
+}
+
+/* @brief Function to poll the numeric status of a GPSDO, see @sample_gpsdo
+ */
+inline void sample_device(gpsdo_device& dev, uint32_t source,
+    std::vector<sample>& out)
+{
+  sample_gpsdo(dev, source, out);
+}
+
+/* @brief Function to poll the hardware status of a u-blox receiver
+ *
+ * @param dev The receiver to poll
+ * @param source Identifier to attach to the samples
+ * @param out The list to which samples are appended
+ */
+inline void sample_device(ubx_device& dev, uint32_t source,
+    std::vector<sample>& out)
+{
+  expected<std::string> hex = dev.try_ubx_mon_hw();
+
+  if (hex)
+    parse_ubx_mon_hw(*hex, source, now_ns(), out);
+}
+
+/* @class monitored
+ *
+ * @brief Telemetry mixin adding a @poll function to a device class
+ *
+ * The device is polled through the @sample_device overload for its type,
+ * which is resolved at compile time
+ *
+ * @tparam Device The device class, e.g. gpsdo_device
+ */
+template <typename Device>
+class monitored : public Device
+{
+  uint32_t id;
+
+public:
+  /* @brief Constructor for monitored
+   *
+   * @param port A shared_ptr to a communication interface
+   * @param source Identifier to attach to the samples
+   */
+  monitored(std::shared_ptr<interface> port, uint32_t source)
+    : Device(port), id(source)
+  { }
+
+  uint32_t source() const
+  {
+    return id;
+  }
+
+  /* @brief Function to poll the device
+   *
+   * @param out The list to which samples are appended
+   */
+  void poll(std::vector<sample>& out)
+  {
+    sample_device(static_cast<Device&>(*this), id, out);
+  }
+};
+
+} // namespace cyrial
+
+#endif // CYRIAL_TELEMETRY_SAMPLER_HPP
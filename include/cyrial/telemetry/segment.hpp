@@ -0,0 +1,693 @@
+#ifndef CYRIAL_TELEMETRY_SEGMENT_HPP
+#define CYRIAL_TELEMETRY_SEGMENT_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sample.hpp"
+#include "wire.hpp"
+
+namespace cyrial
+{
+
+/* Segment file format
+ *
+ *   "CYSEG" <version> 0 0        8 byte header
+ *   <block>*                     wire frames (see wire.hpp), each sorted by
+ *                                time
+ *   <index entry>*               one per block, see segment_block
+ *   <index offset>               uint64
+ *   <index entries>              uint32
+ *   "CYIX"
+ *
+ * All integers are little endian. A segment which was not closed has no
+ * index; readers rebuild it by scanning the blocks
+ */
+
+const uint8_t segment_version = 1;
+const size_t segment_header_size = 8;
+const size_t segment_trailer_size = 16;
+const size_t segment_entry_size = 48;
+
+/* @struct segment_block
+ *
+ * @brief Index entry describing one block of a segment
+ */
+struct segment_block
+{
+  uint64_t offset;     // Position of the frame in the file
+  uint32_t size;       // Size of the frame
+  uint32_t count;      // Number of samples
+  uint64_t min_time;
+  uint64_t max_time;
+  uint32_t min_source;
+  uint32_t max_source;
+  uint64_t metrics;    // Bit n is set if metric n occurs in the block
+
+  /* @brief Function to check whether the block may contain samples from a
+   *        source and metric
+   */
+  bool may_contain(uint32_t source, uint16_t metric) const
+  {
+    return (source == any_source
+            || (source >= min_source && source <= max_source))
+      && (metric == any_metric || metric >= 64 || (metrics >> metric & 1));
+  }
+
+  void add(const sample& s)
+  {
+    if (count++ == 0)
+    {
+      min_time = max_time = s.time;
+      min_source = max_source = s.source;
+    }
+
+    min_time = std::min(min_time, s.time);
+    max_time = std::max(max_time, s.time);
+    min_source = std::min(min_source, s.source);
+    max_source = std::max(max_source, s.source);
+
+    if (s.metric < 64)
+      metrics |= (uint64_t)1 << s.metric;
+  }
+};
+
+inline void put_le(std::vector<uint8_t>& out, uint64_t value, size_t bytes)
+{
+  for (size_t i = 0; i < bytes; ++i)
+    out.push_back((uint8_t)(value >> (8 * i)));
+}
+
+inline uint64_t get_le(const uint8_t* data, size_t bytes)
+{
+  uint64_t value = 0;
+
+  for (size_t i = 0; i < bytes; ++i)
+    value |= (uint64_t)data[i] << (8 * i);
+
+  return value;
+}
+
+/* @class segment_writer
+ *
+ * @brief Class to persist samples into a segment file
+ *
+ * Samples are buffered into blocks of block_size samples, which are sorted by
+ * time before being written. Samples should arrive in roughly increasing time
+ * order for queries to touch as few blocks as possible
+ */
+class segment_writer : public sample_sink
+{
+  std::ofstream file;
+  uint64_t position;
+  size_t block_size;
+
+  std::vector<sample> pending;
+  std::vector<segment_block> index;
+  batch_writer writer;
+
+  void write(const uint8_t* data, size_t size)
+  {
+    file.write((const char*)data, size);
+    position += size;
+  }
+
+public:
+  /* @brief Constructor for segment_writer
+   *
+   * @param path Location of the segment file to create
+   * @param samples_per_block Number of samples per block; smaller blocks make
+   *        narrow queries cheaper at the expense of a larger index
+   */
+  segment_writer(const std::string& path, size_t samples_per_block=1024)
+    : file(path, std::ios::binary | std::ios::trunc), position(0),
+      block_size(samples_per_block)
+  {
+    if (!file)
+      throw std::runtime_error("Failed to open " + path);
+
+    const uint8_t header[segment_header_size] = { 'C', 'Y', 'S', 'E', 'G',
+                                                  segment_version, 0, 0 };
+    write(header, sizeof(header));
+
+    pending.reserve(block_size);
+  }
+
+  segment_writer(const segment_writer&) = delete;
+  segment_writer& operator=(const segment_writer&) = delete;
+
+  void push(const sample& s) override
+  {
+    pending.push_back(s);
+
+    if (pending.size() >= block_size)
+      flush();
+  }
+
+  /* @brief Function to write the buffered samples as a block
+   */
+  void flush()
+  {
+    if (pending.empty() || !file.is_open())
+      return;
+
+    std::stable_sort(pending.begin(), pending.end(),
+      [](const sample& a, const sample& b) { return a.time < b.time; });
+
+    segment_block block = segment_block();
+    block.offset = position;
+
+    for (const auto& s : pending)
+    {
+      block.add(s);
+      writer.push(s);
+    }
+
+    const std::vector<uint8_t>& frame = writer.finish();
+    block.size = frame.size();
+
+    write(frame.data(), frame.size());
+    index.push_back(block);
+    pending.clear();
+
+    file.flush();
+  }
+
+  /* @brief Function to get the number of bytes written so far
+   */
+  uint64_t size() const
+  {
+    return position;
+  }
+
+  /* @brief Function to write the remaining samples and the index. Called by
+   *        the destructor if not called explicitly
+   */
+  void close()
+  {
+    if (!file.is_open())
+      return;
+
+    flush();
+
+    std::vector<uint8_t> out;
+    out.reserve(index.size() * segment_entry_size + segment_trailer_size);
+
+    uint64_t index_offset = position;
+
+    for (const auto& b : index)
+    {
+      put_le(out, b.offset, 8);
+      put_le(out, b.size, 4);
+      put_le(out, b.count, 4);
+      put_le(out, b.min_time, 8);
+      put_le(out, b.max_time, 8);
+      put_le(out, b.min_source, 4);
+      put_le(out, b.max_source, 4);
+      put_le(out, b.metrics, 8);
+    }
+
+    put_le(out, index_offset, 8);
+    put_le(out, index.size(), 4);
+    out.insert(out.end(), { 'C', 'Y', 'I', 'X' });
+
+    write(out.data(), out.size());
+    file.close();
+  }
+
+  ~segment_writer()
+  {
+    close();
+  }
+};
+
+/* @class segment_reader
+ *
+ * @brief Class to query a segment file in place
+ *
+ * The file is memory mapped and only the blocks which overlap a query are
+ * decoded, so queries cost O(log blocks) plus the size of the result
+ */
+class segment_reader
+{
+  const uint8_t* data;
+  size_t length;
+
+  std::vector<segment_block> blocks;
+
+  // Running maximum of max_time from the front and minimum of min_time from
+  // the back, which are monotonic even if blocks overlap in time
+  std::vector<uint64_t> prefix_max;
+  std::vector<uint64_t> suffix_min;
+
+  bool load_index()
+  {
+    if (length < segment_header_size + segment_trailer_size)
+      return false;
+
+    const uint8_t* trailer = data + length - segment_trailer_size;
+
+    if (std::memcmp(trailer + 12, "CYIX", 4) != 0)
+      return false;
+
+    uint64_t offset = get_le(trailer, 8);
+    uint64_t count = get_le(trailer + 8, 4);
+
+    if (offset + count * segment_entry_size + segment_trailer_size != length)
+      return false;
+
+    for (const uint8_t* e = data + offset; count--; e += segment_entry_size)
+    {
+      segment_block b;
+      b.offset     = get_le(e,      8);
+      b.size       = get_le(e + 8,  4);
+      b.count      = get_le(e + 12, 4);
+      b.min_time   = get_le(e + 16, 8);
+      b.max_time   = get_le(e + 24, 8);
+      b.min_source = get_le(e + 32, 4);
+      b.max_source = get_le(e + 36, 4);
+      b.metrics    = get_le(e + 40, 8);
+
+      if (b.offset + b.size > offset)
+        return false;
+
+      blocks.push_back(b);
+    }
+
+    return true;
+  }
+
+  /* @brief Function to rebuild the index of a segment which was not closed,
+   *        stopping at the first incomplete block
+   */
+  void scan_blocks()
+  {
+    blocks.clear();
+
+    size_t pos = segment_header_size;
+
+    while (pos < length)
+    {
+      size_t size = frame_size(data + pos, length - pos);
+
+      if (size == 0 || size > length - pos
+          || !frame_valid(data + pos, length - pos))
+        break;
+
+      segment_block b = segment_block();
+      b.offset = pos;
+      b.size = size;
+
+      for (const auto& s : batch_view(data + pos, size))
+        b.add(s);
+
+      blocks.push_back(b);
+      pos += size;
+    }
+  }
+
+public:
+  /* @brief Range of samples matching a query
+   */
+  class range
+  {
+    const segment_reader* reader;
+    size_t first;
+    size_t last;
+    uint64_t t0;
+    uint64_t t1;
+    uint32_t source;
+    uint16_t metric;
+
+  public:
+    class iterator
+    {
+      const range* r;
+      size_t block;
+      batch_view::iterator pos;
+      batch_view::iterator end;
+
+      bool matches() const
+      {
+        return pos->time >= r->t0 && pos->time <= r->t1
+          && (r->source == any_source || pos->source == r->source)
+          && (r->metric == any_metric || pos->metric == r->metric);
+      }
+
+      void open_block()
+      {
+        for (; block < r->last; ++block)
+        {
+          const segment_block& b = r->reader->blocks[block];
+
+          if (!b.may_contain(r->source, r->metric))
+            continue;
+
+          batch_view view(r->reader->data + b.offset, b.size);
+          pos = view.begin();
+
+          if (pos != end)
+            return;
+        }
+      }
+
+      void advance()
+      {
+        for (;;)
+        {
+          while (pos != end && !matches())
+          {
+            // Blocks are sorted by time, so nothing further can match
+            if (pos->time > r->t1)
+              pos = end;
+            else
+              ++pos;
+          }
+
+          if (pos != end || block >= r->last)
+            return;
+
+          ++block;
+          open_block();
+        }
+      }
+
+    public:
+      iterator()
+        : r(nullptr), block(0)
+      { }
+
+      iterator(const range* parent)
+        : r(parent), block(parent->first)
+      {
+        open_block();
+        advance();
+      }
+
+      const sample& operator*() const { return *pos; }
+      const sample* operator->() const { return &*pos; }
+
+      iterator& operator++()
+      {
+        ++pos;
+        advance();
+
+        return *this;
+      }
+
+      bool operator==(const iterator& other) const
+      {
+        if (pos == end || other.pos == other.end)
+          return pos == end && other.pos == other.end;
+
+        return block == other.block && pos == other.pos;
+      }
+
+      bool operator!=(const iterator& other) const
+      {
+        return !(*this == other);
+      }
+    };
+
+    range(const segment_reader* rd, size_t f, size_t l, uint64_t from,
+        uint64_t to, uint32_t src, uint16_t m)
+      : reader(rd), first(f), last(l), t0(from), t1(to), source(src),
+        metric(m)
+    { }
+
+    iterator begin() const
+    {
+      return iterator(this);
+    }
+
+    iterator end() const
+    {
+      return iterator();
+    }
+
+    /* @brief Function to get the number of blocks the query may touch
+     */
+    size_t blocks() const
+    {
+      return last - first;
+    }
+  };
+
+  /* @brief Constructor for segment_reader
+   *
+   * @param path Location of the segment file
+   */
+  segment_reader(const std::string& path)
+    : data(nullptr), length(0)
+  {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+      if (fd >= 0)
+        ::close(fd);
+
+      throw std::runtime_error("Failed to open " + path);
+    }
+
+    length = st.st_size;
+
+    if (length > 0)
+    {
+      void* map = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+
+      if (map == MAP_FAILED)
+      {
+        ::close(fd);
+        throw std::runtime_error("Failed to map " + path);
+      }
+
+      data = (const uint8_t*)map;
+    }
+
+    ::close(fd);
+
+    if (length < segment_header_size || std::memcmp(data, "CYSEG", 5) != 0
+        || data[5] != segment_version)
+    {
+      if (data)
+        munmap((void*)data, length);
+
+      throw std::runtime_error("Not a segment file: " + path);
+    }
+
+    if (!load_index())
+      scan_blocks();
+
+    prefix_max.resize(blocks.size());
+    suffix_min.resize(blocks.size());
+
+    for (size_t i = 0; i < blocks.size(); ++i)
+      prefix_max[i] = std::max(blocks[i].max_time,
+                               i ? prefix_max[i - 1] : 0);
+
+    for (size_t i = blocks.size(); i-- > 0;)
+      suffix_min[i] = std::min(blocks[i].min_time,
+                               i + 1 < blocks.size() ? suffix_min[i + 1]
+                                                     : UINT64_MAX);
+  }
+
+  segment_reader(const segment_reader&) = delete;
+  segment_reader& operator=(const segment_reader&) = delete;
+
+  /* @brief Function to find the samples in a time range
+   *
+   * The returned range refers to the mapped file and must not outlive the
+   * reader
+   *
+   * @param t0 Start of the range (inclusive), ns since the Unix epoch
+   * @param t1 End of the range (inclusive), ns since the Unix epoch
+   * @param source Device to select, or any_source
+   * @param metric Metric to select, or any_metric
+   * @return Range of matching samples in time order within each block
+   */
+  range query(uint64_t t0, uint64_t t1, uint32_t source=any_source,
+      uint16_t metric=any_metric) const
+  {
+    size_t first = std::lower_bound(prefix_max.begin(), prefix_max.end(), t0)
+      - prefix_max.begin();
+    size_t last = std::upper_bound(suffix_min.begin(), suffix_min.end(), t1)
+      - suffix_min.begin();
+
+    return range(this, first, std::max(first, last), t0, t1, source, metric);
+  }
+
+  /* @brief Function to get the earliest time in the segment
+   */
+  uint64_t min_time() const
+  {
+    return suffix_min.empty() ? 0 : suffix_min.front();
+  }
+
+  /* @brief Function to get the latest time in the segment
+   */
+  uint64_t max_time() const
+  {
+    return prefix_max.empty() ? 0 : prefix_max.back();
+  }
+
+  const std::vector<segment_block>& index() const
+  {
+    return blocks;
+  }
+
+  ~segment_reader()
+  {
+    if (data)
+      munmap((void*)data, length);
+  }
+};
+
+/* @class segment_store
+ *
+ * @brief Class to persist samples into a directory of segments, starting a new
+ *        segment once the current one reaches a size limit
+ *
+ * Segments are named after the time of their creation so that they sort in
+ * time order
+ */
+class segment_store : public sample_sink
+{
+  std::string directory;
+  uint64_t max_bytes;
+  size_t block_size;
+
+  std::unique_ptr<segment_writer> current;
+
+public:
+  /* @brief Constructor for segment_store
+   *
+   * @param dir Directory in which to create segments, which must exist
+   * @param segment_bytes Size at which a new segment is started
+   * @param samples_per_block Number of samples per block
+   */
+  segment_store(const std::string& dir, uint64_t segment_bytes=64 << 20,
+      size_t samples_per_block=1024)
+    : directory(dir), max_bytes(segment_bytes), block_size(samples_per_block)
+  { }
+
+  void push(const sample& s) override
+  {
+    if (!current || current->size() >= max_bytes)
+      rotate();
+
+    current->push(s);
+  }
+
+  /* @brief Function to close the current segment and start a new one
+   */
+  void rotate()
+  {
+    current.reset();
+
+    char name[40];
+    snprintf(name, sizeof(name), "/%020llu.cyseg",
+             (unsigned long long)now_ns());
+
+    current.reset(new segment_writer(directory + name, block_size));
+  }
+
+  /* @brief Function to make buffered samples visible to readers
+   */
+  void flush()
+  {
+    if (current)
+      current->flush();
+  }
+};
+
+/* @class segment_set
+ *
+ * @brief Class to query all segments in a directory
+ */
+class segment_set
+{
+  std::vector<std::unique_ptr<segment_reader>> segments;
+
+public:
+  /* @brief Constructor for segment_set, maps every segment in a directory
+   *
+   * @param dir The directory
+   */
+  segment_set(const std::string& dir)
+  {
+    DIR* d = opendir(dir.c_str());
+
+    if (!d)
+      throw std::runtime_error("Failed to open " + dir);
+
+    std::vector<std::string> names;
+
+    while (dirent* entry = readdir(d))
+    {
+      std::string name = entry->d_name;
+
+      if (name.size() > 6 && name.compare(name.size() - 6, 6, ".cyseg") == 0)
+        names.push_back(name);
+    }
+
+    closedir(d);
+    std::sort(names.begin(), names.end());
+
+    for (const auto& name : names)
+    {
+      std::unique_ptr<segment_reader> reader(
+        new segment_reader(dir + "/" + name));
+
+      if (!reader->index().empty())
+        segments.push_back(std::move(reader));
+    }
+  }
+
+  /* @brief Function to find the samples in a time range across segments
+   *
+   * Segments which do not overlap the range are skipped without touching
+   * their data
+   *
+   * @return One range per overlapping segment, in segment order
+   */
+  std::vector<segment_reader::range> query(uint64_t t0, uint64_t t1,
+      uint32_t source=any_source, uint16_t metric=any_metric) const
+  {
+    std::vector<segment_reader::range> result;
+
+    for (const auto& seg : segments)
+      if (seg->min_time() <= t1 && seg->max_time() >= t0)
+      {
+        segment_reader::range r = seg->query(t0, t1, source, metric);
+
+        if (r.blocks())
+          result.push_back(r);
+      }
+
+    return result;
+  }
+
+  size_t size() const
+  {
+    return segments.size();
+  }
+};
+
+} // namespace cyrial
+
+#endif // CYRIAL_TELEMETRY_SEGMENT_HPP
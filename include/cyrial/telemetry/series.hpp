@@ -0,0 +1,129 @@
+#ifndef CYRIAL_TELEMETRY_SERIES_HPP
+#define CYRIAL_TELEMETRY_SERIES_HPP
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "sample.hpp"
+
+namespace cyrial
+{
+
+/* @struct series_key
+ *
+ * @brief Identifies the series a sample belongs to
+ */
+struct series_key
+{
+  uint32_t source;
+  uint16_t metric;
+
+  bool operator<(const series_key& other) const
+  {
+    return source != other.source ? source < other.source
+                                  : metric < other.metric;
+  }
+
+  bool operator==(const series_key& other) const
+  {
+    return source == other.source && metric == other.metric;
+  }
+};
+
+/* @class series
+ *
+ * @brief Class to store the samples of one metric from one device in columnar
+ *        form
+ *
+ * Times (ns since the Unix epoch) and values are kept in separate contiguous
+ * buffers so that they can be exported or scanned without conversion
+ */
+class series
+{
+public:
+  std::vector<int64_t> time;
+  std::vector<double> value;
+
+  /* @brief Function to append a measurement
+   *
+   * @param t Time in ns since the Unix epoch
+   * @param v The measured value
+   */
+  void append(int64_t t, double v)
+  {
+    time.push_back(t);
+    value.push_back(v);
+  }
+
+  size_t size() const
+  {
+    return time.size();
+  }
+
+  bool empty() const
+  {
+    return time.empty();
+  }
+
+  void reserve(size_t n)
+  {
+    time.reserve(n);
+    value.reserve(n);
+  }
+
+  void clear()
+  {
+    time.clear();
+    value.clear();
+  }
+};
+
+/* @class series_store
+ *
+ * @brief Class to collect samples into one series per device and metric
+ */
+class series_store : public sample_sink
+{
+  std::map<series_key, series> data;
+
+public:
+  typedef std::map<series_key, series>::const_iterator const_iterator;
+
+  void push(const sample& s) override
+  {
+    data[series_key{ s.source, s.metric }].append(s.time, s.value);
+  }
+
+  /* @brief Function to get the series for a device and metric, creating it
+   *        if it does not exist
+   */
+  series& get(uint32_t source, uint16_t metric)
+  {
+    return data[series_key{ source, metric }];
+  }
+
+  size_t size() const
+  {
+    return data.size();
+  }
+
+  const_iterator begin() const
+  {
+    return data.begin();
+  }
+
+  const_iterator end() const
+  {
+    return data.end();
+  }
+
+  void clear()
+  {
+    data.clear();
+  }
+};
+
+} // namespace cyrial
+
+#endif // CYRIAL_TELEMETRY_SERIES_HPP
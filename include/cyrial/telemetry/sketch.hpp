@@ -0,0 +1,566 @@
+#ifndef CYRIAL_TELEMETRY_SKETCH_HPP
+#define CYRIAL_TELEMETRY_SKETCH_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "sample.hpp"
+#include "series.hpp"
+#include "wire.hpp"
+
+namespace cyrial
+{
+
+/* @class sketch_store
+ *
+ * @brief Class to store the bucket counts of one sign of a quantile_sketch
+ *
+ * Buckets are kept in a contiguous array covering the range of indexes seen
+ * so far. If the range exceeds the bucket limit, the buckets nearest to zero
+ * are merged so that the tails keep their accuracy
+ */
+class sketch_store
+{
+  std::vector<uint64_t> bins;
+  int32_t offset;
+  uint64_t total;
+  size_t max_bins;
+
+  void collapse()
+  {
+    size_t excess = bins.size() - max_bins;
+    uint64_t merged = 0;
+
+    for (size_t i = 0; i <= excess; ++i)
+      merged += bins[i];
+
+    bins.erase(bins.begin(), bins.begin() + excess);
+    bins[0] = merged;
+    offset += excess;
+  }
+
+public:
+  sketch_store(size_t limit=2048)
+    : offset(0), total(0), max_bins(limit)
+  { }
+
+  void add(int32_t index, uint64_t n=1)
+  {
+    if (n == 0)
+      return;
+
+    if (bins.empty())
+    {
+      bins.assign(1, 0);
+      offset = index;
+    }
+    else if (index < offset)
+    {
+      // Values below the collapsed range are counted in the lowest bucket
+      if (bins.size() == max_bins)
+        index = offset;
+      else
+      {
+        size_t grow = std::min<size_t>(offset - index + bins.size() / 2,
+                                       max_bins - bins.size());
+        grow = std::max<size_t>(grow, offset - index);
+        bins.insert(bins.begin(), grow, 0);
+        offset -= grow;
+      }
+    }
+    else if ((size_t)(index - offset) >= bins.size())
+      bins.resize(index - offset + 1, 0);
+
+    bins[index - offset] += n;
+    total += n;
+
+    if (bins.size() > max_bins)
+      collapse();
+  }
+
+  void merge(const sketch_store& other)
+  {
+    for (size_t i = 0; i < other.bins.size(); ++i)
+      add(other.offset + i, other.bins[i]);
+  }
+
+  uint64_t count() const
+  {
+    return total;
+  }
+
+  bool empty() const
+  {
+    return total == 0;
+  }
+
+  /* @brief Function to find the bucket holding a rank
+   *
+   * @param rank Zero based rank within this store
+   * @param ascending Whether ranks count up from the lowest index
+   * @return The index of the bucket
+   */
+  int32_t index_of_rank(uint64_t rank, bool ascending) const
+  {
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < bins.size(); ++i)
+    {
+      size_t b = ascending ? i : bins.size() - 1 - i;
+      seen += bins[b];
+
+      if (seen > rank)
+        return offset + b;
+    }
+
+    return offset + (ascending ? bins.size() - 1 : 0);
+  }
+
+  void serialize(std::vector<uint8_t>& out) const
+  {
+    put_varint(out, zigzag(offset));
+    put_varint(out, bins.size());
+
+    for (auto b : bins)
+      put_varint(out, b);
+  }
+
+  bool deserialize(const uint8_t*& pos, const uint8_t* end)
+  {
+    uint64_t off, size, n;
+
+    if (!get_varint(pos, end, off) || !get_varint(pos, end, size)
+        || size > (uint64_t)(end - pos))
+      return false;
+
+    bins.clear();
+    total = 0;
+
+    for (uint64_t i = 0; i < size; ++i)
+    {
+      if (!get_varint(pos, end, n))
+        return false;
+
+      add(unzigzag(off) + i, n);
+    }
+
+    return true;
+  }
+};
+
+/* @class quantile_sketch
+ *
+ * @brief Class to estimate quantiles of a stream in bounded memory
+ *
+ * Implements DDSketch: values are counted in logarithmically sized buckets,
+ * so every quantile estimate is within the configured relative accuracy of
+ * the true value (until the bucket limit forces values nearest zero to be
+ * merged). Updates are O(1) amortised, and sketches with the same accuracy
+ * can be merged, e.g. across devices or time windows
+ */
+class quantile_sketch
+{
+  double gamma;
+  double inv_log_gamma;
+  double min_value;
+
+  sketch_store positive;
+  sketch_store negative;
+  uint64_t zero;
+
+  double lowest;
+  double highest;
+
+  int32_t index(double value) const
+  {
+    return (int32_t)std::ceil(std::log(value) * inv_log_gamma);
+  }
+
+  double value(int32_t index) const
+  {
+    return 2.0 * std::pow(gamma, index) / (gamma + 1.0);
+  }
+
+public:
+  /* @brief Constructor for quantile_sketch
+   *
+   * @param accuracy Relative accuracy of quantile estimates
+   * @param max_bins Maximum number of buckets for each sign
+   * @param min_magnitude Values of smaller magnitude are counted as zero; the
+   *        default suits quantities such as time offsets down to 1E-15
+   */
+  quantile_sketch(double accuracy=0.01, size_t max_bins=2048,
+      double min_magnitude=1e-15)
+    : gamma((1.0 + accuracy) / (1.0 - accuracy)),
+      inv_log_gamma(1.0 / std::log(gamma)), min_value(min_magnitude),
+      positive(max_bins), negative(max_bins), zero(0),
+      lowest(std::numeric_limits<double>::infinity()),
+      highest(-std::numeric_limits<double>::infinity())
+  { }
+
+  /* @brief Function to add a value to the sketch
+   *
+   * @param v The value
+   * @param n The number of occurrences
+   */
+  void add(double v, uint64_t n=1)
+  {
+    if (std::isnan(v) || n == 0)
+      return;
+
+    if (v > min_value)
+      positive.add(index(v), n);
+    else if (v < -min_value)
+      negative.add(index(-v), n);
+    else
+      zero += n;
+
+    lowest = std::min(lowest, v);
+    highest = std::max(highest, v);
+  }
+
+  /* @brief Function to check whether another sketch has the same accuracy,
+   *        and so can be merged into this one
+   */
+  bool compatible(const quantile_sketch& other) const
+  {
+    return std::fabs(other.gamma - gamma) <= 1e-12 * gamma;
+  }
+
+  /* @brief Function to merge another sketch into this one
+   *
+   * @param other A sketch constructed with the same accuracy
+   */
+  void merge(const quantile_sketch& other)
+  {
+    if (!compatible(other))
+      throw std::invalid_argument("Sketch accuracy mismatch");
+
+    positive.merge(other.positive);
+    negative.merge(other.negative);
+    zero += other.zero;
+
+    lowest = std::min(lowest, other.lowest);
+    highest = std::max(highest, other.highest);
+  }
+
+  uint64_t count() const
+  {
+    return positive.count() + negative.count() + zero;
+  }
+
+  double min() const
+  {
+    return lowest;
+  }
+
+  double max() const
+  {
+    return highest;
+  }
+
+  /* @brief Function to estimate a quantile
+   *
+   * @param q The quantile, in [0, 1] (e.g. 0.999 for p99.9)
+   * @return The estimate, or NaN if the sketch is empty
+   */
+  double quantile(double q) const
+  {
+    uint64_t n = count();
+
+    if (n == 0 || q < 0.0 || q > 1.0)
+      return std::numeric_limits<double>::quiet_NaN();
+
+    uint64_t rank = (uint64_t)(q * (n - 1));
+    double estimate;
+
+    if (rank < negative.count())
+      estimate = -value(negative.index_of_rank(rank, false));
+    else if (rank < negative.count() + zero)
+      estimate = 0.0;
+    else
+      estimate = value(positive.index_of_rank(
+        rank - negative.count() - zero, true));
+
+    return std::max(lowest, std::min(highest, estimate));
+  }
+
+  /* @brief Function to append the sketch to a buffer
+   *
+   * Format: accuracy parameters, min, max, zero count, and the negative and
+   * positive stores (see @sketch_store::serialize), varint encoded
+   */
+  void serialize(std::vector<uint8_t>& out) const
+  {
+    double header[4] = { gamma, min_value, lowest, highest };
+
+    for (double d : header)
+    {
+      uint64_t bits;
+      std::memcpy(&bits, &d, sizeof(bits));
+
+      for (int i = 0; i < 8; ++i)
+        out.push_back((uint8_t)(bits >> (8 * i)));
+    }
+
+    put_varint(out, zero);
+    negative.serialize(out);
+    positive.serialize(out);
+  }
+
+  /* @brief Function to read a sketch written by @serialize
+   *
+   * @param pos Position to read from, advanced past the sketch
+   * @param end End of the readable data
+   * @return Whether a complete sketch was read
+   */
+  bool deserialize(const uint8_t*& pos, const uint8_t* end)
+  {
+    if (end - pos < 32)
+      return false;
+
+    double header[4];
+
+    for (double& d : header)
+    {
+      uint64_t bits = 0;
+
+      for (int i = 0; i < 8; ++i)
+        bits |= (uint64_t)*pos++ << (8 * i);
+
+      std::memcpy(&d, &bits, sizeof(bits));
+    }
+
+    gamma = header[0];
+    inv_log_gamma = 1.0 / std::log(gamma);
+    min_value = header[1];
+    lowest = header[2];
+    highest = header[3];
+
+    return get_varint(pos, end, zero) && negative.deserialize(pos, end)
+      && positive.deserialize(pos, end);
+  }
+};
+
+/* @class sketch_set
+ *
+ * @brief Class to maintain a quantile sketch per series and time window
+ *
+ * Quantiles over any range of windows are answered by merging the windows'
+ * sketches, so windows should be chosen as the finest granularity at which
+ * ranges will be requested
+ *
+ * Segments (see segment.hpp) hold raw samples only and the Arrow export
+ * (see arrow.hpp) holds raw series, so neither carries sketches; use @save
+ * and @load to keep them in a file of their own, e.g. beside the segments
+ */
+class sketch_set : public sample_sink
+{
+  struct window
+  {
+    uint64_t start;
+    quantile_sketch sketch;
+  };
+
+  uint64_t resolution;
+  size_t retain;
+  double accuracy;
+
+  std::map<series_key, std::deque<window>> windows;
+
+public:
+  /* @brief Constructor for sketch_set
+   *
+   * @param window_ns Length of each window in ns (default: 1 hour)
+   * @param windows_retained Windows kept per series (default: 31 days)
+   * @param relative_accuracy Accuracy of each sketch
+   */
+  sketch_set(uint64_t window_ns=3600000000000ull, size_t windows_retained=744,
+      double relative_accuracy=0.01)
+    : resolution(window_ns), retain(windows_retained),
+      accuracy(relative_accuracy)
+  { }
+
+  void push(const sample& s) override
+  {
+    std::deque<window>& w = windows[series_key{ s.source, s.metric }];
+    uint64_t start = s.time - s.time % resolution;
+
+    if (w.empty() || start > w.back().start)
+    {
+      w.push_back(window{ start, quantile_sketch(accuracy) });
+
+      if (w.size() > retain)
+        w.pop_front();
+    }
+    else if (start < w.back().start)
+    {
+      // Late samples go to their own window if it is still retained
+      auto it = std::lower_bound(w.begin(), w.end(), start,
+        [](const window& a, uint64_t t) { return a.start < t; });
+
+      if (it == w.end() || it->start != start)
+        return;
+
+      it->sketch.add(s.value);
+      return;
+    }
+
+    w.back().sketch.add(s.value);
+  }
+
+  /* @brief Function to get the merged sketch of a set of series over a time
+   *        range
+   *
+   * @param source The device, or any_source to merge all devices
+   * @param metric The metric
+   * @param t0 Start of the range (inclusive), ns since the Unix epoch
+   * @param t1 End of the range (inclusive), ns since the Unix epoch
+   */
+  quantile_sketch range(uint32_t source, uint16_t metric, uint64_t t0,
+      uint64_t t1) const
+  {
+    quantile_sketch result(accuracy);
+
+    for (const auto& entry : windows)
+    {
+      if (entry.first.metric != metric
+          || (source != any_source && entry.first.source != source))
+        continue;
+
+      const std::deque<window>& w = entry.second;
+      auto it = std::lower_bound(w.begin(), w.end(), t0 - t0 % resolution,
+        [](const window& a, uint64_t t) { return a.start < t; });
+
+      for (; it != w.end() && it->start <= t1; ++it)
+        result.merge(it->sketch);
+    }
+
+    return result;
+  }
+
+  /* @brief Function to estimate a quantile of a series over a time range
+   */
+  double quantile(uint32_t source, uint16_t metric, double q, uint64_t t0=0,
+      uint64_t t1=UINT64_MAX) const
+  {
+    return range(source, metric, t0, t1).quantile(q);
+  }
+
+  /* @brief Function to append all retained windows to a buffer
+   */
+  void serialize(std::vector<uint8_t>& out) const
+  {
+    put_varint(out, windows.size());
+
+    for (const auto& entry : windows)
+    {
+      put_varint(out, entry.first.source);
+      put_varint(out, entry.first.metric);
+      put_varint(out, entry.second.size());
+
+      for (const auto& w : entry.second)
+      {
+        put_varint(out, w.start);
+        w.sketch.serialize(out);
+      }
+    }
+  }
+
+  /* @brief Function to merge windows written by @serialize into the set,
+   *        e.g. to combine the sketches of several hosts
+   *
+   * @return Whether the data was read completely; false also if a sketch
+   *         was written with a different accuracy than the set's
+   */
+  bool merge(const uint8_t* pos, const uint8_t* end)
+  {
+    uint64_t series_count, source, metric, count, start;
+    const quantile_sketch reference(accuracy);
+
+    if (!get_varint(pos, end, series_count))
+      return false;
+
+    while (series_count--)
+    {
+      if (!get_varint(pos, end, source) || !get_varint(pos, end, metric)
+          || !get_varint(pos, end, count))
+        return false;
+
+      std::deque<window>& w = windows[series_key{ (uint32_t)source,
+                                                  (uint16_t)metric }];
+
+      while (count--)
+      {
+        quantile_sketch sketch(accuracy);
+
+        if (!get_varint(pos, end, start) || !sketch.deserialize(pos, end)
+            || !reference.compatible(sketch))
+          return false;
+
+        auto it = std::lower_bound(w.begin(), w.end(), start,
+          [](const window& a, uint64_t t) { return a.start < t; });
+
+        if (it != w.end() && it->start == start)
+          it->sketch.merge(sketch);
+        else
+          w.insert(it, window{ start, sketch });
+      }
+
+      while (w.size() > retain)
+        w.pop_front();
+    }
+
+    return true;
+  }
+
+  /* @brief Function to write all retained windows to a file, replacing it
+   *
+   * Format: "CYSK" followed by the output of @serialize
+   *
+   * @param path Location of the file
+   */
+  void save(const std::string& path) const
+  {
+    const char* magic = "CYSK";
+    std::vector<uint8_t> data(magic, magic + 4);
+    serialize(data);
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+
+    if (!out.write((const char*)data.data(), data.size()))
+      throw std::runtime_error("Failed to write " + path);
+  }
+
+  /* @brief Function to merge the windows of a file written by @save into
+   *        the set
+   *
+   * @param path Location of the file
+   * @return Whether the file was read completely
+   */
+  bool load(const std::string& path)
+  {
+    std::ifstream in(path, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)),
+                              std::istreambuf_iterator<char>());
+
+    if (data.size() < 4 || std::memcmp(data.data(), "CYSK", 4) != 0)
+      return false;
+
+    return merge(data.data() + 4, data.data() + data.size());
+  }
+};
+
+} // namespace cyrial
+
+#endif // CYRIAL_TELEMETRY_SKETCH_HPP
@@ -0,0 +1,316 @@
+#ifndef CYRIAL_TELEMETRY_SYNC_STATE_HPP
+#define CYRIAL_TELEMETRY_SYNC_STATE_HPP
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+#include "sample.hpp"
+
+namespace cyrial
+{
+
+/* @brief Synchronization condition of a device, derived from its lock status
+ *        and synchronization source
+ */
+enum sync_condition : uint8_t { COND_UNKNOWN, COND_LOCKED, COND_UNLOCKED,
+                                COND_HOLDOVER };
+
+/* @brief Kinds of transition recorded by sync_tracker
+ *
+ * EV_LOCKED        : lock acquired (from unlocked or unknown)
+ * EV_UNLOCKED      : lock lost without entering holdover
+ * EV_HOLDOVER      : holdover entered
+ * EV_RECOVERED     : lock regained after holdover
+ * EV_SOURCE_CHANGE : synchronization source changed (from/to hold a
+ *                    source_state)
+ */
+enum sync_event_type : uint8_t { EV_LOCKED, EV_UNLOCKED, EV_HOLDOVER,
+                                 EV_RECOVERED, EV_SOURCE_CHANGE };
+
+/* @struct sync_event
+ *
+ * @brief A transition of a device, packed into 16 bytes
+ */
+struct sync_event
+{
+  uint64_t time;
+  uint32_t source;
+  uint8_t type;
+  uint8_t from;
+  uint8_t to;
+  uint8_t reserved;
+};
+
+/* @struct sync_totals
+ *
+ * @brief Running totals of a device's synchronization history
+ */
+struct sync_totals
+{
+  uint64_t locked_ns;
+  uint64_t unlocked_ns;
+  uint64_t holdover_ns;
+  uint64_t unknown_ns;
+  uint64_t lock_losses;       // Transitions out of lock, including holdover
+  uint64_t holdovers;
+  uint64_t longest_holdover_ns;
+  uint64_t source_changes;
+
+  /* @brief Function to get the fraction of observed time spent locked
+   */
+  double availability() const
+  {
+    uint64_t known = locked_ns + unlocked_ns + holdover_ns;
+
+    return known ? (double)locked_ns / known : 0.0;
+  }
+
+  /* @brief Function to get the mean time between lock losses in seconds, or
+   *        the total locked time if lock has never been lost
+   */
+  double mtbf() const
+  {
+    return locked_ns * 1e-9 / (lock_losses ? lock_losses : 1);
+  }
+
+  /* @brief Function to get the mean holdover duration in seconds
+   */
+  double mean_holdover() const
+  {
+    return holdovers ? holdover_ns * 1e-9 / holdovers : 0.0;
+  }
+};
+
+/* @class sync_tracker
+ *
+ * @brief Class to reconstruct lock and holdover history from sample streams
+ *
+ * Each device is tracked by a state machine fed with its sync_lock and
+ * sync_sour_state samples (see sampler.hpp). Transitions are appended to an
+ * event log and passed to the event handler, and the time between samples is
+ * accounted to the condition the device was in, so availability and MTBF can
+ * be read at any time
+ */
+class sync_tracker : public sample_sink
+{
+public:
+  typedef std::function<void(const sync_event&)> event_handler;
+
+private:
+  struct device_state
+  {
+    sync_condition condition;
+    int lock;                 // -1 until known
+    int sour_state;           // -1 until known
+    uint64_t last_time;
+    uint64_t holdover_start;
+    bool recovering;          // Holdover entered and lock not yet regained
+    sync_totals totals;
+  };
+
+  std::map<uint32_t, device_state> devices;
+  std::vector<sync_event> log;
+  size_t log_limit;
+  uint64_t max_gap;
+  event_handler on_event;
+
+  void emit(uint64_t time, uint32_t source, sync_event_type type,
+      uint8_t from, uint8_t to)
+  {
+    sync_event e{ time, source, type, from, to, 0 };
+
+    if (on_event)
+      on_event(e);
+
+    if (log_limit)
+    {
+      if (log.size() == log_limit)
+        log.erase(log.begin(), log.begin() + log_limit / 2);
+
+      log.push_back(e);
+    }
+  }
+
+  void account(device_state& d, uint64_t time) const
+  {
+    if (d.last_time == 0 || time <= d.last_time)
+    {
+      if (time > d.last_time)
+        d.last_time = time;
+
+      return;
+    }
+
+    uint64_t elapsed = time - d.last_time;
+    d.last_time = time;
+
+    // Time during which the device was not observed is not attributed
+    if (elapsed > max_gap)
+    {
+      d.totals.unknown_ns += elapsed;
+      return;
+    }
+
+    switch (d.condition)
+    {
+      case COND_LOCKED:   d.totals.locked_ns += elapsed;   break;
+      case COND_UNLOCKED: d.totals.unlocked_ns += elapsed; break;
+      case COND_HOLDOVER: d.totals.holdover_ns += elapsed; break;
+      default:            d.totals.unknown_ns += elapsed;  break;
+    }
+  }
+
+  void transition(device_state& d, uint32_t source, uint64_t time)
+  {
+    sync_condition next;
+
+    if (d.sour_state == SRC_HOLD)
+      next = COND_HOLDOVER;
+    else if (d.lock < 0)
+      return;
+    else
+      next = d.lock ? COND_LOCKED : COND_UNLOCKED;
+
+    sync_condition prev = d.condition;
+
+    if (next == prev)
+      return;
+
+    d.condition = next;
+
+    if (prev == COND_LOCKED)
+      ++d.totals.lock_losses;
+
+    if (prev == COND_HOLDOVER)
+    {
+      uint64_t duration = time - d.holdover_start;
+
+      if (duration > d.totals.longest_holdover_ns)
+        d.totals.longest_holdover_ns = duration;
+    }
+
+    switch (next)
+    {
+      case COND_HOLDOVER:
+        ++d.totals.holdovers;
+        d.holdover_start = time;
+        d.recovering = true;
+        emit(time, source, EV_HOLDOVER, prev, next);
+        break;
+
+      case COND_LOCKED:
+        emit(time, source, d.recovering ? EV_RECOVERED : EV_LOCKED, prev,
+             next);
+        d.recovering = false;
+        break;
+
+      default:
+        emit(time, source, EV_UNLOCKED, prev, next);
+        break;
+    }
+  }
+
+public:
+  /* @brief Constructor for sync_tracker
+   *
+   * @param handler Function to call with each transition, e.g. to persist it
+   * @param events_retained Number of transitions kept in memory
+   * @param gap_ns Intervals between samples longer than this are counted as
+   *        unknown rather than attributed to the current condition
+   */
+  sync_tracker(event_handler handler=event_handler(),
+      size_t events_retained=65536, uint64_t gap_ns=600000000000ull)
+    : log_limit(events_retained), max_gap(gap_ns), on_event(handler)
+  { }
+
+  void push(const sample& s) override
+  {
+    if (s.metric != metric::sync_lock && s.metric != metric::sync_sour_state)
+      return;
+
+    auto it = devices.find(s.source);
+
+    if (it == devices.end())
+    {
+      device_state d = device_state();
+      d.lock = d.sour_state = -1;
+      it = devices.insert(std::make_pair(s.source, d)).first;
+    }
+
+    device_state& d = it->second;
+    account(d, s.time);
+
+    if (s.metric == metric::sync_lock)
+      d.lock = s.value != 0.0;
+    else
+    {
+      int state = (int)s.value;
+
+      if (d.sour_state >= 0 && state != d.sour_state)
+      {
+        ++d.totals.source_changes;
+        emit(s.time, s.source, EV_SOURCE_CHANGE, d.sour_state, state);
+      }
+
+      d.sour_state = state;
+    }
+
+    transition(d, s.source, s.time);
+  }
+
+  /* @brief Function to get the current condition of a device
+   */
+  sync_condition condition(uint32_t source) const
+  {
+    auto it = devices.find(source);
+
+    return it == devices.end() ? COND_UNKNOWN : it->second.condition;
+  }
+
+  /* @brief Function to get the running totals of a device
+   *
+   * @param source The device
+   * @param now If non-zero, time up to which the current condition is
+   *        accounted (without modifying the tracker)
+   */
+  sync_totals totals(uint32_t source, uint64_t now=0) const
+  {
+    auto it = devices.find(source);
+
+    if (it == devices.end())
+      return sync_totals();
+
+    device_state d = it->second;
+
+    // Accounted on a copy so that reading does not alter the history
+    if (now)
+      account(d, now);
+
+    return d.totals;
+  }
+
+  /* @brief Function to get the retained transitions, oldest first
+   */
+  const std::vector<sync_event>& events() const
+  {
+    return log;
+  }
+
+  /* @brief Function to get the devices which have been observed
+   */
+  std::vector<uint32_t> sources() const
+  {
+    std::vector<uint32_t> result;
+
+    for (const auto& entry : devices)
+      result.push_back(entry.first);
+
+    return result;
+  }
+};
+
+} // namespace cyrial
+
+#endif // CYRIAL_TELEMETRY_SYNC_STATE_HPP
@@ -0,0 +1,375 @@
+#ifndef CYRIAL_TELEMETRY_WIRE_HPP
+#define CYRIAL_TELEMETRY_WIRE_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "sample.hpp"
+
+namespace cyrial
+{
+
+/* Telemetry wire format
+ *
+ * Samples are sent in self-delimiting frames so that they can be streamed
+ * over TCP or appended to a file:
+ *
+ *   'C' 'Y' 'T' <version>        4 bytes
+ *   <payload length>             uint32, little endian
+ *   <payload>
+ *
+ * The payload of a version 1 frame is a batch of samples:
+ *
+ *   <count>                      varint
+ *   <base time>                  varint, ns since the Unix epoch
+ *   count * {
+ *     <time delta>               zigzag varint, from the previous sample
+ *     <source delta>             zigzag varint, from the previous sample
+ *     <metric << 1 | kind>       varint
+ *     <value>                    kind 0: zigzag varint (integral values)
+ *                                kind 1: IEEE 754 double, little endian
+ *   }
+ *
+ * The first sample's deltas are relative to the base time and source 0.
+ * Decoders must reject frames with a version they do not know
+ */
+
+const uint8_t wire_version = 1;
+const size_t wire_header_size = 8;
+
+/* @brief Function to append an unsigned LEB128 varint to a buffer
+ *
+ * @param out The buffer
+ * @param value The value to encode
+ */
+inline void put_varint(std::vector<uint8_t>& out, uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    out.push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+
+  out.push_back((uint8_t)value);
+}
+
+/* @brief Function to read an unsigned LEB128 varint
+ *
+ * @param pos Position to read from, advanced past the varint
+ * @param end End of the readable data
+ * @param value Set to the decoded value
+ * @return Whether a complete varint was read
+ */
+inline bool get_varint(const uint8_t*& pos, const uint8_t* end,
+    uint64_t& value)
+{
+  value = 0;
+
+  for (unsigned shift = 0; pos < end && shift < 64; shift += 7)
+  {
+    uint8_t byte = *pos++;
+    value |= (uint64_t)(byte & 0x7f) << shift;
+
+    if (!(byte & 0x80))
+      return true;
+  }
+
+  return false;
+}
+
+inline uint64_t zigzag(int64_t value)
+{
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value)
+{
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/* @brief Function to read the payload length of a frame
+ *
+ * @param data Start of the frame
+ * @param size Number of bytes available
+ * @return The total size of the frame including its header, or 0 if the
+ *         header is incomplete
+ */
+inline size_t frame_size(const uint8_t* data, size_t size)
+{
+  if (size < wire_header_size)
+    return 0;
+
+  return wire_header_size + ((uint32_t)data[4]       | (uint32_t)data[5] << 8
+                           | (uint32_t)data[6] << 16 | (uint32_t)data[7] << 24);
+}
+
+/* @brief Function to check whether data begins with a frame header of a
+ *        supported version
+ *
+ * @param data Start of the frame
+ * @param size Number of bytes available (at least wire_header_size)
+ */
+inline bool frame_valid(const uint8_t* data, size_t size)
+{
+  return size >= wire_header_size && data[0] == 'C' && data[1] == 'Y'
+    && data[2] == 'T' && data[3] == wire_version;
+}
+
+/* @class batch_writer
+ *
+ * @brief Class to encode samples into a frame
+ *
+ * The buffer is reused between batches so that steady-state encoding does not
+ * allocate
+ */
+class batch_writer
+{
+  std::vector<uint8_t> body;
+  std::vector<uint8_t> frame;
+
+  size_t count;
+  uint64_t base_time;
+  uint64_t last_time;
+  uint32_t last_source;
+
+public:
+  batch_writer()
+    : count(0), base_time(0), last_time(0), last_source(0)
+  { }
+
+  /* @brief Function to get the number of samples in the current batch
+   */
+  size_t size() const
+  {
+    return count;
+  }
+
+  /* @brief Function to add a sample to the current batch
+   *
+   * @param s The sample
+   */
+  void push(const sample& s)
+  {
+    if (count == 0)
+      base_time = last_time = s.time;
+
+    put_varint(body, zigzag((int64_t)(s.time - last_time)));
+    put_varint(body, zigzag((int64_t)s.source - (int64_t)last_source));
+
+    double integral;
+
+    // Integral values (counts, flags, bit fields) are common and small
+    if (std::modf(s.value, &integral) == 0.0 && std::fabs(s.value) < 9.0e15
+        && (s.value != 0.0 || !std::signbit(s.value)))
+    {
+      put_varint(body, (uint64_t)s.metric << 1);
+      put_varint(body, zigzag((int64_t)s.value));
+    }
+    else
+    {
+      uint64_t bits;
+      std::memcpy(&bits, &s.value, sizeof(bits));
+
+      put_varint(body, (uint64_t)s.metric << 1 | 1);
+
+      for (int i = 0; i < 8; ++i)
+        body.push_back((uint8_t)(bits >> (8 * i)));
+    }
+
+    last_time = s.time;
+    last_source = s.source;
+    ++count;
+  }
+
+  /* @brief Function to complete the current batch
+   *
+   * The returned buffer remains valid until the next call to push or finish
+   *
+   * @return The encoded frame
+   */
+  const std::vector<uint8_t>& finish()
+  {
+    frame.clear();
+    frame.push_back('C');
+    frame.push_back('Y');
+    frame.push_back('T');
+    frame.push_back(wire_version);
+
+    // Length is patched in once the payload prefix is known
+    frame.resize(wire_header_size);
+
+    put_varint(frame, count);
+    put_varint(frame, base_time);
+    frame.insert(frame.end(), body.begin(), body.end());
+
+    uint32_t length = frame.size() - wire_header_size;
+
+    for (int i = 0; i < 4; ++i)
+      frame[4 + i] = (uint8_t)(length >> (8 * i));
+
+    body.clear();
+    count = 0;
+    last_source = 0;
+
+    return frame;
+  }
+};
+
+/* @class batch_view
+ *
+ * @brief Class to decode a frame in place
+ *
+ * No data is copied; the view is only valid for the lifetime of the buffer it
+ * was constructed from
+ */
+class batch_view
+{
+  const uint8_t* payload;
+  const uint8_t* stop;
+
+  size_t count;
+  uint64_t base_time;
+
+public:
+  /* @brief Forward iterator over the samples of a batch
+   *
+   * Iteration stops early if the frame is truncated or malformed
+   */
+  class iterator
+  {
+    const uint8_t* pos;
+    const uint8_t* end;
+    size_t remaining;
+
+    sample current;
+
+    void decode()
+    {
+      uint64_t dt, ds, key, raw;
+
+      if (remaining == 0 || !get_varint(pos, end, dt)
+          || !get_varint(pos, end, ds) || !get_varint(pos, end, key))
+      {
+        remaining = 0;
+        return;
+      }
+
+      current.time += unzigzag(dt);
+      current.source += unzigzag(ds);
+      current.metric = (uint16_t)(key >> 1);
+
+      if (key & 1)
+      {
+        if (end - pos < 8)
+        {
+          remaining = 0;
+          return;
+        }
+
+        raw = 0;
+        for (int i = 0; i < 8; ++i)
+          raw |= (uint64_t)pos[i] << (8 * i);
+        pos += 8;
+
+        std::memcpy(&current.value, &raw, sizeof(raw));
+      }
+      else
+      {
+        if (!get_varint(pos, end, raw))
+        {
+          remaining = 0;
+          return;
+        }
+
+        current.value = (double)unzigzag(raw);
+      }
+    }
+
+  public:
+    iterator()
+      : pos(nullptr), end(nullptr), remaining(0)
+    { }
+
+    iterator(const uint8_t* p, const uint8_t* e, size_t n, uint64_t base)
+      : pos(p), end(e), remaining(n)
+    {
+      current.time = base;
+      current.source = 0;
+      decode();
+    }
+
+    const sample& operator*() const { return current; }
+    const sample* operator->() const { return &current; }
+
+    iterator& operator++()
+    {
+      if (remaining && --remaining)
+        decode();
+
+      return *this;
+    }
+
+    bool operator==(const iterator& other) const
+    {
+      return remaining == other.remaining;
+    }
+
+    bool operator!=(const iterator& other) const
+    {
+      return remaining != other.remaining;
+    }
+  };
+
+  /* @brief Constructor for batch_view
+   *
+   * @param data Start of a complete frame
+   * @param size Size of the frame as returned by @frame_size
+   */
+  batch_view(const uint8_t* data, size_t size)
+    : payload(nullptr), stop(nullptr), count(0), base_time(0)
+  {
+    if (!frame_valid(data, size) || frame_size(data, size) > size)
+      return;
+
+    const uint8_t* pos = data + wire_header_size;
+    const uint8_t* last = data + frame_size(data, size);
+    uint64_t n;
+
+    if (get_varint(pos, last, n) && get_varint(pos, last, base_time))
+    {
+      payload = pos;
+      stop = last;
+      count = n;
+    }
+  }
+
+  /* @brief Function to check whether the frame could be decoded
+   */
+  bool valid() const
+  {
+    return payload != nullptr;
+  }
+
+  /* @brief Function to get the number of samples declared by the frame
+   */
+  size_t size() const
+  {
+    return count;
+  }
+
+  iterator begin() const
+  {
+    return iterator(payload, stop, count, base_time);
+  }
+
+  iterator end() const
+  {
+    return iterator();
+  }
+};
+
+} // namespace cyrial
+
+#endif // CYRIAL_TELEMETRY_WIRE_HPP
@@ -0,0 +1,286 @@
+#ifndef CYRIAL_TRACE_HPP
+#define CYRIAL_TRACE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cyrial
+{
+
+/* @struct trace_event
+ *
+ * @brief A span or instant in the lifecycle of a command
+ */
+struct trace_event
+{
+  const char* name;           // Static storage
+  int64_t port;               // Index of the port, -1 if not port specific
+  uint64_t start;             // ns, steady clock
+  uint64_t duration;          // ns, 0 for instants
+  bool instant;
+};
+
+/* @class tracer
+ *
+ * @brief Class to collect the spans of every thread for viewing in a trace
+ *        viewer such as chrome://tracing or Perfetto
+ *
+ * Each thread appends to its own buffer, whose lock is only contended while
+ * the trace is written. Recording is enabled by defining CYRIAL_TRACE; without
+ * it the CYRIAL_TRACE_* macros expand to nothing
+ */
+class tracer
+{
+  struct thread_buffer
+  {
+    std::mutex lock;
+    std::vector<trace_event> events;
+    size_t thread;
+    size_t dropped = 0;
+  };
+
+  // Buffers of the calling thread, one per tracer
+  struct buffer_owner
+  {
+    std::vector<std::pair<uint64_t, std::shared_ptr<thread_buffer>>> buffers;
+  };
+
+  std::mutex buffers_lock;
+  std::vector<std::shared_ptr<thread_buffer>> buffers;
+  size_t capacity;
+  uint64_t id;
+
+  static uint64_t next_id()
+  {
+    static std::atomic<uint64_t> count(0);
+
+    return ++count;
+  }
+
+  thread_buffer& local_buffer()
+  {
+    static thread_local buffer_owner owner;
+
+    for (auto& b : owner.buffers)
+      if (b.first == id)
+        return *b.second;
+
+    // Allocated in full now, so that recording never reallocates
+    auto created = std::make_shared<thread_buffer>();
+    created->events.reserve(capacity);
+    owner.buffers.push_back(std::make_pair(id, created));
+
+    std::lock_guard<std::mutex> guard(buffers_lock);
+    created->thread = buffers.size() + 1;
+    buffers.push_back(created);
+
+    return *created;
+  }
+
+public:
+  /* @brief Constructor for tracer
+   *
+   * @param events Maximum number of events held per thread, after which
+   *        further events are dropped. Each thread's buffer is allocated at
+   *        this size when it first records
+   */
+  tracer(size_t events=1 << 16)
+    : capacity(events), id(next_id())
+  { }
+
+  tracer(const tracer&) = delete;
+  tracer& operator=(const tracer&) = delete;
+
+  /* @brief Function to allocate the calling thread's buffer ahead of its
+   *        first event, e.g. before a latency sensitive loop
+   */
+  void attach()
+  {
+    local_buffer();
+  }
+
+  /* @brief Function to get the process-wide tracer used by the CYRIAL_TRACE_*
+   *        macros
+   */
+  static tracer& instance()
+  {
+    static tracer global;
+
+    return global;
+  }
+
+  static uint64_t now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  /* @brief Function to record an event from the calling thread
+   */
+  void record(const trace_event& e)
+  {
+    thread_buffer& b = local_buffer();
+    std::lock_guard<std::mutex> guard(b.lock);
+
+    if (b.events.size() < capacity)
+      b.events.push_back(e);
+    else
+      ++b.dropped;
+  }
+
+  /* @brief Function to discard every recorded event
+   */
+  void clear()
+  {
+    std::lock_guard<std::mutex> guard(buffers_lock);
+
+    for (const auto& b : buffers)
+    {
+      std::lock_guard<std::mutex> buffer_guard(b->lock);
+      b->events.clear();
+      b->dropped = 0;
+    }
+  }
+
+  /* @brief Function to write the recorded events in the Chrome trace event
+   *        JSON format, which Perfetto also opens
+   *
+   * Each thread is a track, and events carry the index of their port as an
+   * argument
+   *
+   * @param out Stream to write to
+   */
+  void write_chrome_json(std::ostream& out)
+  {
+    std::lock_guard<std::mutex> guard(buffers_lock);
+    std::vector<std::unique_lock<std::mutex>> held;
+    uint64_t origin = UINT64_MAX;
+    char line[256];
+    bool first = true;
+
+    // Timestamps are relative to the earliest event
+    for (const auto& b : buffers)
+    {
+      held.emplace_back(b->lock);
+
+      for (const auto& e : b->events)
+        origin = std::min(origin, e.start);
+    }
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+    for (const auto& b : buffers)
+    {
+      std::snprintf(line, sizeof(line),
+                    "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                    "\"tid\":%zu,\"args\":{\"name\":\"thread %zu\"}}",
+                    first ? "" : ",", b->thread, b->thread);
+      out << line;
+      first = false;
+
+      for (const auto& e : b->events)
+      {
+        // Timestamps are in microseconds
+        double ts = (e.start - origin) * 1e-3;
+
+        if (e.instant)
+          std::snprintf(line, sizeof(line),
+                        ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\","
+                        "\"ts\":%.3f,\"pid\":1,\"tid\":%zu,"
+                        "\"args\":{\"port\":%lld}}",
+                        e.name, ts, b->thread, (long long)e.port);
+        else
+          std::snprintf(line, sizeof(line),
+                        ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+                        "\"dur\":%.3f,\"pid\":1,\"tid\":%zu,"
+                        "\"args\":{\"port\":%lld}}",
+                        e.name, ts, e.duration * 1e-3, b->thread,
+                        (long long)e.port);
+
+        out << line;
+      }
+    }
+
+    out << "\n]}\n";
+  }
+
+  /* @brief Function to count the events dropped because a thread's buffer
+   *        was full
+   */
+  size_t dropped()
+  {
+    std::lock_guard<std::mutex> guard(buffers_lock);
+    size_t total = 0;
+
+    for (const auto& b : buffers)
+    {
+      std::lock_guard<std::mutex> buffer_guard(b->lock);
+      total += b->dropped;
+    }
+
+    return total;
+  }
+};
+
+/* @class trace_span
+ *
+ * @brief Records the lifetime of a scope as a span
+ */
+class trace_span
+{
+  const char* name;
+  int64_t port;
+  uint64_t start;
+
+public:
+  trace_span(const char* span_name, int64_t span_port=-1)
+    : name(span_name), port(span_port), start(tracer::now())
+  { }
+
+  trace_span(const trace_span&) = delete;
+  trace_span& operator=(const trace_span&) = delete;
+
+  ~trace_span()
+  {
+    tracer::instance().record(
+      trace_event{ name, port, start, tracer::now() - start, false });
+  }
+};
+
+/* @brief Function to record an instant, e.g. the arrival of the first byte
+ */
+inline void trace_instant(const char* name, int64_t port=-1)
+{
+  tracer::instance().record(
+    trace_event{ name, port, tracer::now(), 0, true });
+}
+
+} // namespace cyrial
+
+#define CYRIAL_TRACE_CONCAT_(a, b) a##b
+#define CYRIAL_TRACE_CONCAT(a, b) CYRIAL_TRACE_CONCAT_(a, b)
+
+/* @brief Macros to trace the enclosing scope as a span, and to mark an
+ *        instant. Names must have static storage, e.g. string literals
+ */
+#ifdef CYRIAL_TRACE
+#define CYRIAL_TRACE_SPAN(name, port)                                         \
+  ::cyrial::trace_span CYRIAL_TRACE_CONCAT(cyrial_trace_span_, __LINE__)(     \
+    name, (int64_t)(port))
+#define CYRIAL_TRACE_INSTANT(name, port)                                      \
+  ::cyrial::trace_instant(name, (int64_t)(port))
+#else
+#define CYRIAL_TRACE_SPAN(name, port) do { } while (0)
+#define CYRIAL_TRACE_INSTANT(name, port) do { } while (0)
+#endif
+
+#endif // CYRIAL_TRACE_HPP